@@ -52,14 +52,20 @@
 #include <bitset>
 #include <list>
 #include <map>
+#include <memory>
 #include <set>
 #include <string>
 #include <vector>
 
+#include <cstring>
 #include <exception>
 
 #ifndef MMD_WINDOWS
 #include <iconv.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 #include "util/dwarf.inl"
@@ -101,6 +107,8 @@ namespace mmd {
 #include "reader/motion_reader.inl"
 
 #include "reader/pmd_reader.inl"
+#include "reader/pmx_reader.inl"
+#include "reader/interprete/vmd_types.inl"
 
 namespace mmd {
 #include "mmd_facility_impl.inl"
@@ -81,6 +81,11 @@ namespace mmd {
             std::uint8_t face_type;
         };
 
+        struct PACKED pmd_face_vertex {
+            std::uint32_t vertex_index;
+            Vector3f offset;
+        };
+
         struct PACKED pmd_rigid_body {
             mmd_string<20> name;
             std::uint16_t bone_index;
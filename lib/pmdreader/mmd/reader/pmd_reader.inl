@@ -13,11 +13,27 @@
 
 namespace mmd {
 
+    /**
+      The vertex and index blocks of a PMD file, left in place for callers
+      that decode them straight into their own arrays. The views are valid
+      as long as the FileReader they were read from.
+    **/
+    struct PmdGeometry {
+        array_view<interprete::pmd_vertex> vertices;
+        array_view<std::uint8_t> index_block;  // uint16 indices, unaligned
+
+        size_t GetIndexNum() const;
+        size_t DecodeIndex(size_t i) const;
+    };
+
     class PmdReader : public ModelReader {
     public:
         PmdReader(FileReader &file);
         /*virtual*/ void ReadModel(Model &model);
+        // Read all but the vertices and triangles, which go to geometry.
+        void ReadModel(Model &model, PmdGeometry &geometry);
     private:
+        void Read(Model &model, PmdGeometry *geometry);
         FileReader &file_;
     };
 
@@ -11,11 +11,33 @@
     Toorisugari no Kioku - http://blog.goo.ne.jp/torisu_tetosuki/
 **/
 
+inline size_t
+PmdGeometry::GetIndexNum() const {
+    return index_block.size()/sizeof(std::uint16_t);
+}
+
+inline size_t
+PmdGeometry::DecodeIndex(size_t i) const {
+    std::uint16_t index;
+    memcpy(&index, index_block.data()+i*sizeof(index), sizeof(index));
+    return (size_t)index;
+}
+
 inline
 PmdReader::PmdReader(FileReader &file) : file_(file) {}
 
 inline void
 PmdReader::ReadModel(Model &model) {
+    Read(model, NULL);
+}
+
+inline void
+PmdReader::ReadModel(Model &model, PmdGeometry &geometry) {
+    Read(model, &geometry);
+}
+
+inline void
+PmdReader::Read(Model &model, PmdGeometry *geometry) {
     try {
         file_.Reset();
 
@@ -33,8 +55,14 @@ PmdReader::ReadModel(Model &model) {
         model.SetDescription(ShiftJISToUTF16String(header.info.description));
 
         size_t vertex_num = file_.Read<std::uint32_t>();
+        array_view<interprete::pmd_vertex> vertices
+            = file_.ReadArray<interprete::pmd_vertex>(vertex_num);
+        if(geometry!=NULL) {
+            geometry->vertices = vertices;
+            vertex_num = 0;
+        }
         for(size_t i=0;i<vertex_num;++i) {
-            interprete::pmd_vertex pv = file_.Read<interprete::pmd_vertex>();
+            const interprete::pmd_vertex &pv = vertices[i];
 
             Model::Vertex<ref> vertex = model.NewVertex();
             Model::SkinningOperator &op = vertex.GetSkinningOperator();
@@ -50,11 +78,20 @@ PmdReader::ReadModel(Model &model) {
             op.GetBDEF2().SetBoneWeight(pv.skinning_weight*0.01f);
         }
 
-        size_t triangle_num = file_.Read<std::uint32_t>()/3;
+        size_t index_num = file_.Read<std::uint32_t>();
+        // The block starts at an odd offset, indices are copied out of it.
+        PmdGeometry indices;
+        indices.index_block = file_.ReadArray<std::uint8_t>(
+            index_num*sizeof(std::uint16_t));
+        size_t triangle_num = index_num/3;
+        if(geometry!=NULL) {
+            geometry->index_block = indices.index_block;
+            triangle_num = 0;
+        }
         for(size_t i=0;i<triangle_num;++i) {
             Vector3D<std::uint32_t> &triangle = model.NewTriangle();
             for(size_t j=0;j<3;++j) {
-                triangle.v[j] = file_.Read<std::uint16_t>();
+                triangle.v[j] = indices.DecodeIndex(i*3+j);
             }
         }
 
@@ -369,11 +406,13 @@ PmdReader::ReadModel(Model &model) {
                 base_morph_index = i;
             }
             morph.SetType(Model::Morph::MORPH_TYPE_VERTEX);
-            for(size_t j=0;j<fp.vertex_num;++j) {
+            array_view<interprete::pmd_face_vertex> face_vertices
+                = file_.ReadArray<interprete::pmd_face_vertex>(fp.vertex_num);
+            for(size_t j=0;j<face_vertices.size();++j) {
                 Model::Morph::MorphData::VertexMorph &vertex_morph_data
                     = morph.NewMorphData().GetVertexMorph();
-                vertex_morph_data.SetVertexIndex(file_.Read<std::uint32_t>());
-                vertex_morph_data.SetOffset(file_.Read<Vector3f>());
+                vertex_morph_data.SetVertexIndex(face_vertices[j].vertex_index);
+                vertex_morph_data.SetOffset(face_vertices[j].offset);
             }
         }
 
@@ -13,11 +13,52 @@
 
 namespace mmd {
 
+    /**
+      One PMX vertex as decoded by PmxGeometry. Unused bones and weights
+      of the skinning type are zero, c, r0 and r1 are only set for SDEF.
+    **/
+    struct PmxVertex {
+        Vector3f coordinate;
+        Vector3f normal;
+        Vector2f uv_coordinate;
+        Model::SkinningOperator::SkinningType skinning_type;
+        size_t bone_id[4];
+        float bone_weight[4];
+        Vector3f c, r0, r1;
+    };
+
+    /**
+      The vertex and index blocks of a PMX file, left in place like
+      PmdGeometry. PMX vertices vary in size, so the reader records where
+      each one starts, and any of them can then be decoded on its own.
+    **/
+    struct PmxGeometry {
+        PmxGeometry() : extra_uv_number(0), bone_index_size(0),
+            vertex_index_size(0), has_sdef(false) {}
+
+        array_view<std::uint8_t> vertex_block;
+        std::vector<size_t> vertex_offsets;
+        array_view<std::uint8_t> index_block;
+        size_t extra_uv_number;
+        size_t bone_index_size;
+        size_t vertex_index_size;
+        bool has_sdef;
+
+        size_t GetVertexNum() const;
+        size_t GetIndexNum() const;
+        void DecodeVertex(size_t i, PmxVertex &vertex) const;
+        size_t DecodeIndex(size_t i) const;
+    };
+
     class PmxReader : public ModelReader {
     public:
         PmxReader(FileReader &file);
         /*virtual*/ void ReadModel(Model &model);
+        // Read all but the vertices and triangles, which go to geometry.
+        void ReadModel(Model &model, PmxGeometry &geometry);
     private:
+        void Read(Model &model, PmxGeometry *geometry);
+        void LocateVertices(size_t vertex_num, PmxGeometry &geometry);
         FileReader &file_;
     };
 
@@ -10,11 +10,154 @@
   Reference:
     PMX Specification, which could be found in 'Lib/' directory of PMDEditor.
 **/
+namespace interprete {
+    inline size_t pmx_index_at(const std::uint8_t *p, size_t byte_size) {
+        switch(byte_size) {
+        case 1:
+            return (size_t)*p;
+        case 2:
+            {
+                std::uint16_t i;
+                memcpy(&i, p, sizeof(i));
+                return (size_t)i;
+            }
+        default:
+            {
+                std::int32_t i;
+                memcpy(&i, p, sizeof(i));
+                return (size_t)i;
+            }
+        }
+    }
+}
+
+inline size_t
+PmxGeometry::GetVertexNum() const {
+    return vertex_offsets.size();
+}
+
+inline size_t
+PmxGeometry::GetIndexNum() const {
+    return vertex_index_size>0?index_block.size()/vertex_index_size:0;
+}
+
+inline void
+PmxGeometry::DecodeVertex(size_t i, PmxVertex &vertex) const {
+    const std::uint8_t *p = vertex_block.data()+vertex_offsets[i];
+    interprete::pmx_vertex_basic pv;
+    memcpy(&pv, p, sizeof(pv));
+    p += sizeof(pv)+extra_uv_number*sizeof(Vector4f);
+    vertex.coordinate = pv.coordinate;
+    vertex.normal = pv.normal;
+    vertex.uv_coordinate = pv.uv_coordinate;
+    vertex.skinning_type = (Model::SkinningOperator::SkinningType)*p++;
+    for(size_t j=0;j<4;++j) {
+        vertex.bone_id[j] = 0;
+        vertex.bone_weight[j] = 0.0f;
+    }
+    size_t bone_num = 0;
+    switch(vertex.skinning_type) {
+    case Model::SkinningOperator::SKINNING_BDEF1:
+        bone_num = 1;
+        break;
+    case Model::SkinningOperator::SKINNING_BDEF2:
+    case Model::SkinningOperator::SKINNING_SDEF:
+        bone_num = 2;
+        break;
+    case Model::SkinningOperator::SKINNING_BDEF4:
+        bone_num = 4;
+        break;
+    }
+    for(size_t j=0;j<bone_num;++j) {
+        vertex.bone_id[j] = interprete::pmx_index_at(p, bone_index_size);
+        p += bone_index_size;
+    }
+    switch(vertex.skinning_type) {
+    case Model::SkinningOperator::SKINNING_BDEF1:
+        vertex.bone_weight[0] = 1.0f;
+        break;
+    case Model::SkinningOperator::SKINNING_BDEF4:
+        memcpy(vertex.bone_weight, p, 4*sizeof(float));
+        break;
+    default:
+        memcpy(&vertex.bone_weight[0], p, sizeof(float));
+        vertex.bone_weight[1] = 1.0f-vertex.bone_weight[0];
+        p += sizeof(float);
+        if(vertex.skinning_type==Model::SkinningOperator::SKINNING_SDEF) {
+            memcpy(&vertex.c, p, sizeof(Vector3f));
+            memcpy(&vertex.r0, p+sizeof(Vector3f), sizeof(Vector3f));
+            memcpy(&vertex.r1, p+2*sizeof(Vector3f), sizeof(Vector3f));
+        }
+        break;
+    }
+}
+
+inline size_t
+PmxGeometry::DecodeIndex(size_t i) const {
+    return interprete::pmx_index_at(
+        index_block.data()+i*vertex_index_size, vertex_index_size
+    );
+}
+
 inline
 PmxReader::PmxReader(FileReader &file) : file_(file) {}
 
 inline void
 PmxReader::ReadModel(Model &model) {
+    Read(model, NULL);
+}
+
+inline void
+PmxReader::ReadModel(Model &model, PmxGeometry &geometry) {
+    Read(model, &geometry);
+}
+
+/**
+  Walk the vertex block only as far as needed to find where every vertex
+  starts, then leave the whole block to geometry.
+**/
+inline void
+PmxReader::LocateVertices(size_t vertex_num, PmxGeometry &geometry) {
+    size_t bone_index_size = geometry.bone_index_size;
+    size_t start = file_.GetPosition();
+    geometry.vertex_offsets.clear();
+    geometry.vertex_offsets.reserve(vertex_num);
+    geometry.has_sdef = false;
+    for(size_t i=0;i<vertex_num;++i) {
+        geometry.vertex_offsets.push_back(file_.GetPosition()-start);
+        file_.ReadArray<std::uint8_t>(
+            sizeof(interprete::pmx_vertex_basic)
+            +geometry.extra_uv_number*sizeof(Vector4f)
+        );
+        size_t skinning_size;
+        switch(file_.Read<std::int8_t>()) {
+        case Model::SkinningOperator::SKINNING_BDEF1:
+            skinning_size = bone_index_size;
+            break;
+        case Model::SkinningOperator::SKINNING_BDEF2:
+            skinning_size = 2*bone_index_size+sizeof(float);
+            break;
+        case Model::SkinningOperator::SKINNING_BDEF4:
+            skinning_size = 4*bone_index_size+4*sizeof(float);
+            break;
+        case Model::SkinningOperator::SKINNING_SDEF:
+            skinning_size = 2*bone_index_size+sizeof(float)+3*sizeof(Vector3f);
+            geometry.has_sdef = true;
+            break;
+        default:
+            throw exception(
+                std::string("PmxReader: Invalid skinning specification")
+            );
+        }
+        file_.ReadArray<std::uint8_t>(skinning_size+sizeof(float));
+    }
+    size_t end = file_.GetPosition();
+    file_.Seek(start);
+    geometry.vertex_block = file_.ReadArray<std::uint8_t>(end-start);
+}
+
+inline void
+PmxReader::Read(Model &model, PmxGeometry *geometry) {
     try {
         file_.Reset();
 
@@ -48,6 +191,19 @@ PmxReader::ReadModel(Model &model) {
         model.SetDescriptionEn(file_.ReadString(utf8_encoding));
 
         size_t vertex_num = (size_t)file_.Read<std::int32_t>();
+        if(geometry!=NULL) {
+            if(
+                (vertex_index_size!=1&&vertex_index_size!=2&&vertex_index_size!=4)||
+                (bone_index_size!=1&&bone_index_size!=2&&bone_index_size!=4)
+            ) {
+                throw exception(std::string("FileReader: Invalid byte size"));
+            }
+            geometry->extra_uv_number = extra_UV_number;
+            geometry->bone_index_size = bone_index_size;
+            geometry->vertex_index_size = vertex_index_size;
+            LocateVertices(vertex_num, *geometry);
+            vertex_num = 0;
+        }
         for(size_t i=0;i<vertex_num;++i) {
             interprete::pmx_vertex_basic pv
                 = file_.Read<interprete::pmx_vertex_basic>();
@@ -101,7 +257,18 @@ PmxReader::ReadModel(Model &model) {
             vertex.SetEdgeScale(file_.Read<float>());
         }
 
-        size_t triangle_num = (size_t)file_.Read<std::int32_t>()/3;
+        size_t index_num = (size_t)file_.Read<std::int32_t>();
+        size_t triangle_num = index_num/3;
+        if(geometry!=NULL) {
+            if(index_num>file_.GetLength()/vertex_index_size) {
+                throw exception(
+                    std::string("FileReader: Buffer length exceeded")
+                );
+            }
+            geometry->index_block
+                = file_.ReadArray<std::uint8_t>(index_num*vertex_index_size);
+            triangle_num = 0;
+        }
         for(size_t i=0;i<triangle_num;++i) {
             Vector3D<std::uint32_t> &triangle = model.NewTriangle();
             for(size_t j=0;j<3;++j) {
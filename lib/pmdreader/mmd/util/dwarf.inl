@@ -68,6 +68,29 @@ namespace mmd {
     };
 #include "unpack.inc"
 
+    /**
+      A read-only view of count consecutive T in the file contents, valid
+      as long as the FileReader it came from. The contents have no
+      alignment, so T must be a byte or a packed struct.
+    **/
+    template<typename T>
+    class array_view
+    {
+    public:
+        array_view() : data_(NULL), size_(0) {}
+        array_view(const T *data, size_t size) : data_(data), size_(size) {}
+
+        const T* data() const { return data_; }
+        size_t size() const { return size_; }
+        bool empty() const { return size_==0; }
+        const T* begin() const { return data_; }
+        const T* end() const { return data_+size_; }
+        const T& operator[](size_t i) const { return data_[i]; }
+    private:
+        const T *data_;
+        size_t size_;
+    };
+
     class FileReader
     {
     public:
@@ -79,12 +102,12 @@ namespace mmd {
         static bool FileExists(const std::wstring &filename);
 
         template<typename T> T Read();
+        template<typename T> array_view<T> ReadArray(size_t count);
         size_t ReadIndex(size_t byte_size);
         std::string ReadAnsiString();
         std::wstring ReadString(bool utf8 = false);
 
         buffer_type& GetBuffer();
-        const buffer_type& GetBuffer() const;
         void Reset();
 
         const std::wstring& GetPath() const;
@@ -98,8 +121,16 @@ namespace mmd {
         ptrdiff_t GetRemainedLength() const;
     private:
         void Initialize();
+        bool Map();
+        void CheckLength(size_t length) const;
         std::wstring path_;
-        buffer_type buffer_;
+        // The file is mapped when it can be, else read into buffer_, and
+        // data_ points at either. GetBuffer copies a mapping into buffer_
+        // and keeps the mapping in mapping_, for the views already out.
+        std::shared_ptr<buffer_type> buffer_;
+        std::shared_ptr<const std::uint8_t> data_;
+        std::shared_ptr<const std::uint8_t> mapping_;
+        size_t length_;
         size_t cursor_;
     };
 
@@ -28,7 +28,40 @@ template<size_t length> inline mmd_string<length>::operator std::string () const
     return std::string(buffer);
 }
 
+inline bool FileReader::Map() {
+#ifdef MMD_WINDOWS
+    return false;
+#else
+    int fd = open(UTF16ToNativeString(path_).c_str(), O_RDONLY);
+    if(fd<0) {
+        return false;
+    }
+    struct stat st;
+    // Pipes and other streams have no length to map, they are read.
+    if(fstat(fd, &st)!=0||!S_ISREG(st.st_mode)||st.st_size<=0) {
+        close(fd);
+        return false;
+    }
+    size_t file_length = (size_t)st.st_size;
+    void *p = mmap(NULL, file_length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(p==MAP_FAILED) {
+        return false;
+    }
+    madvise(p, file_length, MADV_SEQUENTIAL);
+    data_.reset(static_cast<const std::uint8_t*>(p),
+        [file_length](const std::uint8_t *q) {
+            munmap(const_cast<std::uint8_t*>(q), file_length);
+        });
+    length_ = file_length;
+    return true;
+#endif
+}
+
 inline void FileReader::Initialize() {
+    if(Map()) {
+        return;
+    }
 #ifdef MMD_WINDOWS
     FILE *f = _wfopen(path_.c_str(), L"rb");
 #else
@@ -37,26 +70,29 @@ inline void FileReader::Initialize() {
     if(f==NULL) {
         throw exception(std::string("FileReader: Cannot open file."));
     }
-    fseek(f, 0, SEEK_END);
-    size_t file_length = (size_t)ftell(f);
-    if(file_length==0) {
-        fclose(f);
-        throw exception(std::string("FileReader: File is empty."));
+    // Read in chunks until the end, the length of a stream is not known.
+    buffer_ = std::make_shared<buffer_type>();
+    std::uint8_t chunk[65536];
+    size_t n;
+    while((n = fread(chunk, 1, sizeof(chunk), f))>0) {
+        buffer_->insert(buffer_->end(), chunk, chunk+n);
     }
-    fseek(f, 0, SEEK_SET);
-    buffer_.assign(file_length, 0);
-    fread(&buffer_[0], 1, file_length, f);
     fclose(f);
+    if(buffer_->empty()) {
+        throw exception(std::string("FileReader: File is empty."));
+    }
+    data_ = std::shared_ptr<const std::uint8_t>(buffer_, buffer_->data());
+    length_ = buffer_->size();
 }
 
-inline FileReader::FileReader() : cursor_(0) {}
+inline FileReader::FileReader() : length_(0), cursor_(0) {}
 
-inline FileReader::FileReader(const std::string &filename) : path_(NativeToUTF16String(filename)), cursor_(0)
+inline FileReader::FileReader(const std::string &filename) : path_(NativeToUTF16String(filename)), length_(0), cursor_(0)
 {
     Initialize();
 }
 
-inline FileReader::FileReader(const std::wstring &filename) : path_(filename), cursor_(0)
+inline FileReader::FileReader(const std::wstring &filename) : path_(filename), length_(0), cursor_(0)
 {
     Initialize();
 }
@@ -74,65 +110,95 @@ inline bool FileReader::FileExists(const std::wstring &filename) {
     return result;
 }
 
-template<typename T> inline T FileReader::Read() {
-    if(cursor_+sizeof(T)>buffer_.size()) {
+inline void FileReader::CheckLength(size_t length) const {
+    if(length>length_||cursor_>length_-length) {
         throw exception(std::string("FileReader: Buffer length exceeded"));
     }
-    T t = *reinterpret_cast<T*>(&buffer_[cursor_]);
+}
+
+template<typename T> inline T FileReader::Read() {
+    CheckLength(sizeof(T));
+    T t;
+    memcpy(&t, data_.get()+cursor_, sizeof(T));
     cursor_ += sizeof(T);
     return t;
 }
 
-inline size_t FileReader::ReadIndex(size_t byte_size) {
-    if(cursor_+byte_size>buffer_.size()) {
+template<typename T> inline array_view<T> FileReader::ReadArray(size_t count) {
+    static_assert(alignof(T)==1, "FileReader: ReadArray needs a packed type");
+    if(count>length_/sizeof(T)) {
         throw exception(std::string("FileReader: Buffer length exceeded"));
     }
+    CheckLength(count*sizeof(T));
+    array_view<T> view(reinterpret_cast<const T*>(data_.get()+cursor_), count);
+    cursor_ += count*sizeof(T);
+    return view;
+}
+
+inline size_t FileReader::ReadIndex(size_t byte_size) {
+    CheckLength(byte_size);
     size_t result;
     switch(byte_size) {
     case 1:
-        result = (size_t)(*reinterpret_cast<std::uint8_t*>(&buffer_[cursor_]));
+        result = (size_t)Read<std::uint8_t>();
         break;
     case 2:
-        result = (size_t)(*reinterpret_cast<std::uint16_t*>(&buffer_[cursor_]));
+        result = (size_t)Read<std::uint16_t>();
         break;
     case 4:
-        result = (size_t)(*reinterpret_cast<std::int32_t*>(&buffer_[cursor_]));
+        result = (size_t)Read<std::int32_t>();
         break;
     default:
         throw exception(std::string("FileReader: Invalid byte size"));
     }
-    cursor_ += byte_size;
     return result;
 }
 
 inline std::string FileReader::ReadAnsiString() {
     size_t length = (size_t)Read<std::int32_t>();
-    if(cursor_+length>buffer_.size()) {
-        throw exception(std::string("FileReader: Buffer length exceeded"));
-    }
+    CheckLength(length);
     cursor_ += length;
-    return std::string((char*)&buffer_[cursor_-length], length);
+    return std::string((const char*)data_.get()+cursor_-length, length);
 }
 
 inline std::wstring FileReader::ReadString(bool utf8) {
     size_t length = (size_t)Read<std::int32_t>();
-    if(cursor_+length>buffer_.size()) {
-        throw exception(std::string("FileReader: Buffer length exceeded"));
-    }
+    CheckLength(length);
     cursor_ += length;
+    const std::uint8_t *begin = data_.get()+cursor_-length;
     if(!utf8) {
 #ifdef MMD_WINDOWS
-        return std::wstring((wchar_t*)&buffer_[cursor_-length], length/sizeof(wchar_t));
+        return std::wstring((const wchar_t*)begin, length/sizeof(wchar_t));
 #else
-        return std::wstring((std::uint16_t*)&buffer_[cursor_-length], (std::uint16_t*)&buffer_[cursor_]);
+        // wchar_t holds whole code points here, join the surrogate pairs.
+        std::wstring ws;
+        ws.reserve(length/2);
+        for(size_t k=0;k+1<length;k+=2) {
+            std::uint32_t c = begin[k]|(begin[k+1]<<8);
+            if(c>=0xD800&&c<0xDC00&&k+3<length) {
+                std::uint32_t low = begin[k+2]|(begin[k+3]<<8);
+                if(low>=0xDC00&&low<0xE000) {
+                    c = 0x10000+((c-0xD800)<<10)+(low-0xDC00);
+                    k += 2;
+                }
+            }
+            ws.push_back((wchar_t)c);
+        }
+        return ws;
 #endif
     } else {
-        return UTF8ToUTF16String(std::string((char*)&buffer_[cursor_-length], length));
+        return UTF8ToUTF16String(std::string((const char*)begin, length));
     }
 }
 
-inline buffer_type& FileReader::GetBuffer() { return buffer_; }
-inline const buffer_type& FileReader::GetBuffer() const { return buffer_; }
+inline buffer_type& FileReader::GetBuffer() {
+    if(!buffer_) {
+        buffer_ = std::make_shared<buffer_type>(data_.get(), data_.get()+length_);
+        mapping_ = data_;
+        data_ = std::shared_ptr<const std::uint8_t>(buffer_, buffer_->data());
+    }
+    return *buffer_;
+}
 inline void FileReader::Reset() { cursor_ = 0; }
 
 inline const std::wstring& FileReader::GetPath() const {
@@ -156,13 +222,13 @@ inline std::wstring FileReader::GetLocation() const {
 }
 
 inline void FileReader::Seek(size_t position) {
-    if(position<=buffer_.size()) {
+    if(position<=length_) {
         cursor_ = position;
     }
 }
 
 inline size_t FileReader::GetLength() const {
-    return buffer_.size();
+    return length_;
 }
 
 inline size_t FileReader::GetPosition() const {
@@ -170,7 +236,7 @@ inline size_t FileReader::GetPosition() const {
 }
 
 inline ptrdiff_t FileReader::GetRemainedLength() const {
-    return buffer_.size()-cursor_;
+    return length_-cursor_;
 }
 
 
@@ -204,11 +270,41 @@ inline std::wstring NativeToUTF16String(const std::string &s) {
     return ws;
 }
 
+inline void AppendCodePoint(std::wstring &ws, std::uint32_t c) {
+#ifdef MMD_WINDOWS
+    if(c>=0x10000) {
+        c -= 0x10000;
+        ws.push_back((wchar_t)(0xD800+(c>>10)));
+        ws.push_back((wchar_t)(0xDC00+(c&0x3FF)));
+        return;
+    }
+#endif
+    ws.push_back((wchar_t)c);
+}
+
+// Decoded by hand, the C locale of mbstowcs only knows ASCII.
 inline std::wstring UTF8ToUTF16String(const std::string &s) {
-    std::string c_locale = setlocale(LC_ALL, NULL);
-    setlocale(LC_ALL, "C");
-    std::wstring ws = s2ws(s);
-    setlocale(LC_ALL, c_locale.c_str());
+    std::wstring ws;
+    ws.reserve(s.size());
+    size_t i = 0;
+    while(i<s.size()) {
+        std::uint8_t c = (std::uint8_t)s[i];
+        size_t n = c<0x80?0:c<0xE0?1:c<0xF0?2:3;
+        std::uint32_t cp = n==0?c:c&(0x3F>>n);
+        bool valid = (c<0x80||c>=0xC0)&&i+n<s.size();
+        for(size_t k=1;valid&&k<=n;++k) {
+            std::uint8_t cc = (std::uint8_t)s[i+k];
+            valid = (cc&0xC0)==0x80;
+            cp = (cp<<6)|(cc&0x3F);
+        }
+        if(!valid) {
+            ws.push_back(L'?');
+            ++i;
+            continue;
+        }
+        AppendCodePoint(ws, cp);
+        i += n+1;
+    }
     return ws;
 }
 
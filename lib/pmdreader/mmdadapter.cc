@@ -6,6 +6,7 @@
 #include "mmdadapter.h"
 #include "mmd/mmdslim.hh"
 #include "bitmap.h"
+#include <algorithm>
 #include <iostream>
 #include <exception>
 #include <unordered_map>
@@ -38,13 +39,26 @@ namespace {
 		lhs[1] = rhs.v[1];
 		return lhs;
 	}
-	glm::uvec3 conv(const mmd::Vector3D<std::uint32_t>& rhs)
+
+	// Vertex count above which a block is decoded by several threads.
+	const size_t kParallelDecode = 4096;
+
+	const char kVmdMagic[] = "Vocaloid Motion Data 0002";
+
+	// Shift-JIS names come out of iconv with a byte order mark, PMX
+	// names without. Drop it so both compare equal.
+	std::wstring boneName(const std::wstring& name)
 	{
-		glm::uvec3 lhs;
-		lhs[0] = rhs.v[0];
-		lhs[1] = rhs.v[1];
-		lhs[2] = rhs.v[2];
-		return lhs;
+		if (!name.empty() && name[0] == 0xFEFF)
+			return name.substr(1);
+		return name;
+	}
+
+	// Bezier control points of one VMD interpolation channel.
+	glm::vec4 curve(const std::int8_t* c)
+	{
+		const float r = 1.0f / 127.0f;
+		return glm::vec4(c[0] * r, c[4] * r, c[8] * r, c[12] * r);
 	}
 };
 
@@ -72,9 +86,18 @@ public:
 	bool open(const std::string& fn)
 	{
 		try {
-			mmd::FileReader file(fn);
-			mmd::PmdReader reader(file);
-			reader.ReadModel(model_);
+			// The vertex and index blocks stay in the file until the
+			// mesh is asked for, so the file outlives the reader.
+			file_ = mmd::FileReader(fn);
+			is_pmx_ = file_.GetLength() >= 4 &&
+				memcmp(file_.ReadArray<std::uint8_t>(4).data(), "PMX ", 4) == 0;
+			if (is_pmx_) {
+				mmd::PmxReader reader(file_);
+				reader.ReadModel(model_, pmx_geometry_);
+			} else {
+				mmd::PmdReader reader(file_);
+				reader.ReadModel(model_, geometry_);
+			}
 
 			size_t useful_bone_id = 0;
 			for (size_t i = 0; i < model_.GetBoneNum(); i++) {
@@ -86,6 +109,9 @@ public:
 				pmd_bone_to_useful_bone_[i] = useful_bone_id;
 				useful_bone_id++;
 			}
+			joint_of_bone_.assign(model_.GetBoneNum(), -1);
+			for (const auto& kv : pmd_bone_to_useful_bone_)
+				joint_of_bone_[kv.first] = kv.second;
 		} catch (std::exception& e) {
 			std::cerr << e.what() << endl;
 			return false;
@@ -98,24 +124,28 @@ public:
 		     std::vector<glm::vec4>& N,
 		     std::vector<glm::vec2>& UV)
 	{
-		size_t nv = model_.GetVertexNum();
+		long nv = vertexNum();
 		V.resize(nv);
 		N.resize(nv);
 		UV.resize(nv);
-		for (size_t i = 0; i < nv; i++) {
-			const auto& v = model_.GetVertex(i);
-			V[i] = conv(v.GetCoordinate());
-			N[i] = conv(v.GetNormal());
-			UV[i] = conv(v.GetUVCoordinate());
-			N[i][3] = 0.0f;
-			V[i][3] = 1.0f;
-		}
-		size_t nf = model_.GetTriangleNum();
-		F.resize(nf);
-		for (size_t i = 0; i < nf; i++) {
-			const auto& f = model_.GetTriangle(i);
-			F[i] = conv(f);
+#pragma omp parallel for schedule(static) if (size_t(nv) >= kParallelDecode)
+		for (long i = 0; i < nv; i++) {
+			RawVertex v;
+			readVertex(i, v);
+			V[i] = glm::vec4(v.position, 1.0f);
+			N[i] = glm::vec4(v.normal, 0.0f);
+			UV[i] = v.uv;
 		}
+		decodeTriangles(F);
+	}
+
+	bool getJointName(int useful_bone_id, std::wstring& name)
+	{
+		auto iter = useful_bone_to_pmd_bone_.find(useful_bone_id);
+		if (iter == useful_bone_to_pmd_bone_.end())
+			return false;
+		name = boneName(model_.GetBone(iter->second).GetName());
+		return true;
 	}
 
 	void getMaterial(std::vector<Material>& vm)
@@ -192,65 +222,398 @@ public:
 		return true;
 	}
 
+	/*
+	 * Influences of vertex i sorted by decreasing weight, with unused
+	 * slots zeroed. Return false if no influence is inside the joint tree.
+	 */
+	bool getVertexSkin(size_t i, VertexSkin& skin) const
+	{
+		RawVertex v;
+		readVertex(i, v);
+		if (v.type == mmd::Model::SkinningOperator::SKINNING_SDEF) {
+			skin.sdef = true;
+			skin.sdef_c = v.sdef_c;
+			skin.sdef_r0 = v.sdef_r0;
+			skin.sdef_r1 = v.sdef_r1;
+		}
+		return normalizeSkin(i, v.jid, v.weight, skin);
+	}
+
+	/*
+	 * Map the raw influences of vertex i to joints, renormalize and sort
+	 * them into skin. Return false if none is inside the joint tree.
+	 */
+	bool normalizeSkin(size_t i, const int jid[4], const float weight[4],
+			   VertexSkin& skin) const
+	{
+		int n = 0;
+		float sum = 0.0f;
+		for (int k = 0; k < 4; k++) {
+			if (jid[k] < 0 || weight[k] <= 0.0f)
+				continue;
+			int joint = usefulBone(jid[k]);
+			if (joint < 0)
+				continue;
+			skin.jid[n] = joint;
+			skin.weight[n] = weight[k];
+			sum += weight[k];
+			n++;
+		}
+		if (n == 0)
+			return false;
+		// SDEF needs both of its bones, degrade to linear blending otherwise.
+		if (n < 2)
+			skin.sdef = false;
+		for (int k = 0; k < n; k++)
+			skin.weight[k] /= sum;
+		for (int k = n; k < 4; k++) {
+			skin.jid[k] = skin.jid[0];
+			skin.weight[k] = 0.0f;
+		}
+		if (!skin.sdef) {
+			for (int k = 1; k < n; k++)
+				for (int m = k; m > 0 && skin.weight[m] > skin.weight[m - 1]; m--) {
+					std::swap(skin.weight[m], skin.weight[m - 1]);
+					std::swap(skin.jid[m], skin.jid[m - 1]);
+				}
+		}
+		skin.vid = i;
+		return true;
+	}
+
+	void getSkinning(std::vector<VertexSkin>& skins)
+	{
+		size_t nv = vertexNum();
+		skins.clear();
+		skins.reserve(nv);
+		VertexSkin skin;
+		for (size_t i = 0; i < nv; i++) {
+			skin = VertexSkin();
+			if (getVertexSkin(i, skin))
+				skins.emplace_back(skin);
+		}
+	}
+
+	void getMorphs(std::vector<VertexMorph>& morphs)
+	{
+		morphs.clear();
+		for (size_t i = 0; i < model_.GetMorphNum(); i++) {
+			const auto& morph = model_.GetMorph(i);
+			if (morph.GetType() != mmd::Model::Morph::MORPH_TYPE_VERTEX &&
+			    morph.GetType() != mmd::Model::Morph::MORPH_TYPE_GROUP)
+				continue;
+			// PMX has no base morph, its system category is a real morph.
+			if (!is_pmx_ &&
+			    morph.GetCategory() == mmd::Model::Morph::MORPH_CAT_SYSTEM &&
+			    morph.GetType() == mmd::Model::Morph::MORPH_TYPE_VERTEX)
+				continue;
+			std::map<int, glm::vec3> offsets;
+			collectMorph(i, 1.0f, offsets, 0);
+			if (offsets.empty())
+				continue;
+
+			VertexMorph vm;
+			const std::wstring& name = morph.GetNameEn().empty()
+				? morph.GetName() : morph.GetNameEn();
+			vm.name = mmd::UTF16ToNativeString(name);
+			vm.category = morph.GetCategory();
+			vm.vid.reserve(offsets.size());
+			vm.offset.reserve(offsets.size());
+			for (const auto& kv : offsets) {
+				vm.vid.emplace_back(kv.first);
+				vm.offset.emplace_back(kv.second);
+			}
+			morphs.emplace_back(std::move(vm));
+		}
+	}
+
+	void getIKChains(std::vector<IKChain>& chains)
+	{
+		chains.clear();
+		for (size_t i = 0; i < model_.GetBoneNum(); i++) {
+			const auto& bone = model_.GetBone(i);
+			if (!bone.IsHasIK() || bone.GetIKLinkNum() == 0)
+				continue;
+			IKChain chain;
+			chain.goal = usefulBone(i);
+			chain.target = usefulBone(bone.GetIKTargetIndex());
+			chain.iterations = bone.GetCCDIterateLimit();
+			chain.angle_limit = bone.GetCCDAngleLimit();
+			bool complete = chain.goal >= 0 && chain.target >= 0;
+			for (size_t j = 0; j < bone.GetIKLinkNum() && complete; j++) {
+				const auto& link = bone.GetIKLink(j);
+				int jid = usefulBone(link.GetLinkIndex());
+				complete = jid >= 0;
+				chain.links.emplace_back(jid);
+				chain.limited.emplace_back(link.IsHasLimit());
+				chain.lo.emplace_back(glm::vec3(conv(link.GetLoLimit())));
+				chain.hi.emplace_back(glm::vec3(conv(link.GetHiLimit())));
+			}
+			if (complete)
+				chains.emplace_back(std::move(chain));
+		}
+	}
+
+	void getPhysics(std::vector<RigidBody>& bodies,
+			std::vector<SpringConstraint>& constraints)
+	{
+		bodies.resize(model_.GetRigidBodyNum());
+		for (size_t i = 0; i < bodies.size(); i++) {
+			const auto& rb = model_.GetRigidBody(i);
+			RigidBody& body = bodies[i];
+			body.joint = usefulBone(rb.GetAssociatedBoneIndex());
+			body.shape = RigidBody::Shape(rb.GetShape());
+			body.type = RigidBody::Type(rb.GetType());
+			body.size = glm::vec3(conv(rb.GetDimensions()));
+			body.position = glm::vec3(conv(rb.GetPosition()));
+			body.rotation = glm::vec3(conv(rb.GetRotation()));
+			body.mass = rb.GetMass();
+			body.linear_damping = rb.GetTranslateDamp();
+			body.angular_damping = rb.GetRotateDamp();
+			body.restitution = rb.GetRestitution();
+			body.friction = rb.GetFriction();
+			body.group = rb.GetCollisionGroup();
+			body.mask = rb.GetCollisionMask().to_ulong();
+		}
+		constraints.resize(model_.GetConstraintNum());
+		for (size_t i = 0; i < constraints.size(); i++) {
+			const auto& c = model_.GetConstraint(i);
+			SpringConstraint& sc = constraints[i];
+			for (int k = 0; k < 2; k++) {
+				size_t b = c.GetAssociatedRigidBodyIndex(k);
+				sc.body[k] = b < bodies.size() ? int(b) : -1;
+			}
+			sc.position = glm::vec3(conv(c.GetPosition()));
+			sc.rotation = glm::vec3(conv(c.GetRotation()));
+			sc.lo_translation = glm::vec3(conv(c.GetPositionLowLimit()));
+			sc.hi_translation = glm::vec3(conv(c.GetPositionHighLimit()));
+			sc.lo_rotation = glm::vec3(conv(c.GetRotationLowLimit()));
+			sc.hi_rotation = glm::vec3(conv(c.GetRotationHighLimit()));
+			sc.spring_translation = glm::vec3(conv(c.GetSpringTranslate()));
+			sc.spring_rotation = glm::vec3(conv(c.GetSpringRotate()));
+		}
+	}
+
+	bool getSkinnedMesh(std::vector<glm::vec4>& V,
+			    std::vector<glm::uvec3>& F,
+			    std::vector<glm::vec4>& N,
+			    std::vector<glm::vec2>& UV,
+			    std::vector<glm::u16vec4>& joint_ids,
+			    std::vector<glm::u16vec4>& joint_weights)
+	{
+		// SDEF needs more than the four influences.
+		if (vertexNum() == 0 || (is_pmx_ && pmx_geometry_.has_sdef))
+			return false;
+		long nv = vertexNum();
+		V.resize(nv);
+		N.resize(nv);
+		UV.resize(nv);
+		joint_ids.resize(nv);
+		joint_weights.resize(nv);
+#pragma omp parallel for schedule(static) if (size_t(nv) >= kParallelDecode)
+		for (long i = 0; i < nv; i++) {
+			RawVertex v;
+			readVertex(i, v);
+			V[i] = glm::vec4(v.position, 1.0f);
+			N[i] = glm::vec4(v.normal, 0.0f);
+			UV[i] = v.uv;
+
+			VertexSkin skin;
+			if (!normalizeSkin(i, v.jid, v.weight, skin)) {
+				// Unbound vertices follow the root.
+				joint_ids[i] = glm::u16vec4(0);
+				joint_weights[i] = glm::u16vec4(65535, 0, 0, 0);
+				continue;
+			}
+			int total = 0;
+			for (int k = 0; k < 4; k++) {
+				joint_ids[i][k] = skin.jid[k];
+				joint_weights[i][k] = int(skin.weight[k] * 65535.0f + 0.5f);
+				total += joint_weights[i][k];
+			}
+			// Make the weights sum to exactly one after quantization.
+			joint_weights[i][0] += 65535 - total;
+		}
+		decodeTriangles(F);
+		return true;
+	}
+
 	void getJointWeights(std::vector<SparseTuple>& tup)
 	{
 		constexpr int SKINNING_BDEF1 = mmd::Model::SkinningOperator::SKINNING_BDEF1;
 		constexpr int SKINNING_BDEF2 = mmd::Model::SkinningOperator::SKINNING_BDEF2;
 		constexpr int SKINNING_BDEF4 = mmd::Model::SkinningOperator::SKINNING_BDEF4;
 		constexpr int SKINNING_SDEF = mmd::Model::SkinningOperator::SKINNING_SDEF;
-		size_t nv = model_.GetVertexNum();
+		size_t nv = vertexNum();
 		tup.clear();
 		tup.reserve(nv * 2);
+		RawVertex v;
 		for (size_t i = 0; i < nv; i++) {
-			const auto& v = model_.GetVertex(i);
-			int skt = v.GetSkinningOperator().GetSkinningType();
-
-			switch (skt) {
+			readVertex(i, v);
+			switch (v.type) {
 				case SKINNING_BDEF1:
 					{
-						const auto& bdef1 = v.GetSkinningOperator().GetBDEF1();
-						auto bid = pmd_bone_to_useful_bone_[bdef1.GetBoneID()];
+						int bid = usefulBone(v.jid[0]);
 						if (bid >= 0)
 							tup.emplace_back(i, bid, -1, 1.0f);
 					}
 					break;
 				case SKINNING_BDEF2:
 					{
-						const auto& bdef2 = v.GetSkinningOperator().GetBDEF2();
-						auto bid0 = pmd_bone_to_useful_bone_[bdef2.GetBoneID(0)];
-						auto bid1 = pmd_bone_to_useful_bone_[bdef2.GetBoneID(1)];
-						if (bid0 >= 0 && bid1 >= 0) {
-							tup.emplace_back(i, bid0, bid1, bdef2.GetBoneWeight());
-						}
+						int bid0 = usefulBone(v.jid[0]);
+						int bid1 = usefulBone(v.jid[1]);
+						if (bid0 >= 0 && bid1 >= 0)
+							tup.emplace_back(i, bid0, bid1, v.weight[0]);
 					}
 					break;
 				case SKINNING_BDEF4:
+				case SKINNING_SDEF:
 					{
-						std::cerr << "We are limited to models that each vertex only binds to at most two bones " << std::endl;
-						throw -1;
-						break;
-#if 0
-						const auto& bdef4 = v.GetSkinningOperator().GetBDEF4();
-						for (int i = 0 ; i < 4; i++) {
-							auto bid = pmd_bone_to_useful_bone_[bdef4.GetBoneID(i)];
-							if (bid < 0)
-								continue;
-							tup.emplace_back(bid, i, bdef4.GetBoneWeight(i));
-						}
-#endif
+						// Keep the two heaviest influences.
+						VertexSkin skin;
+						if (!getVertexSkin(i, skin))
+							break;
+						tup.emplace_back(i, skin.jid[0], skin.jid[1],
+								 skin.weight[0] / (skin.weight[0] + skin.weight[1]));
 					}
 					break;
-				case SKINNING_SDEF:
-					std::cerr << "Unexcepted SkinningOperator " << v.GetSkinningOperator().GetSkinningType() << std::endl;
-					throw -1;
-					break;
 			}
-			//std::cerr << bdef2.GetBoneID(0) << "\t" << bdef2.GetBoneID(1) << "\t" << bdef2.GetBoneWeight() << endl;
 		}
 	}
 private:
+	int usefulBone(size_t pmd_bone) const
+	{
+		return pmd_bone < joint_of_bone_.size() ? joint_of_bone_[pmd_bone] : -1;
+	}
+
+	/*
+	 * One vertex of the model, its influences still in PMD/PMX bone ids.
+	 * Models are read without their vertices and triangles, which are
+	 * decoded from geometry_ or pmx_geometry_ on demand.
+	 */
+	struct RawVertex {
+		glm::vec3 position, normal;
+		glm::vec2 uv;
+		int type;
+		int jid[4];
+		float weight[4];
+		glm::vec3 sdef_c, sdef_r0, sdef_r1;
+	};
+
+	size_t vertexNum() const
+	{
+		return is_pmx_ ? pmx_geometry_.GetVertexNum()
+			       : geometry_.vertices.size();
+	}
+
+	void readVertex(size_t i, RawVertex& v) const
+	{
+		if (!is_pmx_) {
+			const auto& pv = geometry_.vertices[i];
+			v.position = glm::vec3(conv(pv.coordinate));
+			v.normal = glm::vec3(conv(pv.normal));
+			v.uv = conv(pv.uv_coordinate);
+			v.type = mmd::Model::SkinningOperator::SKINNING_BDEF2;
+			v.jid[0] = std::uint16_t(pv.skinning_bone_id[0]);
+			v.jid[1] = std::uint16_t(pv.skinning_bone_id[1]);
+			v.jid[2] = v.jid[3] = -1;
+			v.weight[0] = pv.skinning_weight * 0.01f;
+			v.weight[1] = 1.0f - v.weight[0];
+			v.weight[2] = v.weight[3] = 0.0f;
+		} else {
+			mmd::PmxVertex pv;
+			pmx_geometry_.DecodeVertex(i, pv);
+			v.position = glm::vec3(conv(pv.coordinate));
+			v.normal = glm::vec3(conv(pv.normal));
+			v.uv = conv(pv.uv_coordinate);
+			v.type = pv.skinning_type;
+			for (int k = 0; k < 4; k++) {
+				v.jid[k] = pv.bone_weight[k] != 0.0f ? int(pv.bone_id[k]) : -1;
+				v.weight[k] = pv.bone_weight[k];
+			}
+			if (v.type == mmd::Model::SkinningOperator::SKINNING_SDEF) {
+				v.sdef_c = glm::vec3(conv(pv.c));
+				v.sdef_r0 = glm::vec3(conv(pv.r0));
+				v.sdef_r1 = glm::vec3(conv(pv.r1));
+				// SDEF only bends a bone around its parent or child.
+				if (!isParentAndChild(pv.bone_id[0], pv.bone_id[1]))
+					v.type = mmd::Model::SkinningOperator::SKINNING_BDEF2;
+			}
+		}
+		// As Model::Normalize does, all weight on one bone is a BDEF1.
+		if (v.type == mmd::Model::SkinningOperator::SKINNING_BDEF2 &&
+		    (v.weight[0] == 0.0f || v.weight[0] == 1.0f)) {
+			if (v.weight[0] == 0.0f)
+				v.jid[0] = v.jid[1];
+			v.weight[0] = 1.0f;
+			v.jid[1] = -1;
+			v.weight[1] = 0.0f;
+			v.type = mmd::Model::SkinningOperator::SKINNING_BDEF1;
+		}
+	}
+
+	bool isParentAndChild(size_t a, size_t b) const
+	{
+		size_t n = model_.GetBoneNum();
+		return a < n && b < n &&
+			(model_.GetBone(a).GetParentIndex() == b ||
+			 model_.GetBone(b).GetParentIndex() == a);
+	}
+
+	void decodeTriangles(std::vector<glm::uvec3>& F) const
+	{
+		long nf = is_pmx_ ? pmx_geometry_.GetIndexNum() / 3
+				  : geometry_.GetIndexNum() / 3;
+		F.resize(nf);
+#pragma omp parallel for schedule(static) if (size_t(nf) >= kParallelDecode)
+		for (long i = 0; i < nf; i++) {
+			for (int k = 0; k < 3; k++)
+				F[i][k] = is_pmx_ ? pmx_geometry_.DecodeIndex(i * 3 + k)
+						  : geometry_.DecodeIndex(i * 3 + k);
+		}
+	}
+
+	/*
+	 * Accumulate the offsets of morph i at the given rate, following group
+	 * morphs a few levels deep (malformed files may have cycles).
+	 */
+	void collectMorph(size_t i, float rate,
+			  std::map<int, glm::vec3>& offsets, int depth)
+	{
+		if (i >= model_.GetMorphNum() || depth > 4)
+			return;
+		const auto& morph = model_.GetMorph(i);
+		for (size_t j = 0; j < morph.GetMorphDataNum(); j++) {
+			const auto& data = morph.GetMorphData(j);
+			switch (morph.GetType()) {
+				case mmd::Model::Morph::MORPH_TYPE_VERTEX:
+					{
+						const auto& vm = data.GetVertexMorph();
+						offsets[vm.GetVertexIndex()] +=
+							rate * glm::vec3(conv(vm.GetOffset()));
+					}
+					break;
+				case mmd::Model::Morph::MORPH_TYPE_GROUP:
+					{
+						const auto& gm = data.GetGroupMorph();
+						collectMorph(gm.GetMorphIndex(),
+							     rate * gm.GetMorphRate(),
+							     offsets, depth + 1);
+					}
+					break;
+				default:
+					break;
+			}
+		}
+	}
+
+	mmd::FileReader file_;
+	bool is_pmx_ = false;
+	mmd::PmdGeometry geometry_;
+	mmd::PmxGeometry pmx_geometry_;
 	mmd::Model model_;
 	std::unordered_map<int, int> useful_bone_to_pmd_bone_, pmd_bone_to_useful_bone_;
+	std::vector<int> joint_of_bone_;
 };
 
 MMDReader::MMDReader()
@@ -285,7 +648,113 @@ bool MMDReader::getJoint(int id, glm::vec3& wcoord, int& parent)
 	return d_->getJoint(id, wcoord, parent);
 }
 
+bool MMDReader::getJointName(int id, std::wstring& name)
+{
+	return d_->getJointName(id, name);
+}
+
+void MMDReader::getMorphs(std::vector<VertexMorph>& morphs)
+{
+	d_->getMorphs(morphs);
+}
+
+void MMDReader::getIKChains(std::vector<IKChain>& chains)
+{
+	d_->getIKChains(chains);
+}
+
+void MMDReader::getPhysics(std::vector<RigidBody>& bodies,
+		std::vector<SpringConstraint>& constraints)
+{
+	d_->getPhysics(bodies, constraints);
+}
+
 void MMDReader::getJointWeights(std::vector<SparseTuple>& tup)
 {
 	d_->getJointWeights(tup);
 }
+
+void MMDReader::getSkinning(std::vector<VertexSkin>& skins)
+{
+	d_->getSkinning(skins);
+}
+
+bool MMDReader::getSkinnedMesh(std::vector<glm::vec4>& V,
+		std::vector<glm::uvec3>& F,
+		std::vector<glm::vec4>& N,
+		std::vector<glm::vec2>& UV,
+		std::vector<glm::u16vec4>& joint_ids,
+		std::vector<glm::u16vec4>& joint_weights)
+{
+	return d_->getSkinnedMesh(V, F, N, UV, joint_ids, joint_weights);
+}
+
+bool MMDReader::readMotion(const std::string& fn,
+		const std::vector<std::wstring>& joint_names,
+		std::vector<std::vector<MotionKey>>& keys)
+{
+	keys.assign(joint_names.size(), std::vector<MotionKey>());
+	try {
+		mmd::FileReader file(fn);
+		if (file.GetLength() < sizeof(mmd::interprete::vmd_header))
+			return false;
+		auto header = file.Read<mmd::interprete::vmd_header>();
+		if (std::string(header.magic) != kVmdMagic)
+			return false;
+
+		std::unordered_map<std::wstring, int> joint_of_name;
+		for (size_t i = 0; i < joint_names.size(); i++)
+			joint_of_name.emplace(joint_names[i], i);
+		// Motions repeat the same few dozen names thousands of times,
+		// convert each raw name only the first time it shows up.
+		std::unordered_map<std::string, int> joint_of_raw;
+
+		size_t n = file.Read<std::uint32_t>();
+		auto bones = file.ReadArray<mmd::interprete::vmd_bone>(n);
+		for (const auto& b : bones) {
+			std::string raw = b.bone_name;
+			auto iter = joint_of_raw.find(raw);
+			if (iter == joint_of_raw.end()) {
+				auto found = joint_of_name.find(
+					boneName(mmd::ShiftJISToUTF16String(raw)));
+				int joint = found == joint_of_name.end() ? -1 : found->second;
+				iter = joint_of_raw.emplace(raw, joint).first;
+			}
+			if (iter->second < 0)
+				continue;
+
+			MotionKey key;
+			key.frame = b.nframe;
+			key.translation = glm::vec3(conv(b.translation));
+			key.rotation = glm::normalize(glm::fquat(b.rotation.v[3],
+				b.rotation.v[0], b.rotation.v[1], b.rotation.v[2]));
+			key.curve[0] = curve(b.x_interpolator);
+			key.curve[1] = curve(b.y_interpolator);
+			key.curve[2] = curve(b.z_interpolator);
+			key.curve[3] = curve(b.r_interpolator);
+			keys[iter->second].emplace_back(key);
+		}
+	} catch (std::exception& e) {
+		std::cerr << e.what() << endl;
+		keys.clear();
+		return false;
+	}
+
+	// Files are in no particular order, a later key of the same frame wins.
+	for (auto& track : keys) {
+		std::stable_sort(track.begin(), track.end(),
+			[](const MotionKey& a, const MotionKey& b) {
+				return a.frame < b.frame;
+			});
+		if (track.empty())
+			continue;
+		auto last = track.begin();
+		for (auto it = last + 1; it != track.end(); ++it) {
+			if (it->frame != last->frame)
+				++last;
+			*last = *it;
+		}
+		track.erase(last + 1, track.end());
+	}
+	return true;
+}
@@ -8,6 +8,8 @@
 
 #include "material.h"
 #include <image.h>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_precision.hpp>
 #include <string>
 
 class MMDAdapter;
@@ -23,13 +25,105 @@ struct SparseTuple {
 	}
 };
 
+/*
+ * VertexSkin: all joint influences of one vertex (BDEF1/2/4 or SDEF).
+ * Unused slots have zero weight and repeat the first joint. SDEF vertices
+ * use the first two slots and also carry the SDEF center C and the
+ * reference points R0 and R1.
+ */
+struct VertexSkin {
+	int vid = 0;
+	int jid[4] = {0, 0, 0, 0};
+	float weight[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+	bool sdef = false;
+	glm::vec3 sdef_c, sdef_r0, sdef_r1;
+};
+
+/*
+ * VertexMorph: one morph (facial expression) as sparse vertex offsets,
+ * a vertex moves by weight * offset. Group morphs are flattened into the
+ * offsets of the vertex morphs they blend.
+ */
+struct VertexMorph {
+	std::string name;
+	int category = 0;	// 1 eyebrow, 2 eye, 3 mouth, 4 other
+	std::vector<int> vid;
+	std::vector<glm::vec3> offset;
+};
+
+/*
+ * IKChain: one CCD inverse kinematics chain of the model, in joint ids.
+ * The solver turns the links so the target joint reaches the goal joint.
+ * links[0] is the link next to the target. A limited link only turns
+ * within [lo, hi], Euler angles in radians in its parent's frame.
+ */
+struct IKChain {
+	int goal = -1;
+	int target = -1;
+	std::vector<int> links;
+	std::vector<bool> limited;
+	std::vector<glm::vec3> lo, hi;
+	int iterations = 0;
+	float angle_limit = 0.0f;	// largest turn per link and iteration
+};
+
+/*
+ * RigidBody: collision shape of the model bound to a joint. Kinematic
+ * bodies follow their joint, dynamic bodies drive it. size holds the
+ * radius (sphere, capsule), the capsule height or the box half extents.
+ * position is in model space, rotation is Euler angles in radians.
+ */
+struct RigidBody {
+	enum Shape { kSphere = 0, kBox = 1, kCapsule = 2 };
+	enum Type { kKinematic = 0, kDynamic = 1, kAligned = 2, kGhost = 3 };
+
+	int joint = -1;
+	Shape shape = kSphere;
+	Type type = kKinematic;
+	glm::vec3 size, position, rotation;
+	float mass = 1.0f;
+	float linear_damping = 0.0f;
+	float angular_damping = 0.0f;
+	float restitution = 0.0f;
+	float friction = 0.0f;
+	int group = 0;
+	unsigned mask = 0xffff;	// bit g set: collides with group g
+};
+
+/*
+ * SpringConstraint: 6-DOF spring between two rigid bodies, limits are
+ * translations and Euler angles relative to the constraint frame.
+ */
+struct SpringConstraint {
+	int body[2] = {-1, -1};
+	glm::vec3 position, rotation;
+	glm::vec3 lo_translation, hi_translation;
+	glm::vec3 lo_rotation, hi_rotation;
+	glm::vec3 spring_translation, spring_rotation;
+};
+
+/*
+ * MotionKey: one key frame of a bone in a VMD motion, at frame of the
+ * 30 fps timeline. translation is the offset from the bind position in
+ * the parent's frame, rotation the rotation relative to the bind pose.
+ * The curves ease the way from the previous key: curve[0..2] the x, y and
+ * z of the translation, curve[3] the rotation. Each holds the control
+ * points (x1, y1, x2, y2) of a cubic Bezier from (0, 0) to (1, 1).
+ */
+struct MotionKey {
+	int frame = 0;
+	glm::vec3 translation;
+	glm::fquat rotation;
+	glm::vec4 curve[4];
+};
+
 class MMDReader {
 public:
 	MMDReader();
 	~MMDReader();
 
 	/*
-	 * Open a PMD model file.
+	 * Open a PMD or PMX model file, the format is told by its header.
 	 * Input
 	 *      fn: file name
 	 * Return:
@@ -72,6 +166,12 @@ public:
 	 *       The bone structure in actual PMD files is a forest.
 	 */
 	bool getJoint(int id, glm::vec3& wcoord, int& parent);
+	/*
+	 * Get the name of a joint, the one motion files refer to it by.
+	 * Return:
+	 *      false if the Joint ID is invalid.
+	 */
+	bool getJointName(int id, std::wstring& name);
 	/*
 	 * Get a list of tuples representing the vertex-joint weight.
 	 * See SparseTuple for more details
@@ -84,6 +184,72 @@ public:
 	 *       reading another weight from VRAM.
 	 */
 	void getJointWeights(std::vector<SparseTuple>& tup);
+	/*
+	 * Get every joint influence of every vertex, up to four per vertex.
+	 * Output:
+	 *      skins: one VertexSkin per bound vertex, weights sum to one.
+	 *
+	 * Note: influences of bones outside the joint tree are dropped and
+	 *       the remaining weights renormalized.
+	 */
+	void getSkinning(std::vector<VertexSkin>& skins);
+	/*
+	 * Get the mesh and its skinning in one pass over the vertex and
+	 * index blocks of the file, split across threads for large models.
+	 * Output:
+	 *      V, F, N, UV: as getMesh
+	 *      joint_ids, joint_weights: four influences per vertex as in
+	 *      getSkinning, weights in unorm16 summing to exactly 65535.
+	 *      Unbound vertices follow joint 0.
+	 * Return:
+	 *      false if the model has no vertices or has SDEF vertices, use
+	 *      getMesh and getSkinning then.
+	 */
+	bool getSkinnedMesh(std::vector<glm::vec4>& V,
+			    std::vector<glm::uvec3>& F,
+			    std::vector<glm::vec4>& N,
+			    std::vector<glm::vec2>& UV,
+			    std::vector<glm::u16vec4>& joint_ids,
+			    std::vector<glm::u16vec4>& joint_weights);
+	/*
+	 * Get the vertex and group morphs of the model.
+	 * Output:
+	 *      morphs: one VertexMorph per morph, in file order.
+	 *
+	 * Note: the PMD base morph only holds the rest positions of the
+	 *       morphed vertices, so it is not returned. PMX has none.
+	 */
+	void getMorphs(std::vector<VertexMorph>& morphs);
+	/*
+	 * Get the IK chains of the model, in the order they must be solved.
+	 * Output:
+	 *      chains: chains whose bones are all in the joint tree.
+	 */
+	void getIKChains(std::vector<IKChain>& chains);
+	/*
+	 * Get the rigid bodies and spring constraints of the model.
+	 * Output:
+	 *      bodies: every rigid body, joint is -1 if its bone is not in
+	 *              the joint tree.
+	 *      constraints: every constraint, body indices into bodies.
+	 */
+	void getPhysics(std::vector<RigidBody>& bodies,
+			std::vector<SpringConstraint>& constraints);
+	/*
+	 * Read the bone key frames of a VMD motion file. Each bone name is
+	 * looked up once, keys of bones the model lacks are dropped.
+	 * Input:
+	 *      fn: file name
+	 *      joint_names: name of every joint, as from getJointName
+	 * Output:
+	 *      keys: keys[i] holds the keys of joint i, sorted by frame with
+	 *            one key per frame.
+	 * Return:
+	 *      false if the file is not a VMD motion
+	 */
+	static bool readMotion(const std::string& fn,
+			       const std::vector<std::wstring>& joint_names,
+			       std::vector<std::vector<MotionKey>>& keys);
 private:
 	std::unique_ptr<MMDAdapter> d_;
 };
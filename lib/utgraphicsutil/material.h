@@ -26,6 +26,10 @@ struct Material {
 
 	size_t offset; // This material applies to faces starting from offset.
 	size_t nfaces; // This material applies to nfaces faces.
+
+	// Cheapest skinning shader variant that covers every vertex of these
+	// faces: 0 two joints, 1 four joints, 2 four joints and SDEF.
+	int skin_variant = 0;
 };
 
 #endif
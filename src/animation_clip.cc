@@ -0,0 +1,191 @@
+#include "animation_clip.h"
+#include <algorithm>
+#include <cmath>
+#include <glm/gtx/quaternion.hpp>
+#include "bone_geometry.h"
+
+namespace {
+
+const float kPackRange = 0.70710678f;  // 1/sqrt(2), bound of the small three
+const float kPackScale = 32767.0f;
+
+uint16_t quantize(float x) {
+    float n = glm::clamp((x / kPackRange) * 0.5f + 0.5f, 0.0f, 1.0f);
+    return uint16_t(n * kPackScale + 0.5f);
+}
+
+float dequantize(uint16_t x) {
+    return ((x & 0x7fff) / kPackScale * 2.0f - 1.0f) * kPackRange;
+}
+
+float angleBetween(const glm::fquat& a, const glm::fquat& b) {
+    float d = std::min(1.0f, std::abs(glm::dot(a, b)));
+    return 2.0f * std::acos(d);
+}
+
+/*
+ * Normalized lerp along the shorter arc. Packing can flip the sign of a
+ * key, so two neighbouring keys may come back in opposite hemispheres.
+ */
+glm::fquat nlerpShortest(const glm::fquat& a, const glm::fquat& b,
+                         float tau) {
+    return glm::fastMix(a, glm::dot(a, b) < 0.0f ? -b : b, tau);
+}
+
+/*
+ * Greedy key reduction: starting from the last kept key, extend the
+ * segment while every key inside it is reproduced within tolerance by
+ * interpolating the two ends. Returns the indices of the kept keys, a
+ * single index when the whole track is constant.
+ */
+template <typename Value, typename Lerp, typename Error>
+std::vector<uint32_t> reduceKeys(const std::vector<Value>& keys,
+                                 float tolerance, Lerp lerp, Error error) {
+    std::vector<uint32_t> kept;
+    int n = keys.size();
+    if (n == 0) return kept;
+
+    bool constant = true;
+    for (int k = 1; k < n && constant; k++)
+        constant = error(keys[0], keys[k]) <= tolerance;
+    kept.emplace_back(0);
+    if (constant) return kept;
+
+    int anchor = 0;
+    for (int end = anchor + 2; end < n; end++) {
+        bool fits = true;
+        for (int k = anchor + 1; k < end && fits; k++) {
+            float tau = float(k - anchor) / (end - anchor);
+            fits = error(lerp(keys[anchor], keys[end], tau), keys[k]) <=
+                   tolerance;
+        }
+        if (!fits) {
+            anchor = end - 1;
+            kept.emplace_back(anchor);
+        }
+    }
+    kept.emplace_back(n - 1);
+    return kept;
+}
+
+/*
+ * Find the pair of keys around t in times[first, first + count) and the
+ * blend factor between them.
+ */
+void findSegment(const uint32_t* times, uint32_t count, float t, int& lo,
+                 int& hi, float& tau) {
+    const uint32_t* it = std::upper_bound(times, times + count, uint32_t(t));
+    hi = std::min<int>(it - times, count - 1);
+    lo = std::max(hi - 1, 0);
+    if (hi == lo) {
+        tau = 0.0f;
+        return;
+    }
+    tau = glm::clamp((t - times[lo]) / float(times[hi] - times[lo]), 0.0f,
+                     1.0f);
+}
+
+}  // namespace
+
+PackedQuat PackedQuat::pack(const glm::fquat& q) {
+    float c[4] = {q.x, q.y, q.z, q.w};
+    int largest = 0;
+    for (int i = 1; i < 4; i++)
+        if (std::abs(c[i]) > std::abs(c[largest])) largest = i;
+    float sign = c[largest] < 0.0f ? -1.0f : 1.0f;
+
+    PackedQuat p;
+    for (int i = 0, j = 0; i < 4; i++) {
+        if (i == largest) continue;
+        p.v[j++] = quantize(c[i] * sign);
+    }
+    p.v[0] |= (largest & 1) << 15;
+    p.v[1] |= (largest >> 1) << 15;
+    return p;
+}
+
+glm::fquat PackedQuat::unpack() const {
+    int largest = (v[0] >> 15) | ((v[1] >> 15) << 1);
+    float small[3] = {dequantize(v[0]), dequantize(v[1]), dequantize(v[2])};
+    float sum = small[0] * small[0] + small[1] * small[1] + small[2] * small[2];
+
+    float c[4];
+    for (int i = 0, j = 0; i < 4; i++)
+        c[i] = (i == largest) ? std::sqrt(std::max(0.0f, 1.0f - sum))
+                              : small[j++];
+    return glm::normalize(glm::fquat(c[3], c[0], c[1], c[2]));
+}
+
+void AnimationClip::compress(const std::vector<KeyFrame>& key_frames,
+                             float rot_tolerance, float trans_tolerance) {
+    nframes = key_frames.size();
+    int njoints = nframes > 0 ? key_frames[0].rel_rot.size() : 0;
+    tracks.assign(njoints, Track());
+    times.clear();
+    rotations.clear();
+
+    std::vector<glm::fquat> keys(nframes);
+    for (int j = 0; j < njoints; j++) {
+        for (int f = 0; f < nframes; f++) keys[f] = key_frames[f].rel_rot[j];
+        std::vector<uint32_t> kept =
+            reduceKeys(keys, rot_tolerance, nlerpShortest, angleBetween);
+        tracks[j].first = times.size();
+        tracks[j].count = kept.size();
+        for (uint32_t f : kept) {
+            times.emplace_back(f);
+            rotations.emplace_back(PackedQuat::pack(keys[f]));
+        }
+    }
+
+    auto trans_lerp = [](const glm::vec3& a, const glm::vec3& b, float tau) {
+        return (1 - tau) * a + tau * b;
+    };
+    auto trans_error = [](const glm::vec3& a, const glm::vec3& b) {
+        return glm::length(a - b);
+    };
+    std::vector<glm::vec3> roots(nframes);
+    for (int f = 0; f < nframes; f++) roots[f] = key_frames[f].root;
+    root_times = reduceKeys(roots, trans_tolerance, trans_lerp, trans_error);
+    root_positions.clear();
+    for (uint32_t f : root_times) root_positions.emplace_back(roots[f]);
+    root_track.first = 0;
+    root_track.count = root_times.size();
+
+    times.shrink_to_fit();
+    rotations.shrink_to_fit();
+}
+
+void AnimationClip::sample(float t, KeyFrame& target) const {
+    target.rel_rot.resize(tracks.size());
+    for (size_t j = 0; j < tracks.size(); j++) {
+        const Track& track = tracks[j];
+        if (track.count == 1) {
+            target.rel_rot[j] = rotations[track.first].unpack();
+            continue;
+        }
+        int lo, hi;
+        float tau;
+        findSegment(&times[track.first], track.count, t, lo, hi, tau);
+        target.rel_rot[j] =
+            nlerpShortest(rotations[track.first + lo].unpack(),
+                          rotations[track.first + hi].unpack(), tau);
+    }
+
+    if (root_track.count == 0) return;
+    int lo, hi;
+    float tau;
+    findSegment(root_times.data(), root_track.count, t, lo, hi, tau);
+    target.root = (1 - tau) * root_positions[lo] + tau * root_positions[hi];
+}
+
+void AnimationClip::decompress(std::vector<KeyFrame>& key_frames) const {
+    key_frames.resize(nframes);
+    for (int f = 0; f < nframes; f++) sample(f, key_frames[f]);
+}
+
+size_t AnimationClip::byteSize() const {
+    return tracks.size() * sizeof(Track) + times.size() * sizeof(uint32_t) +
+           rotations.size() * sizeof(PackedQuat) +
+           root_times.size() * sizeof(uint32_t) +
+           root_positions.size() * sizeof(glm::vec3);
+}
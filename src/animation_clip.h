@@ -0,0 +1,64 @@
+#ifndef ANIMATION_CLIP_H
+#define ANIMATION_CLIP_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <stdint.h>
+#include <vector>
+
+struct KeyFrame;
+
+/*
+ * PackedQuat: smallest-three encoding of a unit quaternion in 48 bits.
+ * The largest component is dropped (its sign is flipped to positive) and
+ * recovered from the unit length, the other three are quantized to 15 bits
+ * in [-1/sqrt(2), 1/sqrt(2)]. The top bits of v[0] and v[1] hold the
+ * index of the dropped component.
+ */
+struct PackedQuat {
+    uint16_t v[3];
+
+    static PackedQuat pack(const glm::fquat& q);
+    glm::fquat unpack() const;
+};
+
+/*
+ * AnimationClip: compressed copy of a key frame timeline.
+ *
+ * Every joint is one track of (key frame index, rotation) pairs. Keys that
+ * slerp between their neighbours within the rotation tolerance are
+ * dropped, so a joint that never moves is a single constant key. All
+ * tracks share the flat times/rotations arrays.
+ */
+struct AnimationClip {
+    struct Track {
+        uint32_t first = 0;  // offset into times/rotations
+        uint32_t count = 0;  // 1 means a constant track
+    };
+
+    int nframes = 0;  // length of the source timeline in key frames
+    std::vector<Track> tracks;
+    std::vector<uint32_t> times;
+    std::vector<PackedQuat> rotations;
+    Track root_track;
+    std::vector<uint32_t> root_times;
+    std::vector<glm::vec3> root_positions;
+
+    /*
+     * compress: rebuild the clip from key frames. rot_tolerance is the
+     * largest rotation error in radians, trans_tolerance the largest root
+     * translation error.
+     */
+    void compress(const std::vector<KeyFrame>& key_frames,
+                  float rot_tolerance, float trans_tolerance);
+    /*
+     * sample: evaluate the clip at time t (in key frames) straight into a
+     * KeyFrame, rotations are slerped between the surviving keys.
+     */
+    void sample(float t, KeyFrame& target) const;
+    // Expand back to one KeyFrame per source key frame.
+    void decompress(std::vector<KeyFrame>& key_frames) const;
+    size_t byteSize() const;
+};
+
+#endif
@@ -1,17 +1,157 @@
+#include <stdint.h>
+#include <cstring>
 #include <fstream>
 #include <glm/gtx/io.hpp>
 #include <iostream>
 #include <unordered_map>
 #include "bone_geometry.h"
 #include "json.hpp"
+#include "mapped_file.h"
 #include "texture_to_render.h"
 
 using json = nlohmann::json;
+
+namespace {
+
 /*
- * Placeholder functions for Milestone 2
+ * Binary animation (.anim) layout, all little endian:
+ *   AnimationHeader
+ *   float rotations[nframes][njoints][4]  (x, y, z, w)
+ *   float roots[nframes][3]
+ * Offsets are from the start of the file, so later versions may append
+ * blocks without moving these.
  */
+const char kAnimationMagic[4] = {'A', 'N', 'I', 'M'};
+const uint32_t kAnimationVersion = 1;
+
+struct AnimationHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t njoints;
+    uint32_t nframes;
+    uint64_t rotation_offset;
+    uint64_t root_offset;
+};
+
+bool hasSuffix(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() &&
+           s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+/*
+ * AnimationSaxHandler: streaming reader for animation.json, which is
+ *   [ [ [[x, y, z, w] per joint], [x, y, z] ] per key frame ]
+ * Values go straight into the appended KeyFrames, no DOM is built.
+ */
+class AnimationSaxHandler : public nlohmann::json_sax<json> {
+   public:
+    AnimationSaxHandler(std::vector<KeyFrame>& frames, int njoints)
+        : frames_(frames), njoints_(njoints) {}
+
+    const std::string& error() const { return error_; }
+
+    bool null() override { return fail("unexpected null"); }
+    bool boolean(bool) override { return fail("unexpected boolean"); }
+    bool number_integer(number_integer_t val) override { return value(val); }
+    bool number_unsigned(number_unsigned_t val) override {
+        return value(val);
+    }
+    bool number_float(number_float_t val, const string_t&) override {
+        return value(val);
+    }
+    bool string(string_t&) override { return fail("unexpected string"); }
+    bool start_object(std::size_t) override {
+        return fail("unexpected object");
+    }
+    bool key(string_t&) override { return fail("unexpected key"); }
+    bool end_object() override { return fail("unexpected object"); }
+
+    bool start_array(std::size_t) override {
+        depth_++;
+        if (depth_ == 2) {
+            frames_.emplace_back();
+            frames_.back().rel_rot.resize(njoints_);
+            field_ = 0;
+            joint_ = 0;
+        } else if (depth_ == 3) {
+            if (field_ > 1) return fail("extra data in key frame");
+            component_ = 0;
+        } else if (depth_ == 4) {
+            if (field_ != 0) return fail("unexpected array");
+            if (joint_ >= njoints_) return fail("too many joints");
+            component_ = 0;
+        } else if (depth_ > 4) {
+            return fail("unexpected array");
+        }
+        return true;
+    }
+
+    bool end_array() override {
+        if (depth_ == 4) {
+            if (component_ != 4) return fail("rotation needs 4 components");
+            joint_++;
+        } else if (depth_ == 3) {
+            if (field_ == 0 && joint_ != njoints_)
+                return fail("expected " + std::to_string(njoints_) +
+                            " joints, got " + std::to_string(joint_));
+            if (field_ == 1 && component_ != 3)
+                return fail("root needs 3 components");
+            field_++;
+        } else if (depth_ == 2) {
+            if (field_ != 2) return fail("key frame needs rotation and root");
+        }
+        depth_--;
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string&,
+                     const nlohmann::detail::exception& ex) override {
+        error_ = ex.what();
+        return false;
+    }
+
+   private:
+    bool value(float v) {
+        if (depth_ == 4) {
+            if (component_ >= 4) return fail("rotation needs 4 components");
+            glm::fquat& q = frames_.back().rel_rot[joint_];
+            float* c[4] = {&q.x, &q.y, &q.z, &q.w};
+            *c[component_++] = v;
+            return true;
+        }
+        if (depth_ == 3 && field_ == 1) {
+            if (component_ >= 3) return fail("root needs 3 components");
+            frames_.back().root[component_++] = v;
+            return true;
+        }
+        return fail("unexpected number");
+    }
+
+    bool fail(const std::string& what) {
+        if (depth_ < 2)
+            error_ = what;
+        else
+            error_ = "key frame " + std::to_string(frames_.size() - 1) +
+                     ": " + what;
+        return false;
+    }
+
+    std::vector<KeyFrame>& frames_;
+    int njoints_;
+    int depth_ = 0;
+    int field_ = 0;      // 0: rotations, 1: root, within the current frame
+    int joint_ = 0;
+    int component_ = 0;
+    std::string error_;
+};
+
+}  // namespace
 
 void Mesh::saveAnimationTo(const std::string& fn) {
+    if (hasSuffix(fn, ".anim")) {
+        saveAnimationBinary(fn);
+        return;
+    }
     json json_save;
     for (int i = 0; i < key_frames.size(); i++) {
         json a_frame = json::array();
@@ -36,24 +176,124 @@ void Mesh::saveAnimationTo(const std::string& fn) {
     o << std::setw(4) << json_save << std::endl;
 }
 
+void Mesh::saveAnimationBinary(const std::string& fn) {
+    AnimationHeader header;
+    std::memcpy(header.magic, kAnimationMagic, sizeof(header.magic));
+    header.version = kAnimationVersion;
+    header.njoints = getNumberOfBones();
+    header.nframes = key_frames.size();
+    header.rotation_offset = sizeof(AnimationHeader);
+    header.root_offset = header.rotation_offset +
+                         uint64_t(header.nframes) * header.njoints * 4 *
+                             sizeof(float);
+
+    std::vector<float> rotations;
+    rotations.reserve(size_t(header.nframes) * header.njoints * 4);
+    std::vector<float> roots;
+    roots.reserve(size_t(header.nframes) * 3);
+    for (const KeyFrame& frame : key_frames) {
+        for (const glm::fquat& q : frame.rel_rot) {
+            rotations.insert(rotations.end(), {q.x, q.y, q.z, q.w});
+        }
+        roots.insert(roots.end(), {frame.root.x, frame.root.y, frame.root.z});
+    }
+
+    std::ofstream o(fn, std::ios::binary);
+    o.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    o.write(reinterpret_cast<const char*>(rotations.data()),
+            rotations.size() * sizeof(float));
+    o.write(reinterpret_cast<const char*>(roots.data()),
+            roots.size() * sizeof(float));
+}
+
+/*
+ * The file is mapped to find and bounds-check its blocks, which are then
+ * copied into key_frames; nothing keeps the mapping after loading.
+ * Return: false if fn is not a binary animation. A binary animation that
+ * doesn't match this skeleton is reported and skipped.
+ */
+bool Mesh::loadAnimationBinary(const std::string& fn) {
+    MappedFile file;
+    if (!file.open(fn) || file.size() < sizeof(AnimationHeader)) return false;
+    AnimationHeader header;
+    std::memcpy(&header, file.data(), sizeof(header));
+    if (std::memcmp(header.magic, kAnimationMagic, sizeof(header.magic)) != 0)
+        return false;
+
+    uint64_t rotation_bytes =
+        uint64_t(header.nframes) * header.njoints * 4 * sizeof(float);
+    uint64_t root_bytes = uint64_t(header.nframes) * 3 * sizeof(float);
+    if (header.version != kAnimationVersion ||
+        (int)header.njoints != getNumberOfBones() ||
+        header.rotation_offset > file.size() ||
+        rotation_bytes > file.size() - header.rotation_offset ||
+        header.root_offset > file.size() ||
+        root_bytes > file.size() - header.root_offset) {
+        std::cerr << fn << ": unsupported or mismatched animation (version "
+                  << header.version << ", " << header.njoints << " joints)"
+                  << std::endl;
+        return true;
+    }
+
+    const char* rotations = file.data() + header.rotation_offset;
+    const char* roots = file.data() + header.root_offset;
+    size_t first = key_frames.size();
+    key_frames.resize(first + header.nframes);
+    for (uint32_t f = 0; f < header.nframes; f++) {
+        KeyFrame& frame = key_frames[first + f];
+        frame.rel_rot.resize(header.njoints);
+        for (uint32_t j = 0; j < header.njoints; j++) {
+            float q[4];
+            std::memcpy(q, rotations, sizeof(q));
+            rotations += sizeof(q);
+            frame.rel_rot[j] = glm::fquat(q[3], q[0], q[1], q[2]);
+        }
+        std::memcpy(&frame.root[0], roots, 3 * sizeof(float));
+        roots += 3 * sizeof(float);
+    }
+    return true;
+}
+
+/*
+ * A VMD motion is kept apart from the key frames, it is sampled on its own
+ * timeline. Returns false if the file is no VMD motion.
+ */
+bool Mesh::loadMotion(const std::string& fn) {
+    std::vector<std::wstring> names;
+    for (const Joint& joint : skeleton.joints) names.emplace_back(joint.name);
+    std::vector<std::vector<MotionKey>> keys;
+    if (!MMDReader::readMotion(fn, names, keys)) return false;
+    motion_.load(keys);
+    if (motion_.empty()) {
+        std::cerr << fn << ": no bone of the motion is in the model"
+                  << std::endl;
+        return true;
+    }
+    // Motions are made against the model's IK, legs follow their goals.
+    setIK(true);
+    motion_.sample(0.0f, playback_frame_);
+    updateSkeleton(playback_frame_);
+    skeleton.refreshCache(&currentQ_);
+    return true;
+}
+
 void Mesh::loadAnimationFrom(const std::string& fn) {
-    std::ifstream i(fn);
-    json json_load;
-    i >> json_load;
-    for (int i = 0; i < json_load.size(); i++) {
-        json a_frame = json_load[i];
-        json rotation = a_frame[0];
-        json translation = a_frame[1];
-        KeyFrame frame;
-        frame.root = glm::vec3(translation[0], translation[1], translation[2]);
-        for (int j = 0; j < rotation.size(); j++) {
-            json rot_joint = rotation[j];
-            glm::fquat rel_rotation = glm::fquat(rot_joint[3], rot_joint[0],
-                                                 rot_joint[1], rot_joint[2]);
-            frame.rel_rot.emplace_back(rel_rotation);
-        }
-        key_frames.emplace_back(frame);
+    motion_.clear();
+    playback_frame_.rel_trans.clear();
+    bake_dirty_ = true;
+    if (loadMotion(fn)) return;
+    if (!loadAnimationBinary(fn)) {
+        std::ifstream i(fn);
+        size_t first = key_frames.size();
+        AnimationSaxHandler handler(key_frames, getNumberOfBones());
+        if (!json::sax_parse(i, &handler)) {
+            std::cerr << fn << ": " << handler.error() << std::endl;
+            key_frames.resize(first);
+            return;
+        }
     }
+    if (key_frames.empty()) return;
+    markKeyFramesDirty();
     updateSkeleton(key_frames[0]);
     skeleton.refreshCache(&currentQ_);
 }
@@ -1,10 +1,12 @@
 #include "bone_geometry.h"
+#include <algorithm>
 #include <fstream>
+#include <glm/gtc/packing.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtx/io.hpp>
+#include <glm/gtx/quaternion.hpp>
 #include <glm/gtx/transform.hpp>
 #include <iostream>
-#include <queue>
 #include <stdexcept>
 #include "config.h"
 #include "texture_to_render.h"
@@ -20,6 +22,26 @@ std::ostream& operator<<(std::ostream& os, const std::vector<T>& v) {
     return os;
 }
 
+BoundingBox BoundingBox::none() {
+    BoundingBox b;
+    b.min = glm::vec3(std::numeric_limits<float>::max());
+    b.max = glm::vec3(-std::numeric_limits<float>::max());
+    return b;
+}
+
+BoundingBox BoundingBox::transformed(const glm::mat4& m) const {
+    glm::vec3 center = 0.5f * (min + max);
+    glm::vec3 extent = 0.5f * (max - min);
+    glm::vec3 new_center = glm::vec3(m * glm::vec4(center, 1.0f));
+    glm::vec3 new_extent(0.0f);
+    for (int col = 0; col < 3; col++)
+        new_extent += glm::abs(glm::vec3(m[col])) * extent[col];
+    BoundingBox b;
+    b.min = new_center - new_extent;
+    b.max = new_center + new_extent;
+    return b;
+}
+
 std::ostream& operator<<(std::ostream& os, const BoundingBox& bounds) {
     os << "min = " << bounds.min << " max = " << bounds.max;
     return os;
@@ -31,183 +53,225 @@ const glm::vec3* Skeleton::collectJointTrans() const {
 
 const glm::fquat* Skeleton::collectJointRot() const { return cache.rot.data(); }
 
-// FIXME: Implement bone animation.
-
-void Skeleton::refreshCache(Configuration* target) {
-    if (target == nullptr) target = &cache;
-
-    target->rot.resize(joints.size());
-    target->trans.resize(joints.size());
-
-    for (int i = 0; i < bones.size(); i++) {
-        if (bones[i] != nullptr) {
-            joints[bones[i]->parent_index].orientation = bones[i]->orientation;
-            joints[bones[i]->parent_index].rel_orientation =
-                bones[i]->parent_orientation_relative;
-        }
-    }
-
-    for (int i = 0; i < joints.size(); i++) {
-        if (joints[i].parent_index != -1) {
-            joints[i].position =
-                glm::vec3(bones[i]->deformed_transform *
-                          glm::inverse(bones[i]->undeformed_transform) *
-                          glm::vec4(joints[i].init_position, 1.0));
+/*
+ * Lay the joints out in depth-first preorder and fill the flat pose arrays.
+ * Joint ids are kept as the external interface (shaders, key frames), the
+ * slot permutation is only used internally.
+ */
+void Skeleton::construct() {
+    const int n = joints.size();
+    for (auto& joint : joints) joint.children.clear();
+    for (int i = 0; i < n; i++) {
+        int parent = joints[i].parent_index;
+        if (parent == -1) {
+            joints[i].init_rel_position = joints[i].init_position;
         } else {
-            int root = joints[i].children[0];
-            joints[i].position = glm::vec3(bones[root]->translation[3][0],
-                                           bones[root]->translation[3][1],
-                                           bones[root]->translation[3][2]);
+            joints[parent].children.emplace_back(i);
+            joints[i].init_rel_position =
+                joints[i].init_position - joints[parent].init_position;
         }
     }
-    for (int i = 0; i < joints.size(); i++) {
-        target->rot[i] = joints[i].orientation;
-        target->trans[i] = joints[i].position;
-    }
-}
 
-void Skeleton::translate(glm::vec3 translation, int root) {
-    Joint joint = joints[root];
-    for (int id : joint.children) {
-        bones[id]->translate(translation);
+    bones.assign(n, Bone());
+    for (int i = 0; i < n; i++) {
+        if (joints[i].parent_index != -1)
+            bones[i] = Bone(joints[joints[i].parent_index], joints[i]);
     }
-}
 
-void Skeleton::animateTranslate(glm::vec3 diff_translation, int root_id) {
-    Joint root = joints[root_id];
-    for (int i = 0; i < root.children.size(); i++) {
-        bones[root.children[i]]->performAnimateTranslate(diff_translation);
+    joint_of_slot.clear();
+    joint_of_slot.reserve(n);
+    std::vector<int> stack;
+    for (int i = n - 1; i >= 0; i--)
+        if (joints[i].parent_index == -1) stack.emplace_back(i);
+    while (!stack.empty()) {
+        int id = stack.back();
+        stack.pop_back();
+        joint_of_slot.emplace_back(id);
+        const auto& children = joints[id].children;
+        for (auto it = children.rbegin(); it != children.rend(); ++it)
+            stack.emplace_back(*it);
     }
-}
 
-void Bone::performAnimateTranslate(glm::vec3 diff_translation) {
-    translation = start_translation;
-    translation[3][0] += diff_translation.x;
-    translation[3][1] += diff_translation.y;
-    translation[3][2] += diff_translation.z;
-    deformed_transform =
-        translation * glm::toMat4(glm::normalize(parent_orientation_relative));
-    for (int i = 0; i < nodes.size(); i++) {
-        nodes[i]->translateParent();
+    slot_of_joint.assign(n, -1);
+    for (int s = 0; s < n; s++) slot_of_joint[joint_of_slot[s]] = s;
+
+    parent_slot.resize(n);
+    local_trans.resize(n);
+    for (int s = 0; s < n; s++) {
+        const Joint& joint = joints[joint_of_slot[s]];
+        parent_slot[s] = joint.parent_index == -1
+                             ? -1
+                             : slot_of_joint[joint.parent_index];
+        local_trans[s] = joint.init_rel_position;
+    }
+    // In preorder a subtree ends where the parent's next sibling begins.
+    subtree_end.assign(n, n);
+    std::vector<int> open;
+    for (int s = 0; s < n; s++) {
+        while (!open.empty() && open.back() != parent_slot[s]) {
+            subtree_end[open.back()] = s;
+            open.pop_back();
+        }
+        open.emplace_back(s);
+    }
+    local_rot.assign(n, glm::fquat(1.0, 0.0, 0.0, 0.0));
+    world_rot.resize(n);
+    world_pos.resize(n);
+    world.resize(n);
+    root_translation = glm::vec3(0.0f);
+    markAllDirty();
+    evaluate();
+
+    // The bind pose never changes after loading, invert it only once.
+    inverse_bind.resize(n);
+    inverse_bind_rot.resize(n);
+    for (int s = 0; s < n; s++) {
+        inverse_bind[s] = glm::inverse(world[s]);
+        inverse_bind_rot[s] = glm::conjugate(world_rot[s]);
     }
 }
 
-void Bone::translate(glm::vec3 translation) {
-    this->translation[3][0] += 10.0f * translation.x;
-    this->translation[3][1] += 10.0f * translation.y;
-    this->translation[3][2] += 10.0f * translation.z;
-    this->deformed_transform =
-        this->translation *
-        glm::toMat4(glm::normalize(this->parent_orientation_relative));
-
-    for (int i = 0; i < nodes.size(); i++) {
-        nodes[i]->translateParent();
+void Skeleton::setPose(const KeyFrame& frame) {
+    bool offset = !frame.rel_trans.empty();
+    for (int s = 0; s < (int)joint_of_slot.size(); s++) {
+        int j = joint_of_slot[s];
+        local_rot[s] = frame.rel_rot[j];
+        local_trans[s] = joints[j].init_rel_position;
+        if (offset) local_trans[s] += frame.rel_trans[j];
     }
+    root_translation = frame.root;
+    markAllDirty();
 }
 
-void Bone::translateParent() {
-    this->deformed_transform =
-        this->parent->deformed_transform * this->translation *
-        glm::toMat4(glm::normalize(this->parent_orientation_relative));
-    for (int i = 0; i < nodes.size(); i++) {
-        nodes[i]->translateParent();
+void Skeleton::markDirty(int joint) {
+    int s = slot_of_joint[joint];
+    if (!isDirty()) {
+        dirty_begin = s;
+        dirty_end = subtree_end[s];
+    } else {
+        dirty_begin = std::min(dirty_begin, s);
+        dirty_end = std::max(dirty_end, subtree_end[s]);
     }
 }
 
-void Bone::rotate(glm::fquat rotate_) {
-    if (parent != nullptr)
-        for (int i = 0; i < parent->nodes.size(); i++)
-            parent->nodes[i]->rotate_(rotate_);
-    else
-        this->rotate_(rotate_);
+void Skeleton::markAllDirty() {
+    dirty_begin = 0;
+    dirty_end = parent_slot.size();
 }
 
-void Bone::rotate_(glm::fquat rotate_) {
-    glm::mat4 pre_parent = glm::toMat4(this->parent_orientation_relative);
-    glm::mat4 pre_orientation = glm::toMat4(this->orientation);
-
-    glm::mat4 update_parent = glm::toMat4(rotate_) * pre_parent;
-    glm::mat4 update_orientation = glm::toMat4(rotate_) * pre_orientation;
-
-    this->parent_orientation_relative =
-        glm::normalize(glm::toQuat(update_parent));
-    this->orientation = glm::normalize(glm::toQuat(update_orientation));
-
-    this->deformed_transform *= glm::inverse(pre_parent) * update_parent;
-
-    for (int i = 0; i < nodes.size(); i++) {
-        nodes[i]->rotateParent();
-    }
+/*
+ * Forward kinematics in one linear pass over the dirty slots: every parent
+ * slot precedes its children, so its world transform is already final when
+ * it is read, whether it was recomputed in this pass or not.
+ */
+void Skeleton::evaluate() {
+    for (int s = dirty_begin; s < dirty_end; s++) evaluateSlot(s);
 }
 
-void Bone::rotateParent() {
-    this->deformed_transform = this->parent->deformed_transform * translation *
-                               glm::toMat4(this->parent_orientation_relative);
-    glm::mat4 update_orientation =
-        glm::toMat4(this->parent->orientation) *
-        glm::toMat4(this->parent_orientation_relative);
-    this->orientation = glm::normalize(glm::toQuat(update_orientation));
-
-    for (int i = 0; i < nodes.size(); i++) {
-        nodes[i]->rotateParent();
+void Skeleton::evaluateSlot(int s) {
+    int p = parent_slot[s];
+    if (p < 0) {
+        world_rot[s] = local_rot[s];
+        world_pos[s] = local_trans[s] + root_translation;
+    } else {
+        world_rot[s] = world_rot[p] * local_rot[s];
+        world_pos[s] = world_pos[p] + world_rot[p] * local_trans[s];
     }
+    world[s] = glm::translate(world_pos[s]) * glm::toMat4(world_rot[s]);
 }
 
-void Skeleton::constructBone(int joint) {
-    if (bones[joint] != nullptr) return;
+/*
+ * Recompute the dirty slots and write their palette entries in the same
+ * pass. A target that has not been filled before gets the whole pose.
+ */
+void Skeleton::refreshCache(Configuration* target) {
+    if (target == nullptr) target = &cache;
 
-    Joint end = joints[joint];
-    if (end.parent_index == -1) {
-        bones[joint] = nullptr;
-        return;
+    int begin = dirty_begin;
+    int end = dirty_end;
+    if (target->rot.size() != joints.size()) {
+        target->rot.resize(joints.size());
+        target->trans.resize(joints.size());
+        target->skin.resize(joints.size());
+        target->dq_real.resize(joints.size());
+        target->dq_dual.resize(joints.size());
+    }
+    if (target != synced_target || target->version != synced_version) {
+        begin = 0;
+        end = joints.size();
     }
+    dirty_begin = dirty_end = 0;
+    if (begin >= end) return;
+
+    int first = joints.size();
+    int last = 0;
+    for (int s = begin; s < end; s++) {
+        evaluateSlot(s);
+        int id = joint_of_slot[s];
+        target->rot[id] = world_rot[s];
+        target->trans[id] = world_pos[s];
+        target->skin[id] = world[s] * inverse_bind[s];
+        // Dual quaternion of the same transform, (r, 0.5 * t * r).
+        glm::fquat real = world_rot[s] * inverse_bind_rot[s];
+        glm::vec3 t = glm::vec3(target->skin[id][3]);
+        target->dq_real[id] = real;
+        target->dq_dual[id] = 0.5f * (glm::fquat(0.0f, t) * real);
+        first = std::min(first, id);
+        last = std::max(last, id + 1);
+    }
+    target->changed_first = first;
+    target->changed_last = last;
+    target->version++;
+    synced_target = target;
+    synced_version = target->version;
+}
 
-    Joint start = joints[end.parent_index];
+const glm::fquat& Skeleton::getRelOrientation(int joint) const {
+    return local_rot[slot_of_joint[joint]];
+}
 
-    Bone* bone = new Bone(start, end);
-    joints[end.parent_index].children.emplace_back(end.joint_index);
+void Skeleton::setRelOrientation(int joint, const glm::fquat& rel) {
+    local_rot[slot_of_joint[joint]] = rel;
+    markDirty(joint);
+}
 
-    bones[joint] = bone;
+glm::vec3 Skeleton::getPosition(int joint) const {
+    return world_pos[slot_of_joint[joint]];
+}
 
-    auto trans = start.position;
-    if (start.parent_index > -1) {
-        bone->parent = bones[end.parent_index];
-        trans = start.position - joints[start.parent_index].position;
-    }
+const glm::mat4& Skeleton::getTransform(int joint) const {
+    return world[slot_of_joint[joint]];
+}
 
-    bone->translation = glm::mat4(1.0f);
-    bone->translation[3][0] = trans.x;
-    bone->translation[3][1] = trans.y;
-    bone->translation[3][2] = trans.z;
-    bone->start_translation = bone->translation;
-    bone->undeformed_transform = bone->translation;
-
-    if (start.parent_index == -1) {
-        bone->deformed_transform =
-            bone->translation *
-            glm::toMat4(glm::normalize(bone->parent_orientation_relative));
-    } else {
-        bone->undeformed_transform =
-            (bone->parent)->undeformed_transform * bone->translation;
-        bone->deformed_transform =
-            (bone->parent)->deformed_transform * bone->translation *
-            glm::toMat4(glm::normalize(bone->parent_orientation_relative));
-        bone->root = bone->parent->root;
-    }
+/*
+ * Rotate the frame of the given joint by a world space rotation, which
+ * swings every bone starting at this joint.
+ */
+void Skeleton::rotate(int joint, glm::fquat rotation) {
+    if (isDirty()) evaluate();
+    int s = slot_of_joint[joint];
+    int p = parent_slot[s];
+    glm::fquat parent_rot =
+        p < 0 ? glm::fquat(1.0, 0.0, 0.0, 0.0) : world_rot[p];
+    local_rot[s] = glm::normalize(glm::inverse(parent_rot) * rotation *
+                                  parent_rot * local_rot[s]);
+    markDirty(joint);
+}
 
-    if (bone->parent != nullptr) {
-        bone->parent->nodes.emplace_back(bone);
-    }
+void Skeleton::translate(glm::vec3 translation) {
+    root_translation += 10.0f * translation;
+    markAllDirty();
 }
 
 void KeyFrame::interpolate(const KeyFrame& from, const KeyFrame& to, float tau,
                            KeyFrame& target) {
-    auto rel_rot_from = from.rel_rot;
-    auto rel_rot_to = to.rel_rot;
+    const auto& rel_rot_from = from.rel_rot;
+    const auto& rel_rot_to = to.rel_rot;
 
+    // No reallocation once target has been sized for this skeleton.
     target.rel_rot.resize(rel_rot_from.size());
 
-    for (int i = 0; i < target.rel_rot.size(); i++)
+    for (size_t i = 0; i < target.rel_rot.size(); i++)
         target.rel_rot[i] = glm::fastMix(rel_rot_from[i], rel_rot_to[i], tau);
 
     target.root = (1 - tau) * from.root + tau * to.root;
@@ -218,10 +282,31 @@ Mesh::Mesh() {}
 Mesh::~Mesh() {}
 
 void Mesh::loadPmd(const std::string& fn) {
+    std::vector<IKChain> chains;
+    std::vector<VertexMorph> vms;
+    if (!loadModelCache(fn, chains, vms)) {
+        readPmd(fn, chains, vms);
+        saveModelCache(fn, chains, vms);
+    }
+
+    computeBounds();
+    skeleton.construct();
+    skeleton.ik.load(chains, skeleton);
+    playback_frame_.rel_rot.resize(getNumberOfBones());
+    computeBoneBounds();
+    loadMorphs(vms);
+    packVertices();
+    computeSkinVariants();
+}
+
+void Mesh::readPmd(const std::string& fn, std::vector<IKChain>& chains,
+                   std::vector<VertexMorph>& vms) {
     MMDReader mr;
     mr.open(fn);
-    mr.getMesh(vertices, faces, vertex_normals, uv_coordinates);
-    computeBounds();
+    // Skinning comes in the same pass over the file, unless there is SDEF.
+    bool skinned = mr.getSkinnedMesh(vertices, faces, vertex_normals,
+                                     uv_coordinates, joint_ids, joint_weights);
+    if (!skinned) mr.getMesh(vertices, faces, vertex_normals, uv_coordinates);
     mr.getMaterial(materials);
 
     // FIXME: load skeleton and blend weights from PMD file,
@@ -233,114 +318,186 @@ void Mesh::loadPmd(const std::string& fn) {
 
     while (mr.getJoint(id, pos, parent)) {
         Joint joint = Joint(id, pos, parent);
+        mr.getJointName(id, joint.name);
         skeleton.joints.emplace_back(joint);
         id++;
     }
+    mr.getIKChains(chains);
+    mr.getPhysics(rigid_bodies, spring_constraints);
+    mr.getMorphs(vms);
 
-    skeleton.bones.resize(getNumberOfBones());
-    for (int i = 0; i < getNumberOfBones(); ++i) {
-        if (skeleton.joints[i].parent_index == -1) {
-            skeleton.bones[i] = nullptr;
-        }
-    }
+    if (skinned)
+        sdef_params.clear();
+    else
+        loadSkinning(mr);
+}
 
-    for (int i = 1; i < getNumberOfBones(); i++) {
-        skeleton.constructBone(i);
+void Mesh::packVertices() {
+    packed_vertices.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++) {
+        SkinnedVertex& v = packed_vertices[i];
+        v.position = glm::vec3(vertices[i]);
+        v.normal = glm::packSnorm3x10_1x2(
+            glm::vec4(glm::vec3(vertex_normals[i]), 0.0f));
+        v.uv = glm::packHalf2x16(uv_coordinates[i]);
+        v.joint_ids = joint_ids[i];
+        v.joint_weights = joint_weights[i];
     }
+}
 
-    std::vector<SparseTuple> weights;
-    mr.getJointWeights(weights);
-
-    for (SparseTuple& sparse_tuple : weights) {
-        int v_id = sparse_tuple.vid;
-        joint0.emplace_back(sparse_tuple.jid0);
-        joint1.emplace_back(sparse_tuple.jid1);
-        weight_for_joint0.emplace_back(sparse_tuple.weight0);
-        vector_from_joint0.emplace_back(
-            glm::vec3(vertices[v_id]) -
-            skeleton.joints[sparse_tuple.jid0].position);
-        vector_from_joint1.emplace_back(
-            glm::vec3(vertices[v_id]) -
-            skeleton.joints[sparse_tuple.jid1].position);
+void Mesh::loadSkinning(MMDReader& mr) {
+    std::vector<VertexSkin> skins;
+    mr.getSkinning(skins);
+
+    // Unbound vertices follow the root.
+    joint_ids.assign(vertices.size(), glm::u16vec4(0));
+    joint_weights.assign(vertices.size(), glm::u16vec4(65535, 0, 0, 0));
+    sdef_params.clear();
+
+    for (const VertexSkin& skin : skins) {
+        int v = skin.vid;
+        int total = 0;
+        for (int k = 0; k < 4; k++) {
+            joint_ids[v][k] = skin.jid[k];
+            joint_weights[v][k] = int(skin.weight[k] * 65535.0f + 0.5f);
+            total += joint_weights[v][k];
+        }
+        // Make the weights sum to exactly one after quantization.
+        joint_weights[v][0] += 65535 - total;
+
+        if (skin.sdef) {
+            if (sdef_params.empty())
+                sdef_params.assign(vertices.size() * kSdefTexelsPerVertex,
+                                   glm::vec4(0.0f));
+            // Move R0 and R1 so their weighted mean is C, the usual
+            // correction for SDEF data exported with arbitrary R0/R1.
+            glm::vec3 rw = skin.weight[0] * skin.sdef_r0 +
+                           skin.weight[1] * skin.sdef_r1;
+            glm::vec3 r0 = skin.sdef_c + skin.sdef_r0 - rw;
+            glm::vec3 r1 = skin.sdef_c + skin.sdef_r1 - rw;
+            glm::vec4* p = &sdef_params[v * kSdefTexelsPerVertex];
+            p[0] = glm::vec4(skin.sdef_c, 1.0f);
+            p[1] = glm::vec4(0.5f * (skin.sdef_c + r0), 0.0f);
+            p[2] = glm::vec4(0.5f * (skin.sdef_c + r1), 0.0f);
+        }
     }
 }
 
-int Mesh::getNumberOfBones() const { return skeleton.joints.size(); }
+int Mesh::getSkinVariant(size_t v) const {
+    if (!sdef_params.empty() && sdef_params[v * kSdefTexelsPerVertex].w > 0.0f)
+        return kSkinSdef;
+    return joint_weights[v][2] > 0 ? kSkinFourJoints : kSkinTwoJoints;
+}
 
-void Mesh::computeBounds() {
-    bounds.min = glm::vec3(std::numeric_limits<float>::max());
-    bounds.max = glm::vec3(-std::numeric_limits<float>::max());
-    for (const auto& vert : vertices) {
-        bounds.min = glm::min(glm::vec3(vert), bounds.min);
-        bounds.max = glm::max(glm::vec3(vert), bounds.max);
+void Mesh::computeSkinVariants() {
+    for (Material& material : materials) {
+        material.skin_variant = kSkinTwoJoints;
+        for (size_t f = material.offset;
+             f < material.offset + material.nfaces && f < faces.size(); f++) {
+            for (int k = 0; k < 3; k++)
+                material.skin_variant = std::max(
+                    material.skin_variant, getSkinVariant(faces[f][k]));
+        }
     }
 }
 
-void Mesh::updateSkeleton(KeyFrame frame) {
-    for (int i = 0; i < getNumberOfBones(); i++) {
-        skeleton.joints[i].rel_orientation = frame.rel_rot[i];
+void Mesh::computeBoneBounds() {
+    bone_bounds.assign(getNumberOfBones(), BoundingBox::none());
+    for (size_t v = 0; v < vertices.size(); v++) {
+        for (int k = 0; k < 4; k++)
+            if (joint_weights[v][k] > 0)
+                bone_bounds[joint_ids[v][k]].expand(glm::vec3(vertices[v]));
     }
+}
 
-    for (int i = 0; i < getNumberOfBones(); i++) {
-        if (skeleton.joints[i].parent_index == -1) {
-            skeleton.animateTranslate(frame.root,
-                                      skeleton.joints[i].joint_index);
-            skeleton.joints[i].orientation = skeleton.joints[i].rel_orientation;
-            updateFromRel(skeleton.joints[i]);
+void Mesh::loadMorphs(const std::vector<VertexMorph>& vms) {
+    morphs.load(vms, vertices.size());
+
+    /*
+     * Any mix of morphs must still fit in the boxes of the vertex's joints.
+     * The morphs of a vertex add up, so it moves at most the sum of their
+     * absolute offsets times the largest weight along every axis.
+     */
+    std::vector<glm::vec3> reach(vertices.size(), glm::vec3(0.0f));
+    for (const VertexMorph& vm : vms) {
+        for (size_t i = 0; i < vm.vid.size(); i++) {
+            int v = vm.vid[i];
+            if (v < 0 || size_t(v) >= vertices.size()) continue;
+            reach[v] += glm::abs(vm.offset[i]);
+        }
+    }
+    for (size_t v = 0; v < vertices.size(); v++) {
+        if (reach[v] == glm::vec3(0.0f)) continue;
+        glm::vec3 p = glm::vec3(vertices[v]);
+        glm::vec3 r = kMaxMorphWeight * reach[v];
+        for (int k = 0; k < 4; k++) {
+            if (joint_weights[v][k] == 0) continue;
+            bone_bounds[joint_ids[v][k]].expand(p - r);
+            bone_bounds[joint_ids[v][k]].expand(p + r);
         }
     }
 }
 
-void Mesh::updateFromRel(Joint& parent) {
-    for (int child_id : parent.children) {
-        Joint& child = skeleton.joints[child_id];
-        child.orientation = child.rel_orientation * parent.orientation;
+bool Mesh::applyMorphs(size_t& first, size_t& last) {
+    if (!morphs.apply(first, last)) return false;
+    for (size_t i = first; i < last; i++)
+        packed_vertices[i].position =
+            glm::vec3(vertices[i] + morphs.getDisplacement(i));
+    return true;
+}
 
-        Bone* bone = skeleton.bones[child_id];
-        bone->parent_orientation_relative = parent.rel_orientation;
-        bone->orientation = parent.orientation;
+/*
+ * A linear blend lies in the convex hull of the positions each influence
+ * alone would give, so the union of the moved bone boxes holds every
+ * vertex. Dual quaternion and SDEF blends stay within it up to their small
+ * deviation from the linear blend.
+ */
+const BoundingBox& Mesh::getSkinnedBounds() {
+    if (skinned_bounds_version_ == currentQ_.version &&
+        !skinned_bounds_.isNone())
+        return skinned_bounds_;
+    skinned_bounds_ = BoundingBox::none();
+    for (size_t j = 0; j < bone_bounds.size() && j < currentQ_.skin.size();
+         j++) {
+        if (bone_bounds[j].isNone()) continue;
+        skinned_bounds_.expand(bone_bounds[j].transformed(currentQ_.skin[j]));
+    }
+    skinned_bounds_version_ = currentQ_.version;
+    return skinned_bounds_;
+}
 
-        if (parent.parent_index == -1) {
-            bone->deformed_transform =
-                bone->translation *
-                glm::toMat4(bone->parent_orientation_relative);
-        } else {
-            bone->deformed_transform =
-                bone->parent->deformed_transform * bone->translation *
-                glm::toMat4(bone->parent_orientation_relative);
-        }
+int Mesh::getNumberOfBones() const { return skeleton.joints.size(); }
 
-        updateFromRel(child);
-    }
+void Mesh::computeBounds() {
+    bounds = BoundingBox::none();
+    for (const auto& vert : vertices) bounds.expand(glm::vec3(vert));
 }
 
-void Mesh::constructKeyFrame() {
+void Mesh::updateSkeleton(const KeyFrame& frame) { skeleton.setPose(frame); }
+
+KeyFrame Mesh::captureKeyFrame() const {
     KeyFrame frame;
     for (int i = 0; i < getNumberOfBones(); i++) {
-        frame.rel_rot.emplace_back(skeleton.joints[i].rel_orientation);
-    }
-    frame.root = skeleton.joints[0].position - skeleton.joints[0].init_position;
-    key_frames.emplace_back(frame);
-    if (key_frames.size() == 1) {
-        for (int i = 1; i < skeleton.bones.size(); i++) {
-            skeleton.bones[i]->start_translation =
-                skeleton.bones[i]->translation;
-        }
+        frame.rel_rot.emplace_back(skeleton.getRelOrientation(i));
     }
+    frame.root = skeleton.root_translation;
+    return frame;
+}
+
+void Mesh::constructKeyFrame() {
+    key_frames.emplace_back(captureKeyFrame());
+    markKeyFramesDirty();
 }
 
 void Mesh::updateKeyFrame(int frame_id) {
     if (frame_id < 0) return;
-    KeyFrame frame;
-    for (int i = 0; i < skeleton.joints.size(); i++)
-        frame.rel_rot.emplace_back(skeleton.joints[i].rel_orientation);
-
-    frame.root = skeleton.joints[0].position - skeleton.joints[0].init_position;
-    key_frames[frame_id] = frame;
+    key_frames[frame_id] = captureKeyFrame();
+    markKeyFramesDirty();
 }
 
 void Mesh::delKeyFrame(int frame_id) {
     key_frames.erase(key_frames.begin() + frame_id);
+    markKeyFramesDirty();
 }
 
 void Mesh::spaceKeyFrame(int frame_id) {
@@ -348,82 +505,237 @@ void Mesh::spaceKeyFrame(int frame_id) {
     skeleton.refreshCache(&currentQ_);
 }
 
-glm::fquat splineQuat(glm::fquat q0, glm::fquat q1, glm::fquat q2,
-                      glm::fquat q3, float tau) {
-    glm::fquat s1 = q1 * glm::exp((glm::log(glm::inverse(q1) * q2) +
-                                   glm::log(glm::inverse(q1) * q0)) /
-                                  (-4.0f));
-    glm::fquat s2 = q2 * glm::exp((glm::log(glm::inverse(q2) * q3) +
-                                   glm::log(glm::inverse(q2) * q1)) /
-                                  (-4.0f));
-    glm::fquat temp_1 = glm::mix(q1, q2, tau);
-    glm::fquat temp_2 = glm::mix(s1, s2, tau);
-    glm::fquat result = glm::mix(temp_1, temp_2, 2.0f * tau * (1.0f - tau));
-    return result;
-}
-
-glm::fquat calculateSplineQuat(const std::vector<glm::fquat>& bone_rels,
-                               float t) {
-    int id_0 = glm::clamp<int>(t - 1, 0, bone_rels.size() - 1);
-    int id_1 = glm::clamp<int>(t, 0, bone_rels.size() - 1);
-    int id_2 = glm::clamp<int>(t + 1, 0, bone_rels.size() - 1);
-    int id_3 = glm::clamp<int>(t + 2, 0, bone_rels.size() - 1);
-    float tau = t - floor(t);
-    return splineQuat(bone_rels[id_0], bone_rels[id_1], bone_rels[id_2],
-                      bone_rels[id_3], tau);
-    // return glm::fquat(1.0,0.0,0.0,0.0);
-}
-
-void KeyFrame::interpolateSpline(const std::vector<KeyFrame>& key_frames,
-                                 float t, KeyFrame& target,
-                                 const KeyFrame& from, const KeyFrame& to,
-                                 float tau) {
-    for (int i = 0; i < key_frames[0].rel_rot.size(); i++) {
-        std::vector<glm::fquat> bone_rels;
-        for (int f_id = 0; f_id < key_frames.size(); f_id++) {
-            bone_rels.emplace_back(key_frames[f_id].rel_rot[i]);
-        }
-        glm::fquat spline_quat = calculateSplineQuat(bone_rels, t);
-        target.rel_rot.emplace_back(spline_quat);
+void BakedAnimation::resize(float fps, int nframes, int njoints) {
+    this->fps = fps;
+    this->nframes = nframes;
+    this->njoints = njoints;
+    size_t n = size_t(nframes) * njoints;
+    trans.resize(n);
+    rot.resize(n);
+    skin.resize(n);
+    dq_real.resize(n);
+    dq_dual.resize(n);
+    local_rot.resize(n);
+    local_trans.resize(n);
+    root.resize(nframes);
+}
+
+void BakedAnimation::store(int frame, const Skeleton& skeleton,
+                           const Configuration& q) {
+    size_t base = size_t(frame) * njoints;
+    std::copy(q.trans.begin(), q.trans.end(), trans.begin() + base);
+    std::copy(q.rot.begin(), q.rot.end(), rot.begin() + base);
+    std::copy(q.skin.begin(), q.skin.end(), skin.begin() + base);
+    std::copy(q.dq_real.begin(), q.dq_real.end(), dq_real.begin() + base);
+    std::copy(q.dq_dual.begin(), q.dq_dual.end(), dq_dual.begin() + base);
+    std::copy(skeleton.local_rot.begin(), skeleton.local_rot.end(),
+              local_rot.begin() + base);
+    std::copy(skeleton.local_trans.begin(), skeleton.local_trans.end(),
+              local_trans.begin() + base);
+    root[frame] = skeleton.root_translation;
+}
+
+/*
+ * Copy frame f into the palette and pose the skeleton with it. The world
+ * transforms come from the baked palette, so nothing is evaluated, and
+ * the skeleton counts as synced with q: an edit afterwards only refreshes
+ * the joints it touched.
+ */
+void BakedAnimation::load(int frame, Skeleton& skeleton,
+                          Configuration& q) const {
+    size_t base = size_t(frame) * njoints;
+    std::copy(local_rot.begin() + base, local_rot.begin() + base + njoints,
+              skeleton.local_rot.begin());
+    std::copy(local_trans.begin() + base,
+              local_trans.begin() + base + njoints,
+              skeleton.local_trans.begin());
+    skeleton.root_translation = root[frame];
+    for (int s = 0; s < njoints; s++) {
+        size_t id = base + skeleton.joint_of_slot[s];
+        skeleton.world_rot[s] = rot[id];
+        skeleton.world_pos[s] = trans[id];
+        skeleton.world[s] =
+            glm::translate(trans[id]) * glm::toMat4(rot[id]);
+    }
+    skeleton.dirty_begin = skeleton.dirty_end = 0;
+    q.trans.assign(trans.begin() + base, trans.begin() + base + njoints);
+    q.rot.assign(rot.begin() + base, rot.begin() + base + njoints);
+    q.skin.assign(skin.begin() + base, skin.begin() + base + njoints);
+    q.dq_real.assign(dq_real.begin() + base,
+                     dq_real.begin() + base + njoints);
+    q.dq_dual.assign(dq_dual.begin() + base,
+                     dq_dual.begin() + base + njoints);
+    q.changed_first = 0;
+    q.changed_last = njoints;
+    q.version++;
+    skeleton.synced_target = &q;
+    skeleton.synced_version = q.version;
+}
+
+glm::fquat squadControl(const glm::fquat& q0, const glm::fquat& q1,
+                        const glm::fquat& q2) {
+    return q1 * glm::exp((glm::log(glm::inverse(q1) * q2) +
+                          glm::log(glm::inverse(q1) * q0)) /
+                         (-4.0f));
+}
+
+/*
+ * The squad control point of a key depends only on the key and its two
+ * neighbours, so it is computed once per edit instead of once per frame.
+ */
+void KeyFrame::updateSplineControls(std::vector<KeyFrame>& key_frames) {
+    int last = key_frames.size() - 1;
+    for (int f_id = 0; f_id <= last; f_id++) {
+        const KeyFrame& prev = key_frames[std::max(f_id - 1, 0)];
+        const KeyFrame& next = key_frames[std::min(f_id + 1, last)];
+        KeyFrame& frame = key_frames[f_id];
+        frame.spline_ctrl.resize(frame.rel_rot.size());
+        for (size_t i = 0; i < frame.rel_rot.size(); i++)
+            frame.spline_ctrl[i] = squadControl(
+                prev.rel_rot[i], frame.rel_rot[i], next.rel_rot[i]);
+    }
+}
+
+void KeyFrame::interpolateSpline(const KeyFrame& from, const KeyFrame& to,
+                                 float tau, KeyFrame& target) {
+    float h = 2.0f * tau * (1.0f - tau);
+    target.rel_rot.resize(from.rel_rot.size());
+    for (size_t i = 0; i < target.rel_rot.size(); i++) {
+        glm::fquat temp_1 = glm::mix(from.rel_rot[i], to.rel_rot[i], tau);
+        glm::fquat temp_2 =
+            glm::mix(from.spline_ctrl[i], to.spline_ctrl[i], tau);
+        target.rel_rot[i] = glm::mix(temp_1, temp_2, h);
     }
 
     target.root = (1 - tau) * from.root + tau * to.root;
 }
 
 void Mesh::insertKeyFrame(int frame_id) {
-    KeyFrame frame;
-    for (int i = 0; i < skeleton.joints.size(); i++)
-        frame.rel_rot.emplace_back(skeleton.joints[i].rel_orientation);
+    key_frames.insert(key_frames.begin() + frame_id, captureKeyFrame());
+    markKeyFramesDirty();
+}
 
-    frame.root = skeleton.joints[0].position - skeleton.joints[0].init_position;
+void Mesh::markKeyFramesDirty() {
+    spline_dirty_ = true;
+    bake_dirty_ = true;
+    clip_dirty_ = true;
+}
 
-    key_frames.insert(key_frames.begin() + frame_id, frame);
+const AnimationClip& Mesh::getClip() {
+    if (clip_dirty_) {
+        clip_.compress(key_frames, kClipRotationTolerance,
+                       kClipTranslationTolerance);
+        clip_dirty_ = false;
+    }
+    return clip_;
+}
+
+/*
+ * Interpolate the key frames at time t, which must lie in
+ * [0, key_frames.size() - 1].
+ */
+void Mesh::interpolateAt(float t, KeyFrame& target) {
+    int frame_id = std::min<int>(floor(t), key_frames.size() - 2);
+    float tao = t - frame_id;
+    if (spline_) {
+        if (spline_dirty_) {
+            KeyFrame::updateSplineControls(key_frames);
+            spline_dirty_ = false;
+        }
+        KeyFrame::interpolateSpline(key_frames[frame_id],
+                                    key_frames[frame_id + 1], tao, target);
+    } else
+        KeyFrame::interpolate(key_frames[frame_id], key_frames[frame_id + 1],
+                              tao, target);
+}
+
+/*
+ * Evaluate the whole timeline at the given rate into bake_. Frames are
+ * independent, so every thread poses its own copy of the skeleton.
+ */
+void Mesh::bakeAnimation(float fps) {
+    int nframes = 0;
+    if (hasMotion() || key_frames.size() > 1)
+        nframes = int(getDuration() * fps) + 1;
+    bake_.resize(fps, nframes, getNumberOfBones());
+    if (spline_ && spline_dirty_) {
+        KeyFrame::updateSplineControls(key_frames);
+        spline_dirty_ = false;
+    }
 
-    if (frame_id == 0) {
-        for (int i = 1; i < skeleton.bones.size(); i++) {
-            skeleton.bones[i]->start_translation =
-                skeleton.bones[i]->translation;
+#pragma omp parallel
+    {
+        Skeleton local = skeleton;
+        KeyFrame frame;
+        Configuration q;
+#pragma omp for schedule(static)
+        for (int f = 0; f < nframes; f++) {
+            float t = std::min(f / fps, getDuration());
+            if (hasMotion())
+                motion_.sample(t * kMotionFps, frame);
+            else
+                interpolateAt(t, frame);
+            local.setPose(frame);
+            // Solve every frame cold: the warm start would make a frame
+            // depend on which thread baked the one before it.
+            local.ik.resetWarmStart();
+            solveIK(local, IKBudget());
+            local.refreshCache(&q);
+            bake_.store(f, local, q);
         }
     }
+    bake_dirty_ = false;
+}
+
+float Mesh::getDuration() const {
+    if (hasMotion()) return motion_.duration();
+    return std::max<int>(key_frames.size() - 1, 0);
 }
 
 void Mesh::updateAnimation(float t) {
-    skeleton.refreshCache(&currentQ_);
+    updateAnimation(t, IKBudget(kIKFrameBudget));
+}
+
+void Mesh::updateAnimation(float t, const IKBudget& budget) {
+    if (baked_ && t != -1.0) {
+        if (bake_dirty_) bakeAnimation(kBakeFps);
+        if (bake_.nframes > 0) {
+            int f = glm::clamp<int>(t * bake_.fps + 0.5f, 0, bake_.nframes - 1);
+            bake_.load(f, skeleton, currentQ_);
+            return;
+        }
+    }
 
     int frame_id = floor(t);
-    if (t != -1.0 && frame_id + 1 < (int)key_frames.size()) {
-        float tao = t - frame_id;
-        KeyFrame frame;
-        if (spline_)
-            KeyFrame::interpolateSpline(key_frames, t, frame,
-                                        key_frames[frame_id],
-                                        key_frames[frame_id + 1], tao);
+    if (t != -1.0 && hasMotion()) {
+        // Past the end the motion holds its last pose.
+        motion_.sample(t * kMotionFps, playback_frame_);
+        updateSkeleton(playback_frame_);
+    } else if (t != -1.0 && frame_id + 1 < (int)key_frames.size()) {
+        // The clip is reduced against linear blending, so it ignores spline_.
+        if (compressed_)
+            getClip().sample(t, playback_frame_);
         else
-            KeyFrame::interpolate(key_frames[frame_id],
-                                  key_frames[frame_id + 1], tao, frame);
-
-        updateSkeleton(frame);
+            interpolateAt(t, playback_frame_);
+        updateSkeleton(playback_frame_);
     }
+
+    solveIK(skeleton, budget);
+    skeleton.refreshCache(&currentQ_);
+}
+
+void Mesh::solveIK(Skeleton& skeleton, const IKBudget& budget) {
+    if (!skeleton.ik.isEnabled()) return;
+    skeleton.evaluate();
+    skeleton.ik.solve(skeleton, budget);
+}
+
+bool Mesh::moveIKGoal(int joint, const glm::vec3& delta) {
+    int chain = skeleton.ik.findGoal(joint);
+    if (!getIK() || chain < 0) return false;
+    skeleton.ik.moveGoal(chain, delta);
+    bake_dirty_ = true;
+    return true;
 }
 
 const Configuration* Mesh::getCurrentQ() const { return &currentQ_; }
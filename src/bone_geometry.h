@@ -4,11 +4,16 @@
 #include <mmdadapter.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_precision.hpp>
 #include <limits>
 #include <map>
 #include <ostream>
 #include <string>
 #include <vector>
+#include "animation_clip.h"
+#include "ik_solver.h"
+#include "morph_set.h"
+#include "motion_clip.h"
 
 class TextureToRender;
 
@@ -18,95 +23,122 @@ struct BoundingBox {
           max(glm::vec3(std::numeric_limits<float>::max())) {}
     glm::vec3 min;
     glm::vec3 max;
+
+    // Inverted box, the first expand() replaces it.
+    static BoundingBox none();
+    bool isNone() const { return min.x > max.x; }
+    void expand(const glm::vec3& p) {
+        min = glm::min(min, p);
+        max = glm::max(max, p);
+    }
+    void expand(const BoundingBox& b) {
+        min = glm::min(min, b.min);
+        max = glm::max(max, b.max);
+    }
+    // Bounds of this box after an affine transform.
+    BoundingBox transformed(const glm::mat4& m) const;
 };
 
 struct Joint {
     Joint()
         : joint_index(-1),
           parent_index(-1),
-          position(glm::vec3(0.0f)),
-          init_position(glm::vec3(0.0f)) {}
+          init_position(glm::vec3(0.0f)),
+          init_rel_position(glm::vec3(0.0f)) {}
     Joint(int id, glm::vec3 wcoord, int parent)
         : joint_index(id),
           parent_index(parent),
-          position(wcoord),
           init_position(wcoord),
           init_rel_position(init_position) {}
 
     int joint_index;
     int parent_index;
-    glm::vec3 position;      // position of the joint
-    glm::fquat orientation;  // rotation w.r.t. initial configuration
-    glm::fquat
-        rel_orientation;  // rotation w.r.t. it's parent. Used for animation.
     glm::vec3 init_position;      // initial position of this joint
     glm::vec3 init_rel_position;  // initial relative position to its parent
     std::vector<int> children;
+    std::wstring name;  // as in the model file, motions find the joint by it
 };
 
+/*
+ * Bone: static description of the segment from joint parent_index to joint
+ * index, used for picking and drawing. The pose itself lives in Skeleton.
+ */
 struct Bone {
-    Bone(Joint start, Joint end) {
-        this->start = &start;
-        this->end = &end;
-        this->index = end.joint_index;
-        this->parent_index = start.joint_index;
-        this->length = glm::length(end.position - start.position);
-        this->direction = glm::normalize(end.position - start.position);
-        this->parent = nullptr;
-        this->parent_orientation_relative = glm::fquat(1.0, 0.0, 0.0, 0.0);
-        this->orientation = glm::fquat(1.0, 0.0, 0.0, 0.0);
-        this->root = start.joint_index;
-    };
-
-    // properities
+    Bone() : index(-1), parent_index(-1), length(0.0), direction(0.0f) {}
+    Bone(const Joint& start, const Joint& end)
+        : index(end.joint_index),
+          parent_index(start.joint_index),
+          length(glm::length(end.init_position - start.init_position)),
+          direction(
+              glm::normalize(end.init_position - start.init_position)) {}
+
+    bool valid() const { return parent_index >= 0; }
 
     int index;
     int parent_index;
-    int root;
     double length;
-
-    glm::vec3 direction;
-
-    Joint* start;
-    Joint* end;
-
-    Bone* parent;
-    std::vector<Bone*> nodes;
-
-    // matrices
-    glm::mat4 start_translation;
-    glm::mat4 undeformed_transform;
-    glm::mat4 deformed_transform;
-    glm::mat4 translation;
-
-    glm::fquat parent_orientation_relative;
-    glm::fquat orientation;
-
-    void translate(glm::vec3 translation);
-    void translateParent();
-    void performAnimateTranslate(glm::vec3 diff_translation);
-    void rotate(glm::fquat rotate_);
-    void rotate_(glm::fquat rotate_);
-    void rotateParent();
+    glm::vec3 direction;  // in the bind pose
 };
 
 struct Configuration {
     std::vector<glm::vec3> trans;
     std::vector<glm::fquat> rot;
+    std::vector<glm::mat4> skin;  // skinning palette: world * inverse bind
+    std::vector<glm::fquat> dq_real;  // same palette as dual quaternions
+    std::vector<glm::fquat> dq_dual;
+    // Bumped on every refresh that changed something. changed_first and
+    // changed_last bound the joint ids touched by the latest version.
+    size_t version = 0;
+    int changed_first = 0;
+    int changed_last = 0;
 
     const auto& transData() const { return trans; }
     const auto& rotData() const { return rot; }
+    const auto& skinData() const { return skin; }
+    const auto& realData() const { return dq_real; }
+    const auto& dualData() const { return dq_dual; }
+};
+
+struct Skeleton;
+
+/*
+ * BakedAnimation: the key frame timeline pre-evaluated at a fixed frame
+ * rate. The palette of frame f starts at f * njoints in every array, so
+ * playback only copies one slice. The local pose of every slot is kept as
+ * well, loading a frame leaves the skeleton in that pose for picking and
+ * editing.
+ */
+struct BakedAnimation {
+    float fps = 0.0f;
+    int nframes = 0;
+    int njoints = 0;
+    std::vector<glm::vec3> trans;
+    std::vector<glm::fquat> rot;
+    std::vector<glm::mat4> skin;
+    std::vector<glm::fquat> dq_real;
+    std::vector<glm::fquat> dq_dual;
+    std::vector<glm::fquat> local_rot;  // by slot
+    std::vector<glm::vec3> local_trans;
+    std::vector<glm::vec3> root;  // one per frame
+
+    void resize(float fps, int nframes, int njoints);
+    void store(int frame, const Skeleton& skeleton, const Configuration& q);
+    void load(int frame, Skeleton& skeleton, Configuration& q) const;
 };
 
 struct KeyFrame {
     std::vector<glm::fquat> rel_rot;
     glm::vec3 root;
+    // Offsets of the joints from their bind positions, in the parent's
+    // frame. Empty keeps every joint at its bind position.
+    std::vector<glm::vec3> rel_trans;
+    // Squad control point of every rotation, see updateSplineControls.
+    std::vector<glm::fquat> spline_ctrl;
     static void interpolate(const KeyFrame& from, const KeyFrame& to, float tau,
                             KeyFrame& target);
-    static void interpolateSpline(const std::vector<KeyFrame>& key_frames,
-                                  float t, KeyFrame& target,
-                                  const KeyFrame& from, const KeyFrame& to,
-                                  float tau);
+    static void interpolateSpline(const KeyFrame& from, const KeyFrame& to,
+                                  float tau, KeyFrame& target);
+    static void updateSplineControls(std::vector<KeyFrame>& key_frames);
 };
 
 struct LineMesh {
@@ -116,17 +148,65 @@ struct LineMesh {
 
 struct Skeleton {
     std::vector<Joint> joints;
+    std::vector<Bone> bones;  // bones[i] ends at joint i, roots have none
+
+    /*
+     * Flat pose storage. Joints are laid out in slots sorted in depth-first
+     * preorder (parents before children), so the whole hierarchy is
+     * evaluated by one forward pass over contiguous arrays.
+     */
+    std::vector<int> joint_of_slot;
+    std::vector<int> slot_of_joint;
+    std::vector<int> parent_slot;  // -1 for roots
+    std::vector<int> subtree_end;  // slots [s, subtree_end[s]) are s's subtree
+    std::vector<glm::fquat> local_rot;
+    std::vector<glm::vec3> local_trans;
+    std::vector<glm::fquat> world_rot;
+    std::vector<glm::vec3> world_pos;
+    std::vector<glm::mat4> world;
+    std::vector<glm::mat4> inverse_bind;  // fixed once constructed
+    std::vector<glm::fquat> inverse_bind_rot;
+    glm::vec3 root_translation = glm::vec3(0.0f);
+    // Slots whose world transform is stale, evaluate() only visits these.
+    int dirty_begin = 0;
+    int dirty_end = 0;
+    // Configuration and version written by the latest refreshCache. If
+    // either differs, the target was changed elsewhere and gets a full copy.
+    const Configuration* synced_target = nullptr;
+    size_t synced_version = 0;
 
     Configuration cache;
+    IKSolver ik;
 
+    void construct();
+    void setPose(const KeyFrame& frame);
+    void markDirty(int joint);
+    void markAllDirty();
+    bool isDirty() const { return dirty_begin < dirty_end; }
+    void evaluate();
+    void evaluateSlot(int s);
     void refreshCache(Configuration* cache = nullptr);
     const glm::vec3* collectJointTrans() const;
     const glm::fquat* collectJointRot() const;
-    void constructBone(int joint);
-    void translate(glm::vec3 translation, int root);
-    void animateTranslate(glm::vec3 diff_translation, int root_id);
-    // FIXME: create skeleton and bone data structures
-    std::vector<Bone*> bones;
+
+    const glm::fquat& getRelOrientation(int joint) const;
+    void setRelOrientation(int joint, const glm::fquat& rel);
+    glm::vec3 getPosition(int joint) const;
+    const glm::mat4& getTransform(int joint) const;
+    void rotate(int joint, glm::fquat rotation);
+    void translate(glm::vec3 translation);
+};
+
+/*
+ * SkinnedVertex: interleaved, quantized vertex of the object pass, 36 bytes
+ * instead of the 64 of separate float attributes.
+ */
+struct SkinnedVertex {
+    glm::vec3 position;
+    uint32_t normal;  // GL_INT_2_10_10_10_REV, normalized
+    uint32_t uv;      // two half floats
+    glm::u16vec4 joint_ids;
+    glm::u16vec4 joint_weights;  // unorm16
 };
 
 struct Mesh {
@@ -136,12 +216,25 @@ struct Mesh {
     /*
      * Static per-vertex attrributes for Shaders
      */
-    std::vector<int32_t> joint0;
-    std::vector<int32_t> joint1;
-    std::vector<float>
-        weight_for_joint0;  // weight_for_joint1 can be calculated
-    std::vector<glm::vec3> vector_from_joint0;
-    std::vector<glm::vec3> vector_from_joint1;
+    // Up to four influences per vertex: joint ids and unorm16 weights that
+    // sum to 65535, heaviest first. Unused slots have zero weight.
+    std::vector<glm::u16vec4> joint_ids;
+    std::vector<glm::u16vec4> joint_weights;
+    /*
+     * SDEF parameters, kSdefTexelsPerVertex texels per vertex and empty if
+     * the model has no SDEF vertex: (C, 1), and the midpoints of C and the
+     * corrected R0 and R1. The w of the first texel is 0 for other vertices.
+     */
+    std::vector<glm::vec4> sdef_params;
+    // All of the above packed for the GPU, see packVertices.
+    std::vector<SkinnedVertex> packed_vertices;
+    // Bind pose bounds of the vertices each joint influences, including
+    // where the morphs can move them.
+    std::vector<BoundingBox> bone_bounds;
+    MorphSet morphs;
+    // Physics of the model, simulated by a PhysicsReactor.
+    std::vector<RigidBody> rigid_bodies;
+    std::vector<SpringConstraint> spring_constraints;
     std::vector<glm::vec4> vertex_normals;
     std::vector<glm::vec4> face_normals;
     std::vector<glm::vec2> uv_coordinates;
@@ -153,15 +246,37 @@ struct Mesh {
     Skeleton skeleton;
 
     void loadPmd(const std::string& fn);
+    /*
+     * Where loadPmd keeps the model cache: next to the model by default,
+     * in dir if it is set, nowhere if disabled. Models of the same file
+     * name share a cache in dir, whichever was loaded last rebuilds it.
+     */
+    void setModelCacheDir(const std::string& dir) { cache_dir_ = dir; }
+    void setModelCache(bool x) { model_cache_ = x; }
     int getNumberOfBones() const;
     glm::vec3 getCenter() const {
         return 0.5f * glm::vec3(bounds.min + bounds.max);
     }
+    /*
+     * Bounds of the current pose, the union of bone_bounds moved by the
+     * skinning palette. No vertex is touched.
+     */
+    const BoundingBox& getSkinnedBounds();
+    /*
+     * Move packed_vertices by the current morph weights. Returns false if
+     * nothing changed, otherwise [first, last) are the vertices to upload.
+     */
+    bool applyMorphs(size_t& first, size_t& last);
+    // Cheapest skinning shader variant for vertex v alone, a kSkin value.
+    int getSkinVariant(size_t v) const;
     const Configuration* getCurrentQ()
         const;  // Configuration is abbreviated as Q
     void updateAnimation(float t = -1.0);
-    void updateSkeleton(KeyFrame frame);
-    void updateFromRel(Joint& parent);
+    // Same, with the IK time budget shared by the whole frame.
+    void updateAnimation(float t, const IKBudget& budget);
+    void updateSkeleton(const KeyFrame& frame);
+    // Refresh the palette after the skeleton was changed directly.
+    void refreshPose() { skeleton.refreshCache(&currentQ_); }
 
     void constructKeyFrame();
     void delKeyFrame(int frame_id);
@@ -169,16 +284,79 @@ struct Mesh {
     void spaceKeyFrame(int frame_id);
     void insertKeyFrame(int frame_id);
 
+    /*
+     * Animations ending in .anim are saved in the binary format, the rest
+     * as JSON. Loading detects the format from the file contents, a VMD
+     * motion replaces the key frames in playback until another animation
+     * is loaded.
+     */
     void saveAnimationTo(const std::string& fn);
     void loadAnimationFrom(const std::string& fn);
-    void setSpline(bool x) { spline_ = x; }
+    bool hasMotion() const { return !motion_.empty(); }
+    // Length of what playback plays, the motion or the key frames, in
+    // seconds.
+    float getDuration() const;
+    void setSpline(bool x) {
+        spline_ = x;
+        bake_dirty_ = true;
+    }
     bool getSpline() { return spline_; }
+    void setBaked(bool x) { baked_ = x; }
+    bool getBaked() const { return baked_; }
+    void bakeAnimation(float fps);
+    void setCompressed(bool x) { compressed_ = x; }
+    bool getCompressed() const { return compressed_; }
+    const AnimationClip& getClip();
+    void setIK(bool x) {
+        skeleton.ik.setEnabled(x);
+        bake_dirty_ = true;
+    }
+    bool getIK() const { return skeleton.ik.isEnabled(); }
+    // Drag the IK goal at the given joint, false if it isn't one.
+    bool moveIKGoal(int joint, const glm::vec3& delta);
 
    private:
+    KeyFrame captureKeyFrame() const;
+    void saveAnimationBinary(const std::string& fn);
+    bool loadAnimationBinary(const std::string& fn);
+    bool loadMotion(const std::string& fn);
+    void interpolateAt(float t, KeyFrame& target);
+    static void solveIK(Skeleton& skeleton, const IKBudget& budget);
+    void markKeyFramesDirty();
     void computeBounds();
+    void readPmd(const std::string& fn, std::vector<IKChain>& chains,
+                 std::vector<VertexMorph>& vms);
+    /*
+     * The model cache of a PMD file holds what readPmd gets from it.
+     * Return: false if there is no cache for this version of the file.
+     */
+    std::string modelCachePath(const std::string& fn) const;
+    bool loadModelCache(const std::string& fn, std::vector<IKChain>& chains,
+                        std::vector<VertexMorph>& vms);
+    void saveModelCache(const std::string& fn,
+                        const std::vector<IKChain>& chains,
+                        const std::vector<VertexMorph>& vms);
+    void loadSkinning(MMDReader& mr);
+    void computeBoneBounds();
+    void loadMorphs(const std::vector<VertexMorph>& vms);
+    void packVertices();
+    void computeSkinVariants();
     void computeNormals();
     Configuration currentQ_;
+    BoundingBox skinned_bounds_;
+    size_t skinned_bounds_version_ = 0;
+    KeyFrame playback_frame_;  // scratch reused by every playback frame
+    bool spline_dirty_ = true;  // key_frames changed since the last squad
+    BakedAnimation bake_;
+    bool baked_ = false;       // play back from bake_
+    bool bake_dirty_ = true;   // key_frames changed since the last bake
+    AnimationClip clip_;
+    bool compressed_ = false;  // play back from clip_
+    bool clip_dirty_ = true;   // key_frames changed since the last compress
+    MotionClip motion_;        // played instead of key_frames if not empty
     bool spline_ = false;
+    std::string cache_dir_;    // of the model cache, empty: the model's
+    bool model_cache_ = true;
 };
 
 #endif
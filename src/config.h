@@ -6,7 +6,14 @@
  */
 
 const float kCylinderRadius = 0.25;
-const int kMaxBones = 128;
+// RGBA32F texels per joint in the palette buffer, the shaders assume 3.
+const int kPaletteTexelsPerJoint = 3;
+// RGBA32F texels per vertex in Mesh::sdef_params, the shaders assume 3.
+const int kSdefTexelsPerVertex = 3;
+// Values of Material::skin_variant.
+const int kSkinTwoJoints = 0;
+const int kSkinFourJoints = 1;
+const int kSkinSdef = 2;
 /*
  * Extra credit: what would happen if you set kNear to 1e-5? How to solve it?
  */
@@ -24,4 +31,36 @@ const float kFloorY = -0.75617 - kFloorEps;
 
 const float kScrollSpeed = 64.0f;
 
+// Frame rate of the exported video, as passed to ffmpeg in GUI::cmd.
+// Export renders every frame of the timeline at this rate, however long
+// each takes.
+const float kExportFps = 60.0f;
+// Frame rate of baked playback, matches the rate of the exported video.
+const float kBakeFps = kExportFps;
+
+// Largest weight of a vertex morph, weights are clamped to [0, this].
+// The bone boxes are grown for every morph of a vertex at this weight.
+const float kMaxMorphWeight = 1.0f;
+
+// Frame rate of the VMD motion timeline.
+const float kMotionFps = 30.0f;
+
+// Largest error AnimationClip may introduce when dropping keys, in radians
+// of joint rotation and in units of root translation.
+const float kClipRotationTolerance = 0.002f;
+const float kClipTranslationTolerance = 0.001f;
+
+// Distance at which an IK target counts as having reached its goal.
+const float kIKTolerance = 1e-3f;
+// Time all IK chains of a frame may take, in seconds.
+const double kIKFrameBudget = 0.002;
+
+// Fixed step of the physics reactor in seconds, the most steps one frame
+// may take, and the constraint passes per step.
+const float kPhysicsStep = 1.0f / 120.0f;
+const int kPhysicsMaxSteps = 8;
+const int kPhysicsIterations = 4;
+// Gravity in model units (about 10 per meter) per second^2.
+const float kPhysicsGravity = 98.0f;
+
 #endif
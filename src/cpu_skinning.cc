@@ -0,0 +1,262 @@
+#include "cpu_skinning.h"
+#include <glm/gtc/quaternion.hpp>
+#include "bone_geometry.h"
+#include "config.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SKINNING_SSE
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Influence count, joint ids and weights of one vertex.
+struct Influences {
+    int n;
+    int jid[4];
+    float w[4];
+};
+
+glm::vec3 qtransform(const glm::fquat& q, const glm::vec3& v) {
+    glm::vec3 u(q.x, q.y, q.z);
+    return v + 2.0f * glm::cross(glm::cross(v, u) - q.w * v, u);
+}
+
+glm::vec3 dqTranslation(const glm::fquat& r, const glm::fquat& d) {
+    glm::vec3 ru(r.x, r.y, r.z), du(d.x, d.y, d.z);
+    return 2.0f * (r.w * du - d.w * ru + glm::cross(ru, du));
+}
+
+glm::vec4 safeNormalize(const glm::vec3& n) {
+    float len = glm::length(n);
+    return len > 0.0f ? glm::vec4(n / len, 0.0f) : glm::vec4(0.0f);
+}
+
+/*
+ * SDEF as in blending.vert: rotate around C by the blended rotation of the
+ * two bones, and carry C along with the midpoints c0 and c1. Rare enough
+ * that it stays scalar.
+ */
+void skinSdef(const Configuration& q, int j0, int j1, float w0,
+              const glm::vec4* sdef, const glm::vec4& v, const glm::vec4& n,
+              glm::vec4& out_v, glm::vec4& out_n) {
+    const glm::fquat& r0 = q.dq_real[j0];
+    const glm::fquat& r1 = q.dq_real[j1];
+    float w1 = glm::dot(r0, r1) < 0.0f ? w0 - 1.0f : 1.0f - w0;
+    glm::fquat r = glm::normalize(w0 * r0 + w1 * r1);
+    glm::vec3 c(sdef[0]), c0(sdef[1]), c1(sdef[2]);
+    glm::vec3 p0 = qtransform(r0, c0) + dqTranslation(r0, q.dq_dual[j0]);
+    glm::vec3 p1 = qtransform(r1, c1) + dqTranslation(r1, q.dq_dual[j1]);
+    out_v = glm::vec4(
+        qtransform(r, glm::vec3(v) - c) + w0 * p0 + (1.0f - w0) * p1, 1.0f);
+    out_n = safeNormalize(qtransform(r, glm::vec3(n)));
+}
+
+// Blend of one vertex by its influences, SDEF aside.
+typedef void (*BlendFn)(const Configuration& q, const Influences& in,
+                        const glm::vec4& v, const glm::vec4& n,
+                        glm::vec4& out_v, glm::vec4& out_n);
+
+void skinLinear(const Configuration& q, const Influences& in,
+                const glm::vec4& v, const glm::vec4& n, glm::vec4& out_v,
+                glm::vec4& out_n) {
+    glm::mat4 m = in.w[0] * q.skin[in.jid[0]];
+    for (int i = 1; i < in.n; i++) m = m + in.w[i] * q.skin[in.jid[i]];
+    out_v = m * glm::vec4(glm::vec3(v), 1.0f);
+    out_v.w = 1.0f;
+    out_n = safeNormalize(glm::vec3(m * glm::vec4(glm::vec3(n), 0.0f)));
+}
+
+void skinDual(const Configuration& q, const Influences& in,
+              const glm::vec4& v, const glm::vec4& n, glm::vec4& out_v,
+              glm::vec4& out_n) {
+    const glm::fquat& pivot = q.dq_real[in.jid[0]];
+    glm::fquat r(0.0f, 0.0f, 0.0f, 0.0f), d(0.0f, 0.0f, 0.0f, 0.0f);
+    for (int i = 0; i < in.n; i++) {
+        const glm::fquat& qr = q.dq_real[in.jid[i]];
+        float w = glm::dot(pivot, qr) < 0.0f ? -in.w[i] : in.w[i];
+        r = r + w * qr;
+        d = d + w * q.dq_dual[in.jid[i]];
+    }
+    float len = glm::length(r);
+    r = r / len;
+    d = d / len;
+    out_v = glm::vec4(qtransform(r, glm::vec3(v)) + dqTranslation(r, d),
+                      1.0f);
+    out_n = safeNormalize(qtransform(r, glm::vec3(n)));
+}
+
+#ifdef SKINNING_SSE
+
+inline __m128 load(const glm::fquat& q) {
+    return _mm_setr_ps(q.x, q.y, q.z, q.w);
+}
+
+inline __m128 load(const glm::vec4& v) { return _mm_loadu_ps(&v[0]); }
+
+inline __m128 splat(__m128 v, int lane) {
+    switch (lane) {
+        case 0: return _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0));
+        case 1: return _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1));
+        case 2: return _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2));
+        default: return _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+}
+
+inline __m128 dot4(__m128 a, __m128 b) {
+    __m128 m = _mm_mul_ps(a, b);
+    __m128 s = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_add_ps(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+// xyz cross product, w of the result is 0.
+inline __m128 cross3(__m128 a, __m128 b) {
+    __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+inline __m128 normalize3(__m128 v) {
+    __m128 xyz = _mm_and_ps(v, _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0)));
+    __m128 len2 = dot4(xyz, xyz);
+    __m128 mask = _mm_cmpgt_ps(len2, _mm_setzero_ps());
+    return _mm_and_ps(_mm_div_ps(xyz, _mm_sqrt_ps(len2)), mask);
+}
+
+// qtransform of blending.vert: v + 2 cross(cross(v, q) - q.w v, q)
+inline __m128 qtransform(__m128 q, __m128 v) {
+    __m128 t = _mm_sub_ps(cross3(v, q), _mm_mul_ps(splat(q, 3), v));
+    __m128 c = cross3(t, q);
+    return _mm_add_ps(v, _mm_add_ps(c, c));
+}
+
+void skinLinearSse(const Configuration& q, const Influences& in,
+                   const glm::vec4& v, const glm::vec4& n, glm::vec4& out_v,
+                   glm::vec4& out_n) {
+    __m128 c[4] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(),
+                   _mm_setzero_ps()};
+    for (int i = 0; i < in.n; i++) {
+        const glm::mat4& m = q.skin[in.jid[i]];
+        __m128 w = _mm_set1_ps(in.w[i]);
+        for (int k = 0; k < 4; k++)
+            c[k] = _mm_add_ps(c[k], _mm_mul_ps(w, load(m[k])));
+    }
+
+    __m128 vv = load(v);
+    __m128 p = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(c[0], splat(vv, 0)),
+                   _mm_mul_ps(c[1], splat(vv, 1))),
+        _mm_add_ps(_mm_mul_ps(c[2], splat(vv, 2)), c[3]));
+    __m128 nn = load(n);
+    __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[0], splat(nn, 0)),
+                                     _mm_mul_ps(c[1], splat(nn, 1))),
+                          _mm_mul_ps(c[2], splat(nn, 2)));
+    _mm_storeu_ps(&out_v[0], p);
+    _mm_storeu_ps(&out_n[0], normalize3(r));
+    out_v.w = 1.0f;
+}
+
+// trans of blending.vert: 2 (r.w d - d.w r + cross(r, d))
+inline __m128 dqTranslation(__m128 r, __m128 d) {
+    __m128 t = _mm_add_ps(
+        _mm_sub_ps(_mm_mul_ps(splat(r, 3), d), _mm_mul_ps(splat(d, 3), r)),
+        cross3(r, d));
+    return _mm_add_ps(t, t);
+}
+
+void skinDualSse(const Configuration& q, const Influences& in,
+                 const glm::vec4& v, const glm::vec4& n, glm::vec4& out_v,
+                 glm::vec4& out_n) {
+    __m128 pivot = load(q.dq_real[in.jid[0]]);
+    __m128 r = _mm_setzero_ps();
+    __m128 d = _mm_setzero_ps();
+    for (int i = 0; i < in.n; i++) {
+        __m128 qr = load(q.dq_real[in.jid[i]]);
+        __m128 qd = load(q.dq_dual[in.jid[i]]);
+        // Blend along the shortest arc.
+        float w = in.w[i];
+        if (_mm_cvtss_f32(dot4(pivot, qr)) < 0.0f) w = -w;
+        __m128 ww = _mm_set1_ps(w);
+        r = _mm_add_ps(r, _mm_mul_ps(ww, qr));
+        d = _mm_add_ps(d, _mm_mul_ps(ww, qd));
+    }
+    __m128 len = _mm_sqrt_ps(dot4(r, r));
+    r = _mm_div_ps(r, len);
+    d = _mm_div_ps(d, len);
+
+    __m128 p = _mm_add_ps(qtransform(r, load(v)), dqTranslation(r, d));
+    __m128 nn = load(n);
+    _mm_storeu_ps(&out_v[0], p);
+    _mm_storeu_ps(&out_n[0], normalize3(qtransform(r, nn)));
+    out_v.w = 1.0f;
+}
+
+#endif
+
+/*
+ * Skin every vertex with one blend. It is a template argument so the
+ * call is direct and the blend can be inlined into the loop.
+ */
+template <BlendFn blend>
+void skinAll(const Mesh& mesh, const Configuration& q, glm::vec4* positions,
+             glm::vec4* normals) {
+    int n = mesh.vertices.size();
+    bool has_sdef = !mesh.sdef_params.empty();
+    // The morphs as last applied, like the positions the shaders get.
+    bool morphed = mesh.morphs.size() > 0;
+
+#pragma omp parallel for schedule(static)
+    for (int i = 0; i < n; i++) {
+        const glm::u16vec4& ids = mesh.joint_ids[i];
+        const glm::u16vec4& weights = mesh.joint_weights[i];
+        glm::vec4 v = mesh.vertices[i];
+        if (morphed) v += mesh.morphs.getDisplacement(i);
+        if (has_sdef && mesh.sdef_params[i * kSdefTexelsPerVertex].w > 0.0f) {
+            skinSdef(q, ids[0], ids[1], weights[0] / 65535.0f,
+                     &mesh.sdef_params[i * kSdefTexelsPerVertex], v,
+                     mesh.vertex_normals[i], positions[i], normals[i]);
+            continue;
+        }
+        // Two-joint vertices skip the empty slots.
+        Influences in;
+        in.n = weights[2] == 0 ? 2 : 4;
+        for (int k = 0; k < in.n; k++) {
+            in.jid[k] = ids[k];
+            in.w[k] = weights[k] / 65535.0f;
+        }
+        blend(q, in, v, mesh.vertex_normals[i], positions[i], normals[i]);
+    }
+}
+
+}  // namespace
+
+bool CpuSkinner::isVectorized() const {
+#ifdef SKINNING_SSE
+    return vectorized_;
+#else
+    return false;
+#endif
+}
+
+void CpuSkinner::skin(const Mesh& mesh, const Configuration& q,
+                      SkinningMode mode) {
+    positions_.resize(mesh.vertices.size());
+    normals_.resize(mesh.vertices.size());
+    bool dual = mode == SkinningMode::kDualQuaternion;
+#ifdef SKINNING_SSE
+    if (vectorized_) {
+        if (dual)
+            skinAll<skinDualSse>(mesh, q, positions_.data(), normals_.data());
+        else
+            skinAll<skinLinearSse>(mesh, q, positions_.data(),
+                                   normals_.data());
+        return;
+    }
+#endif
+    if (dual)
+        skinAll<skinDual>(mesh, q, positions_.data(), normals_.data());
+    else
+        skinAll<skinLinear>(mesh, q, positions_.data(), normals_.data());
+}
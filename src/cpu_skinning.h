@@ -0,0 +1,43 @@
+#ifndef CPU_SKINNING_H
+#define CPU_SKINNING_H
+
+#include <glm/glm.hpp>
+#include <vector>
+
+struct Mesh;
+struct Configuration;
+
+enum class SkinningMode { kLinearBlend, kDualQuaternion };
+
+/*
+ * CpuSkinner: deforms the mesh on the CPU with the same two-joint blend as
+ * blending.vert, for export, bounds and collision. Vertices are displaced
+ * by the morphs as of the last MorphSet::apply(). Vertex ranges are
+ * split across OpenMP threads and each vertex is blended with SSE where
+ * available. The output buffers are reused between calls.
+ *
+ * Only this per-vertex SSE is provided: one vertex per __m128, with no
+ * 4 or 8 wide structure-of-arrays path and no AVX. Each vertex gathers its
+ * own joints' palette entries, which would have to be transposed into
+ * lanes before any wider blend.
+ */
+class CpuSkinner {
+   public:
+    void skin(const Mesh& mesh, const Configuration& q, SkinningMode mode);
+    // Skinned positions (w = 1) and unit normals (w = 0) of the last skin().
+    const std::vector<glm::vec4>& positions() const { return positions_; }
+    const std::vector<glm::vec4>& normals() const { return normals_; }
+    /*
+     * The scalar blend is always compiled and used when SSE is missing or
+     * turned off here, it is the reference the SSE path is tested against.
+     */
+    void setVectorized(bool x) { vectorized_ = x; }
+    bool isVectorized() const;
+
+   private:
+    std::vector<glm::vec4> positions_;
+    std::vector<glm::vec4> normals_;
+    bool vectorized_ = true;
+};
+
+#endif
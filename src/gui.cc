@@ -208,7 +208,12 @@ void GUI::keyCallback(int key, int scancode, int action, int mods) {
         std::cout << "Saved to out.jpg!" << std::endl;
     }
     if (key == GLFW_KEY_S && (mods & GLFW_MOD_CONTROL)) {
-        if (action == GLFW_RELEASE) mesh_->saveAnimationTo("animation.json");
+        if (action == GLFW_RELEASE) {
+            if (mods & GLFW_MOD_SHIFT)
+                mesh_->saveAnimationTo("animation.anim");
+            else
+                mesh_->saveAnimationTo("animation.json");
+        }
         return;
     }
     if (mods == 0 && captureWASDUPDOWN(key, action)) return;
@@ -223,10 +228,14 @@ void GUI::keyCallback(int key, int scancode, int action, int mods) {
             return;
         }
 
-        Bone *bone = mesh_->skeleton.bones[current_bone_];
-        glm::fquat rotate_ =
-            glm::toQuat(glm::rotate(roll_speed, bone->direction));
-        bone->rotate(rotate_);
+        Skeleton &skeleton = mesh_->skeleton;
+        const Bone &bone = skeleton.bones[current_bone_];
+        if (!bone.valid()) return;
+        glm::vec3 direction =
+            glm::normalize(skeleton.getPosition(bone.index) -
+                           skeleton.getPosition(bone.parent_index));
+        glm::fquat rotate_ = glm::toQuat(glm::rotate(roll_speed, direction));
+        skeleton.rotate(bone.parent_index, rotate_);
         mesh_->updateAnimation();
     } else if (key == GLFW_KEY_C && action != GLFW_RELEASE) {
         fps_mode_ = !fps_mode_;
@@ -240,6 +249,17 @@ void GUI::keyCallback(int key, int scancode, int action, int mods) {
         current_bone_ %= mesh_->getNumberOfBones();
     } else if (key == GLFW_KEY_T && action != GLFW_RELEASE) {
         transparent_ = !transparent_;
+    } else if (key == GLFW_KEY_G && action != GLFW_RELEASE) {
+        use_gs_ = !use_gs_;
+    } else if (key == GLFW_KEY_Z && action != GLFW_RELEASE) {
+        // Frame the current pose.
+        const BoundingBox& box = mesh_->getSkinnedBounds();
+        if (!box.isNone()) {
+            float radius = 0.5f * glm::length(box.max - box.min);
+            center_ = 0.5f * (box.min + box.max);
+            camera_distance_ =
+                -radius / std::tan(0.5f * kFov * float(M_PI / 180.0f));
+        }
     } else if (key == GLFW_KEY_I && action != GLFW_RELEASE) {
         translate_ = !translate_;
     } else if (key == GLFW_KEY_F && action != GLFW_RELEASE) {
@@ -283,6 +303,32 @@ void GUI::keyCallback(int key, int scancode, int action, int mods) {
         }
     } else if (key == GLFW_KEY_M && action != GLFW_RELEASE) {
         mesh_->setSpline(!mesh_->getSpline());
+    } else if (key == GLFW_KEY_L && action != GLFW_RELEASE) {
+        mesh_->setIK(!mesh_->getIK());
+        mesh_->updateAnimation();
+    } else if (key == GLFW_KEY_H && action != GLFW_RELEASE) {
+        physics_ = !physics_;
+    } else if (key == GLFW_KEY_B && action != GLFW_RELEASE) {
+        mesh_->setBaked(!mesh_->getBaked());
+    } else if (key == GLFW_KEY_K && action != GLFW_RELEASE) {
+        mesh_->setCompressed(!mesh_->getCompressed());
+        if (mesh_->getCompressed())
+            std::cout << "compressed clip: " << mesh_->getClip().byteSize()
+                      << " bytes" << std::endl;
+    } else if ((key == GLFW_KEY_COMMA || key == GLFW_KEY_PERIOD) &&
+               action != GLFW_RELEASE) {
+        int n = mesh_->morphs.size();
+        if (n == 0) return;
+        current_morph_ += (key == GLFW_KEY_PERIOD) ? 1 : n - 1;
+        current_morph_ %= n;
+        std::cout << "morph " << current_morph_ << ": "
+                  << mesh_->morphs.getName(current_morph_) << std::endl;
+    } else if ((key == GLFW_KEY_MINUS || key == GLFW_KEY_EQUAL) &&
+               action != GLFW_RELEASE) {
+        if (current_morph_ >= mesh_->morphs.size()) return;
+        float w = mesh_->morphs.getWeight(current_morph_) +
+                  (key == GLFW_KEY_EQUAL ? 0.1f : -0.1f);
+        mesh_->morphs.setWeight(current_morph_, w);
     } else if (key == GLFW_KEY_N && action != GLFW_RELEASE) {
         if (!isPlaying()) {
             play_ = true;
@@ -354,8 +400,9 @@ void GUI::mousePosCallback(double mouse_x, double mouse_y) {
     } else if (drag_bone && current_bone_ != -1) {
         // FIXME: Handle bone rotation
 
+        const Bone &bone = mesh_->skeleton.bones[current_bone_];
         if (!translate_) {
-            Bone *bone = mesh_->skeleton.bones[current_bone_];
+            if (!bone.valid()) return;
             glm::vec3 start = glm::unProject(glm::vec3(mouse_start, 0.0f),
                                              view_matrix_ * model_matrix_,
                                              projection_matrix_, viewport);
@@ -366,11 +413,9 @@ void GUI::mousePosCallback(double mouse_x, double mouse_y) {
 
             glm::mat4 rotate = glm::rotate(rotation_speed_, delta);
             glm::fquat rotate_ = glm::normalize(glm::toQuat(rotate));
-            bone->rotate(rotate_);
+            mesh_->skeleton.rotate(bone.parent_index, rotate_);
             mesh_->updateAnimation();
         } else {
-            Bone *bone = mesh_->skeleton.bones[current_bone_];
-            int root = bone->root;
             glm::vec3 start = glm::unProject(glm::vec3(mouse_start, 0.0f),
                                              view_matrix_ * model_matrix_,
                                              projection_matrix_, viewport);
@@ -378,7 +423,8 @@ void GUI::mousePosCallback(double mouse_x, double mouse_y) {
                                            view_matrix_ * model_matrix_,
                                            projection_matrix_, viewport);
             glm::vec3 delta = end - start;
-            mesh_->skeleton.translate(delta, root);
+            if (!mesh_->moveIKGoal(bone.index, 10.0f * delta))
+                mesh_->skeleton.translate(delta);
             mesh_->updateAnimation();
         }
         return;
@@ -409,15 +455,13 @@ void GUI::mousePosCallback(double mouse_x, double mouse_y) {
     // std::cout << r_world[0] << " " << r_world[1] << " " << r_world[2]
     //          << std::endl;
 
-    std::vector<Bone *> bones = mesh_->skeleton.bones;
-
-    for (auto bone : bones) {
+    for (const Bone &bone : mesh_->skeleton.bones) {
         T = -1;
-        if (bone != nullptr) {
-            glm::mat4 ori = bone_transform_index(bone->index);
+        if (bone.valid()) {
+            glm::mat4 ori = bone_transform_index(bone.index);
             glm::vec3 p = eye_;
             glm::vec3 d = r_world;
-            glm::mat4 scale = glm::mat4(bone->length);
+            glm::mat4 scale = glm::mat4(bone.length);
             /*
             p = glm::vec3(glm::inverse(bone->deformed_transform) *
                           glm::vec4(p, 1));
@@ -432,7 +476,7 @@ void GUI::mousePosCallback(double mouse_x, double mouse_y) {
 
             if (val) {
                 if (T >= 0 && T < prev) {
-                    current_bone_ = bone->index;
+                    current_bone_ = bone.index;
                     prev = T;
                 }
             }
@@ -446,26 +490,26 @@ glm::mat4 GUI::bone_transform() {
 }
 
 glm::mat4 GUI::bone_transform_index(int index) {
-    if (index == 0) {
+    if (index < 0 || !mesh_->skeleton.bones[index].valid()) {
         return glm::mat4(1.0f);
     }
-    Bone *bone = mesh_->skeleton.bones[index];
+    const Bone &bone = mesh_->skeleton.bones[index];
 
     auto alignment = glm::mat4(1.0);
-    alignment[0][0] = bone->direction[0];
-    alignment[0][1] = bone->direction[1];
-    alignment[0][2] = bone->direction[2];
+    alignment[0][0] = bone.direction[0];
+    alignment[0][1] = bone.direction[1];
+    alignment[0][2] = bone.direction[2];
 
     glm::vec3 y;
-    if (bone->direction.x != 0) {
+    if (bone.direction.x != 0) {
         y = glm::normalize(
-            glm::cross(bone->direction, glm::vec3(0.0, 1.0, 0.0)));
+            glm::cross(bone.direction, glm::vec3(0.0, 1.0, 0.0)));
     } else {
         y = glm::normalize(
-            glm::cross(bone->direction, glm::vec3(1.0, 0.0, 0.0)));
+            glm::cross(bone.direction, glm::vec3(1.0, 0.0, 0.0)));
     }
 
-    auto z = glm::normalize(glm::cross(bone->direction, y));
+    auto z = glm::normalize(glm::cross(bone.direction, y));
 
     alignment[1][0] = y[0];
     alignment[1][1] = y[1];
@@ -474,8 +518,8 @@ glm::mat4 GUI::bone_transform_index(int index) {
     alignment[2][1] = z[1];
     alignment[2][2] = z[2];
 
-    return bone->deformed_transform * alignment *
-           glm::scale(glm::vec3(bone->length, 0.25, 0.25));
+    return mesh_->skeleton.getTransform(bone.parent_index) * alignment *
+           glm::scale(glm::vec3(bone.length, 0.25, 0.25));
 }
 
 void GUI::mouseButtonCallback(int button, int action, int mods) {
@@ -542,6 +586,7 @@ bool GUI::setCurrentBone(int i) {
 }
 
 float GUI::getCurrentPlayTime() {
+    if (exportBool) return export_frame_ / kExportFps;
     double new_time = glfwGetTime();
     time_ = new_time;
     return time_;
@@ -48,6 +48,8 @@ class GUI {
     bool setCurrentBone(int i);
 
     bool isTransparent() const { return transparent_; }
+    bool useGeometryShader() const { return use_gs_; }
+    bool usePhysics() const { return physics_; }
     bool isPlaying() const { return play_; }
     bool isCreatingFrame() const { return createFrameBool; }
     bool isDeletingFrame() const { return delFrameBool; }
@@ -55,7 +57,10 @@ class GUI {
     bool isInsertingFrame() const { return insertFrameBool; }
     bool isLoadingFromJson() const { return loadJSONBool; }
     bool isExporting() const { return exportBool; }
+    // Wall clock since playback started, or the time of the frame being
+    // exported.
     float getCurrentPlayTime();
+    void nextExportFrame() { export_frame_++; }
     float getFrameShift() const { return frame_shift_; }
 
     void setCreateFrame(bool x) { createFrameBool = x; }
@@ -64,7 +69,10 @@ class GUI {
     void setUpdateFrame(bool x) { updateFrameBool = x; }
     void setDelFrame(bool x) { delFrameBool = x; }
     void setPlaying(bool x) { play_ = x; }
-    void setExporting(bool x) { exportBool = x; }
+    void setExporting(bool x) {
+        exportBool = x;
+        export_frame_ = 0;
+    }
     void prevFrame() {
         if (current_frame_ > 0) {
             current_frame_--;
@@ -96,7 +104,9 @@ class GUI {
     bool fps_mode_ = false;
     bool pose_changed_ = true;
     bool transparent_ = false;
+    bool use_gs_ = false;  // shade through default.geom instead of direct.vert
     bool translate_ = false;
+    bool physics_ = false;
     bool createFrameBool = false;
     bool delFrameBool = false;
     bool updateFrameBool = false;
@@ -106,6 +116,7 @@ class GUI {
     bool cursorBool = true;
     bool loadJSONBool = false;
     int current_bone_ = -1;
+    int current_morph_ = 0;  // morph the - and = keys change
     int current_button_ = -1;
     int current_frame_ = -1;
     float roll_speed_ = M_PI / 64.0f;
@@ -133,6 +144,7 @@ class GUI {
 
     bool play_ = false;
     double time_ = 0.0;
+    int export_frame_ = 0;
 };
 
 #endif
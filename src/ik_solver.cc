@@ -0,0 +1,305 @@
+#include "ik_solver.h"
+#include <mmdadapter.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <glm/gtx/quaternion.hpp>
+#include "bone_geometry.h"
+#include "config.h"
+
+namespace {
+
+const glm::vec3 kHingeAxis = glm::vec3(1.0f, 0.0f, 0.0f);
+
+float wrapAngle(float a) {
+    const float pi = float(M_PI);
+    while (a > pi) a -= 2.0f * pi;
+    while (a < -pi) a += 2.0f * pi;
+    return a;
+}
+
+// Angle of a rotation around kHingeAxis.
+float hingeAngle(const glm::fquat& q) { return 2.0f * std::atan2(q.x, q.w); }
+
+// Parent rotation of a slot, the identity for roots.
+glm::fquat parentRotation(const Skeleton& skeleton, int s) {
+    int p = skeleton.parent_slot[s];
+    return p < 0 ? glm::fquat(1.0f, 0.0f, 0.0f, 0.0f) : skeleton.world_rot[p];
+}
+
+/*
+ * Turn the local rotation of slot s by a world space rotation, the same
+ * way Skeleton::rotate does.
+ */
+void turn(Skeleton& skeleton, int s, const glm::fquat& rotation) {
+    glm::fquat parent_rot = parentRotation(skeleton, s);
+    skeleton.local_rot[s] =
+        glm::normalize(glm::inverse(parent_rot) * rotation * parent_rot *
+                       skeleton.local_rot[s]);
+}
+
+}  // namespace
+
+IKBudget::IKBudget(double seconds, int max_iterations)
+    : timed(true),
+      deadline(std::chrono::steady_clock::now() +
+               std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                   std::chrono::duration<double>(seconds))),
+      max_iterations(max_iterations) {}
+
+void IKSolver::load(const std::vector<IKChain>& chains,
+                    const Skeleton& skeleton) {
+    chains_.clear();
+    for (const IKChain& ik : chains) {
+        Chain chain;
+        chain.goal = ik.goal;
+        chain.target = ik.target;
+        chain.target_slot = skeleton.slot_of_joint[ik.target];
+        chain.iterations = ik.iterations;
+        chain.angle_limit = ik.angle_limit;
+
+        // Every link has to be an ancestor of the target.
+        std::vector<int> path;
+        int top = skeleton.slot_of_joint[ik.links.back()];
+        for (int s = chain.target_slot; s >= 0 && s != top;
+             s = skeleton.parent_slot[s])
+            path.emplace_back(s);
+        path.emplace_back(top);
+        if (path.size() < 2 ||
+            skeleton.parent_slot[path[path.size() - 2]] != top)
+            continue;
+        chain.path.assign(path.rbegin(), path.rend());
+
+        bool ancestors = true;
+        for (size_t k = 0; k < ik.links.size(); k++) {
+            Link link;
+            link.joint = ik.links[k];
+            link.slot = skeleton.slot_of_joint[link.joint];
+            link.limited = ik.limited[k];
+            link.lo = ik.lo[k];
+            link.hi = ik.hi[k];
+            link.hinge = link.limited && link.lo.y == 0.0f &&
+                         link.hi.y == 0.0f && link.lo.z == 0.0f &&
+                         link.hi.z == 0.0f;
+            ancestors = ancestors &&
+                        std::find(chain.path.begin(), chain.path.end(),
+                                  link.slot) != chain.path.end();
+            chain.links.emplace_back(link);
+        }
+        if (!ancestors) continue;
+        chain.two_bone = chain.links.size() == 2 && chain.path.size() == 3 &&
+                         chain.path[1] == chain.links[0].slot;
+        chains_.emplace_back(chain);
+    }
+}
+
+void IKSolver::setEnabled(bool x) {
+    enabled_ = x;
+    resetWarmStart();
+}
+
+void IKSolver::resetWarmStart() {
+    for (Chain& chain : chains_) chain.warm.clear();
+}
+
+int IKSolver::findGoal(int joint) const {
+    for (size_t i = 0; i < chains_.size(); i++)
+        if (chains_[i].goal == joint) return i;
+    return -1;
+}
+
+void IKSolver::moveGoal(int chain, const glm::vec3& delta) {
+    if (chain >= 0 && chain < size()) chains_[chain].goal_offset += delta;
+}
+
+bool IKSolver::solve(Skeleton& skeleton, const IKBudget& budget) {
+    for (Chain& chain : chains_) {
+        // Out of time: hold the last solution rather than the FK pose.
+        if (budget.expired()) {
+            for (size_t k = 0; k < chain.warm.size(); k++)
+                skeleton.local_rot[chain.links[k].slot] = chain.warm[k];
+            if (!chain.warm.empty()) {
+                evaluatePath(skeleton, chain, 0);
+                skeleton.markDirty(chain.links.back().joint);
+            }
+            continue;
+        }
+        solveChain(skeleton, chain, budget);
+    }
+    return !budget.expired();
+}
+
+void IKSolver::solveChain(Skeleton& skeleton, Chain& chain,
+                          const IKBudget& budget) const {
+    std::vector<glm::fquat>& before = chain.before;
+    before.resize(chain.links.size());
+    for (size_t k = 0; k < chain.links.size(); k++)
+        before[k] = skeleton.local_rot[chain.links[k].slot];
+    if (chain.warm.size() == chain.links.size()) {
+        for (size_t k = 0; k < chain.links.size(); k++)
+            skeleton.local_rot[chain.links[k].slot] = chain.warm[k];
+    }
+    evaluatePath(skeleton, chain, 0);
+
+    glm::vec3 goal =
+        skeleton.getPosition(chain.goal) + chain.goal_offset;
+    auto error = [&]() {
+        return glm::length(skeleton.world_pos[chain.target_slot] - goal);
+    };
+
+    if (error() > kIKTolerance) {
+        if (chain.two_bone && closed_form_) {
+            solveTwoBone(skeleton, chain, goal);
+        } else {
+            int iterations = chain.iterations;
+            if (budget.max_iterations > 0)
+                iterations = std::min(iterations, budget.max_iterations);
+            for (int i = 0; i < iterations && error() > kIKTolerance; i++) {
+                if (budget.expired()) break;
+                for (size_t k = 0; k < chain.links.size(); k++)
+                    stepCCD(skeleton, chain, k, goal);
+            }
+        }
+    }
+
+    chain.warm.resize(chain.links.size());
+    bool changed = false;
+    for (size_t k = 0; k < chain.links.size(); k++) {
+        chain.warm[k] = skeleton.local_rot[chain.links[k].slot];
+        changed = changed || chain.warm[k] != before[k];
+    }
+    // The target's subtree (toes, fingers) still has to follow.
+    if (changed) skeleton.markDirty(chain.links.back().joint);
+}
+
+/*
+ * Closed form for a link (knee, elbow) under a root link (hip, shoulder):
+ * bend the inner link until the root-to-target distance matches the
+ * distance to the goal, then swing the root link onto the goal.
+ */
+void IKSolver::solveTwoBone(Skeleton& skeleton, const Chain& chain,
+                            const glm::vec3& goal) const {
+    const Link& inner = chain.links[0];
+    const Link& root = chain.links[1];
+    int s1 = inner.slot;
+    int s2 = root.slot;
+
+    glm::vec3 u = skeleton.local_trans[s1];
+    glm::vec3 v = skeleton.local_trans[chain.target_slot];
+    float lu = glm::length(u);
+    float lv = glm::length(v);
+    float d = glm::length(goal - skeleton.world_pos[s2]);
+    d = glm::clamp(d, std::abs(lu - lv) + kIKTolerance,
+                   lu + lv - kIKTolerance);
+
+    // A hinge turns from the rest pose, a free link from where it is.
+    glm::fquat base = inner.hinge ? glm::fquat(1.0f, 0.0f, 0.0f, 0.0f)
+                                  : skeleton.local_rot[s1];
+    glm::vec3 w = base * v;
+    glm::vec3 axis = kHingeAxis;
+    if (!inner.hinge) {
+        glm::vec3 n = glm::cross(u, w);
+        if (glm::length(n) > 1e-6f) axis = glm::normalize(n);
+    }
+
+    // |u + R(phi) w|^2 = d^2 reduces to A cos(phi) + B sin(phi) = k.
+    glm::vec3 w_par = glm::dot(axis, w) * axis;
+    glm::vec3 w_perp = w - w_par;
+    float a = glm::dot(u, w_perp);
+    float b = glm::dot(u, glm::cross(axis, w_perp));
+    float r = std::sqrt(a * a + b * b);
+    if (r > 1e-6f) {
+        float k = 0.5f * (d * d - lu * lu - lv * lv) - glm::dot(u, w_par);
+        float beta = std::atan2(b, a);
+        float gamma = std::acos(glm::clamp(k / r, -1.0f, 1.0f));
+        float phi[2] = {wrapAngle(beta + gamma), wrapAngle(beta - gamma)};
+
+        float best = phi[0];
+        if (inner.hinge) {
+            // Prefer the solution inside the limits, then the nearer one.
+            float current = hingeAngle(skeleton.local_rot[s1]);
+            float best_cost = std::numeric_limits<float>::max();
+            for (float p : phi) {
+                float clamped = glm::clamp(p, inner.lo.x, inner.hi.x);
+                float cost = 10.0f * std::abs(clamped - p) +
+                             std::abs(wrapAngle(clamped - current));
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best = clamped;
+                }
+            }
+        } else if (std::abs(phi[1]) < std::abs(phi[0])) {
+            best = phi[1];
+        }
+        skeleton.local_rot[s1] =
+            glm::normalize(glm::angleAxis(best, axis) * base);
+    }
+    evaluatePath(skeleton, chain, 1);
+
+    glm::vec3 hip = skeleton.world_pos[s2];
+    glm::vec3 to_target = skeleton.world_pos[chain.target_slot] - hip;
+    glm::vec3 to_goal = goal - hip;
+    if (glm::length(to_target) > 1e-6f && glm::length(to_goal) > 1e-6f) {
+        turn(skeleton, s2,
+             glm::rotation(glm::normalize(to_target),
+                           glm::normalize(to_goal)));
+        evaluatePath(skeleton, chain, 0);
+    }
+}
+
+/*
+ * One CCD step of link k: turn it so its target direction points at the
+ * goal, by at most angle_limit * (k + 1) as the MMD poser does.
+ */
+void IKSolver::stepCCD(Skeleton& skeleton, const Chain& chain, int k,
+                       const glm::vec3& goal) const {
+    const Link& link = chain.links[k];
+    int s = link.slot;
+    glm::vec3 joint = skeleton.world_pos[s];
+    glm::vec3 to_target = skeleton.world_pos[chain.target_slot] - joint;
+    glm::vec3 to_goal = goal - joint;
+    if (glm::length(to_target) < 1e-6f || glm::length(to_goal) < 1e-6f)
+        return;
+    float max_angle = chain.angle_limit * (k + 1);
+
+    if (link.hinge) {
+        // Both directions projected on the plane the hinge turns in.
+        glm::fquat to_parent = glm::inverse(parentRotation(skeleton, s));
+        glm::vec3 e = to_parent * to_target;
+        glm::vec3 g = to_parent * to_goal;
+        e -= glm::dot(e, kHingeAxis) * kHingeAxis;
+        g -= glm::dot(g, kHingeAxis) * kHingeAxis;
+        float delta = std::atan2(glm::dot(kHingeAxis, glm::cross(e, g)),
+                                 glm::dot(e, g));
+        delta = glm::clamp(delta, -max_angle, max_angle);
+        float angle = glm::clamp(
+            hingeAngle(skeleton.local_rot[s]) + delta, link.lo.x, link.hi.x);
+        skeleton.local_rot[s] = glm::angleAxis(angle, kHingeAxis);
+    } else {
+        to_target = glm::normalize(to_target);
+        to_goal = glm::normalize(to_goal);
+        float angle =
+            std::acos(glm::clamp(glm::dot(to_target, to_goal), -1.0f, 1.0f));
+        glm::vec3 axis = glm::cross(to_target, to_goal);
+        if (angle < 1e-6f || glm::length(axis) < 1e-6f) return;
+        turn(skeleton, s,
+             glm::angleAxis(std::min(angle, max_angle),
+                            glm::normalize(axis)));
+        if (link.limited) {
+            glm::vec3 euler = glm::eulerAngles(skeleton.local_rot[s]);
+            skeleton.local_rot[s] =
+                glm::fquat(glm::clamp(euler, link.lo, link.hi));
+        }
+    }
+
+    int index = std::find(chain.path.begin(), chain.path.end(), s) -
+                chain.path.begin();
+    evaluatePath(skeleton, chain, index);
+}
+
+// Forward kinematics of path[from, end), which ends at the target.
+void IKSolver::evaluatePath(Skeleton& skeleton, const Chain& chain,
+                            int from) const {
+    for (size_t i = from; i < chain.path.size(); i++)
+        skeleton.evaluateSlot(chain.path[i]);
+}
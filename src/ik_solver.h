@@ -0,0 +1,100 @@
+#ifndef IK_SOLVER_H
+#define IK_SOLVER_H
+
+#include <chrono>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+
+struct IKChain;
+struct Skeleton;
+
+/*
+ * IKBudget: time and iteration budget shared by every IK solve of one
+ * frame. Pass the same budget to every model of the scene, chains that
+ * come after the deadline keep their previous solution.
+ */
+struct IKBudget {
+    IKBudget() : timed(false) {}
+    explicit IKBudget(double seconds, int max_iterations = 0);
+
+    bool timed;
+    std::chrono::steady_clock::time_point deadline;
+    int max_iterations = 0;  // cap per chain, 0 keeps the model's limit
+
+    bool expired() const {
+        return timed && std::chrono::steady_clock::now() >= deadline;
+    }
+};
+
+/*
+ * IKSolver: solves the IK chains of a model on top of the forward
+ * kinematics pose of its Skeleton.
+ *
+ * Two link chains (legs and arms) are solved in closed form, the others by
+ * CCD. Every chain starts from its solution of the previous frame, so an
+ * unchanged goal costs no iteration at all.
+ */
+class IKSolver {
+   public:
+    void load(const std::vector<IKChain>& chains, const Skeleton& skeleton);
+
+    int size() const { return chains_.size(); }
+    bool isEnabled() const { return enabled_; }
+    void setEnabled(bool x);
+    // Forget the last solutions, the next solve starts from the FK pose.
+    void resetWarmStart();
+    // Chain whose goal is the given joint, -1 if there is none.
+    int findGoal(int joint) const;
+    // Move the goal of a chain away from its goal joint.
+    void moveGoal(int chain, const glm::vec3& delta);
+    int getGoal(int chain) const { return chains_[chain].goal; }
+    int getTarget(int chain) const { return chains_[chain].target; }
+    bool isTwoBone(int chain) const { return chains_[chain].two_bone; }
+    // Solve two link chains by CCD as well, to check the closed form.
+    void setClosedForm(bool x) { closed_form_ = x; }
+
+    /*
+     * solve: move every chain's target to its goal. The skeleton must be
+     * evaluated, the touched joints are marked dirty. Returns false if the
+     * budget ran out before the last chain.
+     */
+    bool solve(Skeleton& skeleton, const IKBudget& budget);
+
+   private:
+    struct Link {
+        int joint;
+        int slot;
+        bool limited;
+        bool hinge;  // limited to a turn around the parent's x axis
+        glm::vec3 lo, hi;
+    };
+    struct Chain {
+        int goal;
+        int target;
+        int target_slot;
+        std::vector<Link> links;
+        std::vector<int> path;  // slots from the last link to the target
+        int iterations;
+        float angle_limit;
+        bool two_bone;
+        glm::vec3 goal_offset = glm::vec3(0.0f);
+        std::vector<glm::fquat> warm;  // link rotations of the last solve
+        std::vector<glm::fquat> before;  // scratch of solveChain
+    };
+
+    void solveChain(Skeleton& skeleton, Chain& chain,
+                    const IKBudget& budget) const;
+    void solveTwoBone(Skeleton& skeleton, const Chain& chain,
+                      const glm::vec3& goal) const;
+    void stepCCD(Skeleton& skeleton, const Chain& chain, int k,
+                 const glm::vec3& goal) const;
+    void evaluatePath(Skeleton& skeleton, const Chain& chain,
+                      int from) const;
+
+    std::vector<Chain> chains_;
+    bool enabled_ = false;
+    bool closed_form_ = true;
+};
+
+#endif
@@ -3,13 +3,19 @@
 #include "bone_geometry.h"
 #include "config.h"
 #include "gui.h"
+#include "palette_buffer.h"
+#include "physics_reactor.h"
 #include "procedure_geometry.h"
 #include "render_pass.h"
+#include "skinning_feedback.h"
 #include "texture_to_render.h"
 
 #include <algorithm>
+#include <chrono>
+#include <cstddef>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -41,6 +47,10 @@ const char* blending_shader =
 #include "shaders/blending.vert"
     ;
 
+const char* direct_vertex_shader =
+#include "shaders/direct.vert"
+    ;
+
 const char* geometry_shader =
 #include "shaders/default.geom"
     ;
@@ -112,7 +122,8 @@ GLFWwindow* init_glefw() {
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         std::cerr << "Input model file is missing" << std::endl;
-        std::cerr << "Usage: " << argv[0] << " <PMD file>" << std::endl;
+        std::cerr << "Usage: " << argv[0] << " <PMD file> [animation file]"
+                  << std::endl;
         return -1;
     }
     GLFWwindow* window = init_glefw();
@@ -226,14 +237,20 @@ int main(int argc, char* argv[]) {
     };
     auto object_alpha = make_uniform("alpha", alpha_data);
 
-    std::function<std::vector<glm::vec3>()> trans_data = [&mesh]() {
-        return mesh.getCurrentQ()->transData();
+    // All skinned models share one palette buffer.
+    PaletteBuffer palette;
+    int palette_base = palette.allocate(mesh.getNumberOfBones());
+    std::function<unsigned()> palette_data = [&palette, &mesh,
+                                              palette_base]() {
+        palette.update(palette_base, *mesh.getCurrentQ());
+        palette.upload();
+        return palette.getTexture();
     };
-    std::function<std::vector<glm::fquat>()> rot_data = [&mesh]() {
-        return mesh.getCurrentQ()->rotData();
+    std::function<int()> palette_base_data = [palette_base]() {
+        return palette_base;
     };
-    auto joint_trans = make_uniform("joint_trans", trans_data);
-    auto joint_rot = make_uniform("joint_rot", rot_data);
+    auto joint_palette = make_buffer_texture("joint_palette", 1, palette_data);
+    auto std_palette_base = make_uniform("palette_base", palette_base_data);
     // FIXME: define more ShaderUniforms for RenderPass if you want to use it.
     //        Otherwise, do whatever you like here
 
@@ -243,41 +260,67 @@ int main(int argc, char* argv[]) {
                             floor_vertices.size(), 4, GL_FLOAT);
     floor_pass_input.assignIndex(floor_faces.data(), floor_faces.size(), 3);
     RenderPass floor_pass(
+        -1, floor_pass_input,
+        {direct_vertex_shader, nullptr, floor_fragment_shader},
+        {floor_model, std_view, std_proj, std_light}, {"fragment_color"});
+    RenderPass floor_gs_pass(
         -1, floor_pass_input,
         {vertex_shader, geometry_shader, floor_fragment_shader},
         {floor_model, std_view, std_proj, std_light}, {"fragment_color"});
+    auto draw_floor_pass = [&]() {
+        RenderPass& pass =
+            gui.useGeometryShader() ? floor_gs_pass : floor_pass;
+        pass.setup();
+        CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, floor_faces.size() * 3,
+                                      GL_UNSIGNED_INT, 0));
+    };
 
     // PMD Model render pass
     // FIXME: initialize the input data at Mesh::loadPmd
-    std::vector<glm::vec2>& uv_coordinates = mesh.uv_coordinates;
+    SkinningFeedback skinning(mesh, blending_shader);
     RenderDataInput object_pass_input;
-    object_pass_input.assign(0, "jid0", mesh.joint0.data(), mesh.joint0.size(),
-                             1, GL_INT);
-    object_pass_input.assign(1, "jid1", mesh.joint1.data(), mesh.joint1.size(),
-                             1, GL_INT);
-    object_pass_input.assign(2, "w0", mesh.weight_for_joint0.data(),
-                             mesh.weight_for_joint0.size(), 1, GL_FLOAT);
-    object_pass_input.assign(3, "vector_from_joint0",
-                             mesh.vector_from_joint0.data(),
-                             mesh.vector_from_joint0.size(), 3, GL_FLOAT);
-    object_pass_input.assign(4, "vector_from_joint1",
-                             mesh.vector_from_joint1.data(),
-                             mesh.vector_from_joint1.size(), 3, GL_FLOAT);
-    object_pass_input.assign(5, "normal", mesh.vertex_normals.data(),
-                             mesh.vertex_normals.size(), 4, GL_FLOAT);
-    object_pass_input.assign(6, "uv", uv_coordinates.data(),
-                             uv_coordinates.size(), 2, GL_FLOAT);
-    // TIPS: You won't need vertex position in your solution.
-    //       This only serves the stub shader.
-    object_pass_input.assign(7, "vert", mesh.vertices.data(),
-                             mesh.vertices.size(), 4, GL_FLOAT);
+    object_pass_input.assignExternal(skinning.getOutputBuffer(),
+                                     skinning.getNVertices(),
+                                     SkinningFeedback::kOutputStride);
+    object_pass_input.assignAttribute(0, "vertex_position", 0, 4, GL_FLOAT);
+    object_pass_input.assignAttribute(1, "normal", 4 * sizeof(float), 4,
+                                      GL_FLOAT);
+    object_pass_input.assignExternal(skinning.getInputBuffer(),
+                                     skinning.getNVertices(),
+                                     sizeof(SkinnedVertex));
+    object_pass_input.assignAttribute(2, "uv", offsetof(SkinnedVertex, uv), 2,
+                                      GL_HALF_FLOAT);
     object_pass_input.assignIndex(mesh.faces.data(), mesh.faces.size(), 3);
     object_pass_input.useMaterials(mesh.materials);
     RenderPass object_pass(-1, object_pass_input,
-                           {blending_shader, geometry_shader, fragment_shader},
+                           {direct_vertex_shader, nullptr, fragment_shader},
                            {std_model, std_view, std_proj, std_light,
-                            std_camera, object_alpha, joint_trans, joint_rot},
+                            std_camera, object_alpha},
                            {"fragment_color"});
+    // The geometry shader path duplicates the material textures, so it is
+    // only built once it gets selected.
+    std::unique_ptr<RenderPass> object_gs_pass;
+    // Skin once per pose, every pass and view of the model reuses it.
+    auto draw_object_pass = [&]() {
+        size_t morph_first, morph_last;
+        if (mesh.applyMorphs(morph_first, morph_last))
+            skinning.uploadVertices(mesh, morph_first, morph_last);
+        skinning.update(palette_data(), palette_base,
+                        mesh.getCurrentQ()->version);
+        if (gui.useGeometryShader() && !object_gs_pass) {
+            object_gs_pass.reset(new RenderPass(
+                -1, object_pass_input,
+                {vertex_shader, geometry_shader, fragment_shader},
+                {std_model, std_view, std_proj, std_light, std_camera,
+                 object_alpha},
+                {"fragment_color"}));
+        }
+        RenderPass& pass =
+            gui.useGeometryShader() ? *object_gs_pass : object_pass;
+        pass.setup();
+        int mid = 0;
+        while (pass.renderWithMaterial(mid)) mid++;
+    };
 
     // stuff for preview
     // RenderPass object for preview
@@ -309,7 +352,8 @@ int main(int argc, char* argv[]) {
     bone_pass_input.assignIndex(bone_indices.data(), bone_indices.size(), 2);
     RenderPass bone_pass(-1, bone_pass_input,
                          {bone_vertex_shader, nullptr, bone_fragment_shader},
-                         {std_model, std_view, std_proj, joint_trans},
+                         {std_model, std_view, std_proj, joint_palette,
+                          std_palette_base},
                          {"fragment_color"});
 
     RenderDataInput cylinder_pass_input;
@@ -340,6 +384,17 @@ int main(int argc, char* argv[]) {
         gui.setLoadJSON(true);
     }
 
+    // Secondary motion of every model. During playback and export it
+    // follows the animation timeline, every fixed step of it and nothing
+    // dropped, so an export always gets the same motion. Otherwise it runs
+    // on the wall clock.
+    PhysicsReactor physics;
+    physics.addSkeleton(mesh.skeleton, mesh.rigid_bodies,
+                        mesh.spring_constraints);
+    physics.setFloor(true, kFloorY);
+    bool physics_on = false;
+    auto last_frame = std::chrono::steady_clock::now();
+
     while (!glfwWindowShouldClose(window)) {
         // Setup some basic window stuff.
         glfwGetFramebufferSize(window, &window_width, &window_height);
@@ -358,31 +413,46 @@ int main(int argc, char* argv[]) {
         gui.updateMatrices();
         mats = gui.getMatrixPointers();
 
+        // Every model's IK of this frame shares one time budget.
+        IKBudget ik_budget(kIKFrameBudget);
+        float cur_time = -1.0f;
         if (gui.isPlaying()) {
             std::stringstream title;
-            float cur_time = gui.getCurrentPlayTime();
+            cur_time = gui.getCurrentPlayTime();
             title << window_title << " Playing: " << std::setprecision(2)
                   << std::setfill('0') << std::setw(6) << cur_time << " s";
             glfwSetWindowTitle(window, title.str().data());
-            mesh.updateAnimation(cur_time);
+            mesh.updateAnimation(cur_time, ik_budget);
         } else if (gui.isPoseDirty()) {
-            mesh.updateAnimation();
+            mesh.updateAnimation(-1.0, ik_budget);
             gui.clearPose();
         }
 
+        auto now = std::chrono::steady_clock::now();
+        float elapsed = std::chrono::duration<float>(now - last_frame).count();
+        last_frame = now;
+        if (gui.usePhysics() != physics_on) {
+            physics_on = gui.usePhysics();
+            physics.reset();
+            mesh.refreshPose();
+        }
+        if (physics_on) {
+            if (gui.isPlaying())
+                physics.follow(cur_time);
+            else
+                physics.react(elapsed);
+            if (mesh.skeleton.isDirty()) mesh.refreshPose();
+        }
+
         if (gui.isCreatingFrame()) {
             TextureToRender* texture = new TextureToRender();
             texture->create(preview_width * 2, preview_height * 2);
             texture->bind();
             if (draw_floor) {
-                floor_pass.setup();
-                CHECK_GL_ERROR(glDrawElements(
-                    GL_TRIANGLES, floor_faces.size() * 3, GL_UNSIGNED_INT, 0));
+                draw_floor_pass();
             }
             if (draw_object) {
-                object_pass.setup();
-                int mid = 0;
-                while (object_pass.renderWithMaterial(mid)) mid++;
+                draw_object_pass();
             }
 
             mesh.previews.emplace_back(texture);
@@ -404,17 +474,12 @@ int main(int argc, char* argv[]) {
             texture->bind();
 
             if (draw_floor) {
-                floor_pass.setup();
-                // Draw our triangles.
-                CHECK_GL_ERROR(glDrawElements(
-                    GL_TRIANGLES, floor_faces.size() * 3, GL_UNSIGNED_INT, 0));
+                draw_floor_pass();
             }
 
             // Draw the model
             if (draw_object) {
-                object_pass.setup();
-                int mid = 0;
-                while (object_pass.renderWithMaterial(mid)) mid++;
+                draw_object_pass();
             }
             TextureToRender* texture_prev =
                 mesh.previews[gui.getCurrentFrame()];
@@ -433,25 +498,21 @@ int main(int argc, char* argv[]) {
                 texture->bind();
 
                 if (draw_floor) {
-                    floor_pass.setup();
-                    // Draw our triangles.
-                    CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES,
-                                                  floor_faces.size() * 3,
-                                                  GL_UNSIGNED_INT, 0));
+                    draw_floor_pass();
                 }
 
                 // Draw the model
                 if (draw_object) {
-                    object_pass.setup();
-                    int mid = 0;
-                    while (object_pass.renderWithMaterial(mid)) mid++;
+                    draw_object_pass();
                 }
 
                 mesh.previews.emplace_back(texture);
                 texture->unbind();
             }
-            mesh.updateSkeleton(mesh.key_frames[0]);
-            mesh.updateAnimation();
+            if (!mesh.key_frames.empty()) {
+                mesh.updateSkeleton(mesh.key_frames[0]);
+                mesh.updateAnimation();
+            }
             gui.setLoadJSON(false);
         }
 
@@ -461,17 +522,12 @@ int main(int argc, char* argv[]) {
             texture->bind();
 
             if (draw_floor) {
-                floor_pass.setup();
-                // Draw our triangles.
-                CHECK_GL_ERROR(glDrawElements(
-                    GL_TRIANGLES, floor_faces.size() * 3, GL_UNSIGNED_INT, 0));
+                draw_floor_pass();
             }
 
             // Draw the model
             if (draw_object) {
-                object_pass.setup();
-                int mid = 0;
-                while (object_pass.renderWithMaterial(mid)) mid++;
+                draw_object_pass();
             }
 
             std::vector<TextureToRender*>::iterator iterator =
@@ -499,16 +555,12 @@ int main(int argc, char* argv[]) {
         }
 
         if (draw_floor) {
-            floor_pass.setup();
-            CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES, floor_faces.size() * 3,
-                                          GL_UNSIGNED_INT, 0));
+            draw_floor_pass();
         }
 
         // Draw the model
         if (draw_object) {
-            object_pass.setup();
-            int mid = 0;
-            while (object_pass.renderWithMaterial(mid)) mid++;
+            draw_object_pass();
         }
 
         for (int i = 0; i < (int)mesh.previews.size(); i++) {
@@ -539,6 +591,8 @@ int main(int argc, char* argv[]) {
             if (!file_exists) {
                 file_open = popen(gui.cmd, "w");
                 file_exists = true;
+                // Export frames as fast as they render.
+                glfwSwapInterval(0);
             }
 
             glReadPixels(0, 0, main_view_width * 2, main_view_height * 2,
@@ -548,10 +602,12 @@ int main(int argc, char* argv[]) {
                    main_view_height * main_view_width * 4 * sizeof(int), 1,
                    file_open);
 
-            if (gui.getCurrentPlayTime() > mesh.key_frames.size() - 1.0) {
+            gui.nextExportFrame();
+            if (gui.getCurrentPlayTime() > mesh.getDuration()) {
                 pclose(file_open);
                 gui.setExporting(false);
                 file_exists = false;
+                glfwSwapInterval(1);
             }
         }
     }
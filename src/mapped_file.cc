@@ -0,0 +1,64 @@
+#include "mapped_file.h"
+#ifdef _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::~MappedFile() { close(); }
+
+#ifdef _WIN32
+
+// No mmap here, read the whole file into memory instead.
+bool MappedFile::open(const std::string& fn) {
+    close();
+    std::ifstream in(fn, std::ios::binary | std::ios::ate);
+    if (!in) return false;
+    std::streamoff size = in.tellg();
+    if (size <= 0) return false;
+    char* buffer = new char[size];
+    in.seekg(0);
+    if (!in.read(buffer, size)) {
+        delete[] buffer;
+        return false;
+    }
+    data_ = buffer;
+    size_ = size;
+    return true;
+}
+
+void MappedFile::close() {
+    delete[] data_;
+    data_ = nullptr;
+    size_ = 0;
+}
+
+#else
+
+bool MappedFile::open(const std::string& fn) {
+    close();
+    int fd = ::open(fn.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);  // the mapping keeps the file alive
+    if (p == MAP_FAILED) return false;
+    data_ = static_cast<const char*>(p);
+    size_ = st.st_size;
+    return true;
+}
+
+void MappedFile::close() {
+    if (data_) munmap(const_cast<char*>(data_), size_);
+    data_ = nullptr;
+    size_ = 0;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stddef.h>
+#include <string>
+
+/*
+ * MappedFile: read-only memory mapping of a whole file. The mapping is
+ * released when the object is destroyed.
+ */
+class MappedFile {
+   public:
+    MappedFile() {}
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Return: false if the file can't be opened or mapped.
+    bool open(const std::string& fn);
+    void close();
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+   private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+#endif
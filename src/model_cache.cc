@@ -0,0 +1,357 @@
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include "bone_geometry.h"
+#include "config.h"
+#include "mapped_file.h"
+
+namespace {
+
+/*
+ * Model cache (<model>.cache, see Mesh::setModelCacheDir) layout, all
+ * little endian:
+ *   ModelCacheHeader
+ *   the sections in the order saveModelCache writes them, every array as
+ *   a uint64 count followed by its elements
+ * The header keys the cache to the size and FNV-1a hash of the model
+ * file, a cache of another version of the file, or written by another
+ * version of this program, is rebuilt.
+ */
+const char kModelCacheMagic[4] = {'M', 'D', 'L', 'C'};
+const uint32_t kModelCacheVersion = 2;
+const char kModelCacheSuffix[] = ".cache";
+
+struct ModelCacheHeader {
+    char magic[4];
+    uint32_t version;
+    uint64_t source_size;
+    uint64_t source_hash;
+};
+
+bool hashFile(const std::string& fn, uint64_t& size, uint64_t& hash) {
+    MappedFile file;
+    if (!file.open(fn)) return false;
+    const unsigned char* p =
+        reinterpret_cast<const unsigned char*>(file.data());
+    hash = 14695981039346656037ull;
+    for (size_t i = 0; i < file.size(); i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    size = file.size();
+    return true;
+}
+
+// Plain old data only: glm vectors, ints and the POD structs of the model.
+class CacheWriter {
+   public:
+    explicit CacheWriter(std::ostream& out) : out_(out) {}
+
+    template <typename T>
+    void write(const T& x) {
+        out_.write(reinterpret_cast<const char*>(&x), sizeof(T));
+    }
+    template <typename T>
+    void writeArray(const std::vector<T>& v) {
+        write(uint64_t(v.size()));
+        out_.write(reinterpret_cast<const char*>(v.data()),
+                   v.size() * sizeof(T));
+    }
+    void writeString(const std::string& s) {
+        write(uint64_t(s.size()));
+        out_.write(s.data(), s.size());
+    }
+
+   private:
+    std::ostream& out_;
+};
+
+// Reads what CacheWriter wrote, every read fails past the end of the file.
+class CacheReader {
+   public:
+    CacheReader(const char* data, size_t size)
+        : data_(data), size_(size), cursor_(0) {}
+
+    template <typename T>
+    bool read(T& x) {
+        if (size_ - cursor_ < sizeof(T)) return false;
+        std::memcpy(&x, data_ + cursor_, sizeof(T));
+        cursor_ += sizeof(T);
+        return true;
+    }
+    template <typename T>
+    bool readArray(std::vector<T>& v) {
+        uint64_t n;
+        if (!read(n) || n > (size_ - cursor_) / sizeof(T)) return false;
+        v.resize(n);
+        std::memcpy(v.data(), data_ + cursor_, n * sizeof(T));
+        cursor_ += n * sizeof(T);
+        return true;
+    }
+    bool readString(std::string& s) {
+        uint64_t n;
+        if (!read(n) || n > size_ - cursor_) return false;
+        s.assign(data_ + cursor_, n);
+        cursor_ += n;
+        return true;
+    }
+
+   private:
+    const char* data_;
+    size_t size_;
+    size_t cursor_;
+};
+
+// Whether id indexes an array of n, or is the -1 for none where allowed.
+bool inRange(int32_t id, size_t n, bool none_allowed = false) {
+    return (none_allowed && id == -1) || (id >= 0 && size_t(id) < n);
+}
+
+// Whether an enum read from the cache is one of its values, up to last.
+template <typename E>
+bool inRange(E value, E last) {
+    int32_t raw;
+    static_assert(sizeof(E) == sizeof(raw), "enums are cached as int32");
+    std::memcpy(&raw, &value, sizeof(raw));
+    return raw >= 0 && raw <= int32_t(last);
+}
+
+}  // namespace
+
+std::string Mesh::modelCachePath(const std::string& fn) const {
+    if (!model_cache_) return std::string();
+    if (cache_dir_.empty()) return fn + kModelCacheSuffix;
+    size_t slash = fn.find_last_of('/');
+    std::string name = slash == std::string::npos ? fn : fn.substr(slash + 1);
+    return cache_dir_ + "/" + name + kModelCacheSuffix;
+}
+
+void Mesh::saveModelCache(const std::string& fn,
+                          const std::vector<IKChain>& chains,
+                          const std::vector<VertexMorph>& vms) {
+    std::string cache_fn = modelCachePath(fn);
+    if (cache_fn.empty()) return;
+    ModelCacheHeader header;
+    std::memcpy(header.magic, kModelCacheMagic, sizeof(header.magic));
+    header.version = kModelCacheVersion;
+    if (!hashFile(fn, header.source_size, header.source_hash)) return;
+
+    // Written aside and renamed, so no reader ever maps half a cache. A
+    // model in a read-only directory just goes without.
+    std::string temp_fn = cache_fn + ".tmp";
+    std::ofstream o(temp_fn, std::ios::binary);
+    if (!o) return;
+    CacheWriter w(o);
+    w.write(header);
+
+    w.writeArray(vertices);
+    w.writeArray(vertex_normals);
+    w.writeArray(uv_coordinates);
+    w.writeArray(faces);
+    w.writeArray(joint_ids);
+    w.writeArray(joint_weights);
+    w.writeArray(sdef_params);
+
+    // Decoded textures, once each however many materials share them.
+    std::map<const Image*, int32_t> texture_ids;
+    std::vector<const Image*> textures;
+    for (const Material& m : materials) {
+        if (!m.texture || texture_ids.count(m.texture.get())) continue;
+        texture_ids[m.texture.get()] = textures.size();
+        textures.emplace_back(m.texture.get());
+    }
+    w.write(uint64_t(textures.size()));
+    for (const Image* image : textures) {
+        w.write(int32_t(image->width));
+        w.write(int32_t(image->height));
+        w.write(int32_t(image->stride));
+        w.writeArray(image->bytes);
+    }
+    w.write(uint64_t(materials.size()));
+    for (const Material& m : materials) {
+        w.write(m.diffuse);
+        w.write(m.ambient);
+        w.write(m.specular);
+        w.write(m.shininess);
+        w.write(uint64_t(m.offset));
+        w.write(uint64_t(m.nfaces));
+        w.write(m.texture ? texture_ids[m.texture.get()] : int32_t(-1));
+    }
+
+    w.write(uint64_t(skeleton.joints.size()));
+    for (const Joint& joint : skeleton.joints) {
+        w.write(joint.init_position);
+        w.write(int32_t(joint.parent_index));
+        // Code units widened to 32 bits, wchar_t differs across platforms.
+        w.writeArray(std::vector<uint32_t>(joint.name.begin(),
+                                           joint.name.end()));
+    }
+
+    w.write(uint64_t(chains.size()));
+    for (const IKChain& chain : chains) {
+        w.write(int32_t(chain.goal));
+        w.write(int32_t(chain.target));
+        w.write(int32_t(chain.iterations));
+        w.write(chain.angle_limit);
+        w.writeArray(chain.links);
+        w.writeArray(std::vector<uint8_t>(chain.limited.begin(),
+                                          chain.limited.end()));
+        w.writeArray(chain.lo);
+        w.writeArray(chain.hi);
+    }
+
+    w.write(uint64_t(vms.size()));
+    for (const VertexMorph& vm : vms) {
+        w.writeString(vm.name);
+        w.write(int32_t(vm.category));
+        w.writeArray(vm.vid);
+        w.writeArray(vm.offset);
+    }
+
+    w.writeArray(rigid_bodies);
+    w.writeArray(spring_constraints);
+
+    o.close();
+    if (!o || std::rename(temp_fn.c_str(), cache_fn.c_str()) != 0)
+        std::remove(temp_fn.c_str());
+}
+
+bool Mesh::loadModelCache(const std::string& fn, std::vector<IKChain>& chains,
+                          std::vector<VertexMorph>& vms) {
+    std::string cache_fn = modelCachePath(fn);
+    MappedFile file;
+    if (cache_fn.empty() || !file.open(cache_fn)) return false;
+    CacheReader r(file.data(), file.size());
+    ModelCacheHeader header;
+    if (!r.read(header) ||
+        std::memcmp(header.magic, kModelCacheMagic, sizeof(header.magic)) !=
+            0 ||
+        header.version != kModelCacheVersion)
+        return false;
+    uint64_t source_size, source_hash;
+    if (!hashFile(fn, source_size, source_hash) ||
+        source_size != header.source_size ||
+        source_hash != header.source_hash)
+        return false;
+
+    bool ok = r.readArray(vertices) && r.readArray(vertex_normals) &&
+              r.readArray(uv_coordinates) && r.readArray(faces) &&
+              r.readArray(joint_ids) && r.readArray(joint_weights) &&
+              r.readArray(sdef_params);
+
+    uint64_t n = 0;
+    std::vector<std::shared_ptr<Image>> textures;
+    ok = ok && r.read(n);
+    for (uint64_t i = 0; ok && i < n; i++) {
+        auto image = std::make_shared<Image>();
+        int32_t width = 0, height = 0, stride = 0;
+        ok = r.read(width) && r.read(height) && r.read(stride) &&
+             r.readArray(image->bytes) && width > 0 && height > 0 &&
+             int64_t(stride) >= 3 * int64_t(width) &&
+             uint64_t(stride) * uint64_t(height) <= image->bytes.size();
+        image->width = width;
+        image->height = height;
+        image->stride = stride;
+        textures.emplace_back(image);
+    }
+    ok = ok && r.read(n);
+    for (uint64_t i = 0; ok && i < n; i++) {
+        Material m;
+        uint64_t offset = 0, nfaces = 0;
+        int32_t texture = -1;
+        ok = r.read(m.diffuse) && r.read(m.ambient) && r.read(m.specular) &&
+             r.read(m.shininess) && r.read(offset) && r.read(nfaces) &&
+             r.read(texture) && inRange(texture, textures.size(), true) &&
+             offset <= faces.size() && nfaces <= faces.size() - offset;
+        m.offset = offset;
+        m.nfaces = nfaces;
+        if (ok && texture >= 0) m.texture = textures[texture];
+        materials.emplace_back(m);
+    }
+
+    ok = ok && r.read(n);
+    for (uint64_t i = 0; ok && i < n; i++) {
+        glm::vec3 position;
+        int32_t parent = -1;
+        std::vector<uint32_t> name;
+        // Parents come first, the skeleton is built in one pass.
+        ok = r.read(position) && r.read(parent) && inRange(parent, i, true) &&
+             r.readArray(name);
+        Joint joint(i, position, parent);
+        joint.name.assign(name.begin(), name.end());
+        skeleton.joints.emplace_back(joint);
+    }
+
+    ok = ok && r.read(n);
+    for (uint64_t i = 0; ok && i < n; i++) {
+        IKChain chain;
+        int32_t goal = -1, target = -1, iterations = 0;
+        std::vector<uint8_t> limited;
+        size_t njoints = skeleton.joints.size();
+        ok = r.read(goal) && r.read(target) && r.read(iterations) &&
+             r.read(chain.angle_limit) && r.readArray(chain.links) &&
+             r.readArray(limited) && r.readArray(chain.lo) &&
+             r.readArray(chain.hi) && inRange(goal, njoints) &&
+             inRange(target, njoints) && !chain.links.empty() &&
+             limited.size() == chain.links.size() &&
+             chain.lo.size() == chain.links.size() &&
+             chain.hi.size() == chain.links.size();
+        for (int link : chain.links) ok = ok && inRange(link, njoints);
+        chain.goal = goal;
+        chain.target = target;
+        chain.iterations = iterations;
+        chain.limited.assign(limited.begin(), limited.end());
+        chains.emplace_back(chain);
+    }
+
+    ok = ok && r.read(n);
+    for (uint64_t i = 0; ok && i < n; i++) {
+        VertexMorph vm;
+        int32_t category = 0;
+        ok = r.readString(vm.name) && r.read(category) &&
+             r.readArray(vm.vid) && r.readArray(vm.offset) &&
+             vm.offset.size() == vm.vid.size();
+        for (int v : vm.vid) ok = ok && inRange(v, vertices.size());
+        vm.category = category;
+        vms.emplace_back(std::move(vm));
+    }
+
+    ok = ok && r.readArray(rigid_bodies) && r.readArray(spring_constraints);
+
+    // Sizes that don't add up mean a damaged cache, parse the model instead.
+    size_t nv = vertices.size();
+    ok = ok && vertex_normals.size() == nv && uv_coordinates.size() == nv &&
+         joint_ids.size() == nv && joint_weights.size() == nv &&
+         (sdef_params.empty() ||
+          sdef_params.size() == nv * kSdefTexelsPerVertex);
+    for (size_t i = 0; ok && i < faces.size(); i++)
+        ok = faces[i][0] < nv && faces[i][1] < nv && faces[i][2] < nv;
+    for (size_t i = 0; ok && i < nv; i++)
+        for (int k = 0; k < 4; k++)
+            ok = ok && joint_ids[i][k] < skeleton.joints.size();
+    for (const RigidBody& body : rigid_bodies)
+        ok = ok && inRange(body.joint, skeleton.joints.size(), true) &&
+             inRange(body.shape, RigidBody::kCapsule) &&
+             inRange(body.type, RigidBody::kGhost);
+    for (const SpringConstraint& c : spring_constraints)
+        for (int k = 0; k < 2; k++)
+            ok = ok && inRange(c.body[k], rigid_bodies.size(), true);
+    if (!ok) {
+        vertices.clear();
+        vertex_normals.clear();
+        uv_coordinates.clear();
+        faces.clear();
+        joint_ids.clear();
+        joint_weights.clear();
+        sdef_params.clear();
+        materials.clear();
+        skeleton.joints.clear();
+        rigid_bodies.clear();
+        spring_constraints.clear();
+        chains.clear();
+        vms.clear();
+    }
+    return ok;
+}
@@ -0,0 +1,126 @@
+#include "morph_set.h"
+#include <mmdadapter.h>
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include "config.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MORPH_SSE
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Weights below this leave the model unchanged.
+const float kWeightEpsilon = 1e-4f;
+
+/*
+ * Scatter-add weight * offsets[i] into dst[indices[i]]. Offsets are padded
+ * to vec4, so every delta is a single four-wide multiply-add.
+ */
+void scatterAdd(float weight, const uint32_t* indices,
+                const glm::vec4* offsets, uint32_t count, glm::vec4* dst) {
+#ifdef MORPH_SSE
+    __m128 w = _mm_set1_ps(weight);
+    for (uint32_t i = 0; i < count; i++) {
+        float* d = &dst[indices[i]][0];
+        __m128 o = _mm_loadu_ps(&offsets[i][0]);
+        _mm_storeu_ps(d, _mm_add_ps(_mm_loadu_ps(d), _mm_mul_ps(w, o)));
+    }
+#else
+    for (uint32_t i = 0; i < count; i++)
+        dst[indices[i]] += weight * offsets[i];
+#endif
+}
+
+}  // namespace
+
+void MorphSet::load(const std::vector<VertexMorph>& morphs,
+                    size_t nvertices) {
+    morphs_.clear();
+    indices_.clear();
+    offsets_.clear();
+    for (const VertexMorph& vm : morphs) {
+        Morph m;
+        m.name = vm.name;
+        m.first = indices_.size();
+        // Sorted vertices keep the scatter walking forward through memory.
+        std::vector<uint32_t> order(vm.vid.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&vm](uint32_t a, uint32_t b) {
+            return vm.vid[a] < vm.vid[b];
+        });
+        for (uint32_t k : order) {
+            if (vm.vid[k] < 0 || size_t(vm.vid[k]) >= nvertices) continue;
+            indices_.emplace_back(vm.vid[k]);
+            offsets_.emplace_back(glm::vec4(vm.offset[k], 0.0f));
+        }
+        m.count = indices_.size() - m.first;
+        if (m.count > 0) {
+            m.vmin = indices_[m.first];
+            m.vmax = indices_[m.first + m.count - 1] + 1;
+        }
+        morphs_.emplace_back(m);
+    }
+    weights_.assign(morphs_.size(), 0.0f);
+    displacement_.assign(nvertices, glm::vec4(0.0f));
+    active_first_ = active_last_ = 0;
+    dirty_ = false;
+}
+
+int MorphSet::find(const std::string& name) const {
+    for (size_t i = 0; i < morphs_.size(); i++)
+        if (morphs_[i].name == name) return i;
+    return -1;
+}
+
+void MorphSet::setWeight(int morph, float weight) {
+    weight = std::min(std::max(weight, 0.0f), kMaxMorphWeight);
+    if (morph < 0 || morph >= size() || weights_[morph] == weight) return;
+    weights_[morph] = weight;
+    dirty_ = true;
+}
+
+void MorphSet::clearWeights() {
+    for (size_t i = 0; i < weights_.size(); i++) setWeight(i, 0.0f);
+}
+
+bool MorphSet::apply(size_t& first, size_t& last) {
+    if (!dirty_) return false;
+    dirty_ = false;
+
+    size_t active_first = displacement_.size();
+    size_t active_last = 0;
+    for (size_t i = 0; i < morphs_.size(); i++) {
+        if (std::abs(weights_[i]) < kWeightEpsilon || morphs_[i].count == 0)
+            continue;
+        active_first = std::min<size_t>(active_first, morphs_[i].vmin);
+        active_last = std::max<size_t>(active_last, morphs_[i].vmax);
+    }
+    if (active_first >= active_last) active_first = active_last = 0;
+
+    // Vertices the previous weights moved have to go back to rest too.
+    first = active_first;
+    last = active_last;
+    if (active_first_ < active_last_) {
+        first = active_first < active_last
+                    ? std::min(active_first, active_first_)
+                    : active_first_;
+        last = std::max(active_last, active_last_);
+    }
+    active_first_ = active_first;
+    active_last_ = active_last;
+    if (first >= last) return false;
+
+    std::fill(displacement_.begin() + first, displacement_.begin() + last,
+              glm::vec4(0.0f));
+    for (size_t i = 0; i < morphs_.size(); i++) {
+        const Morph& m = morphs_[i];
+        if (std::abs(weights_[i]) < kWeightEpsilon || m.count == 0) continue;
+        scatterAdd(weights_[i], &indices_[m.first], &offsets_[m.first],
+                   m.count, displacement_.data());
+    }
+    return true;
+}
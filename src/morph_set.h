@@ -0,0 +1,63 @@
+#ifndef MORPH_SET_H
+#define MORPH_SET_H
+
+#include <glm/glm.hpp>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct VertexMorph;
+
+/*
+ * MorphSet: vertex morphs of a model as sparse delta streams.
+ *
+ * Every morph is a run of (vertex index, offset) pairs in the flat
+ * indices/offsets arrays, sorted by vertex. apply() accumulates the
+ * weighted offsets of the active morphs into a per-vertex displacement
+ * buffer and reports the vertex range that changed, so only that range
+ * needs to be uploaded again.
+ */
+class MorphSet {
+   public:
+    void load(const std::vector<VertexMorph>& morphs, size_t nvertices);
+
+    int size() const { return morphs_.size(); }
+    const std::string& getName(int morph) const { return morphs_[morph].name; }
+    // Index of the morph with the given name, -1 if there is none.
+    int find(const std::string& name) const;
+    float getWeight(int morph) const { return weights_[morph]; }
+    // Clamped to [0, kMaxMorphWeight].
+    void setWeight(int morph, float weight);
+    void clearWeights();
+
+    /*
+     * apply: rebuild the displacement of every vertex the current or the
+     * previous weights touch. Returns false if no weight changed since the
+     * last call, otherwise [first, last) is the range to upload.
+     */
+    bool apply(size_t& first, size_t& last);
+    const glm::vec4& getDisplacement(size_t vertex) const {
+        return displacement_[vertex];
+    }
+
+   private:
+    struct Morph {
+        std::string name;
+        uint32_t first = 0;  // offset into indices_/offsets_
+        uint32_t count = 0;
+        uint32_t vmin = 0;   // range of the vertices it moves
+        uint32_t vmax = 0;   // one past the last
+    };
+
+    std::vector<Morph> morphs_;
+    std::vector<uint32_t> indices_;
+    std::vector<glm::vec4> offsets_;  // w is 0, so a delta is one vec4 add
+    std::vector<float> weights_;
+    std::vector<glm::vec4> displacement_;
+    size_t active_first_ = 0;  // range displaced by the last apply()
+    size_t active_last_ = 0;
+    bool dirty_ = false;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "motion_clip.h"
+#include <mmdadapter.h>
+#include <algorithm>
+#include <cmath>
+#include "bone_geometry.h"
+#include "config.h"
+
+namespace {
+
+// Progress error at which solving a curve for its parameter stops.
+const float kCurveTolerance = 1e-5f;
+const int kNewtonSteps = 8;
+const int kBisectionSteps = 24;
+
+// One coordinate of the curve at parameter s, p1 and p2 are the control
+// points of that coordinate.
+float bezier(float s, float p1, float p2) {
+    float r = 1.0f - s;
+    return 3.0f * r * r * s * p1 + 3.0f * r * s * s * p2 + s * s * s;
+}
+
+float bezierSlope(float s, float p1, float p2) {
+    float r = 1.0f - s;
+    return 3.0f * r * r * p1 + 6.0f * r * s * (p2 - p1) +
+           3.0f * s * s * (1.0f - p2);
+}
+
+}  // namespace
+
+MotionCurve MotionCurve::make(const glm::vec4& points) {
+    MotionCurve c;
+    c.x1 = glm::clamp(points[0], 0.0f, 1.0f);
+    c.y1 = points[1];
+    c.x2 = glm::clamp(points[2], 0.0f, 1.0f);
+    c.y2 = points[3];
+    c.linear = c.x1 == c.y1 && c.x2 == c.y2;
+    return c;
+}
+
+/*
+ * Solve x(s) = x for the curve parameter s, by Newton's method from s = x,
+ * which is close for the usual gentle curves, and by bisection where the
+ * slope vanishes. x(s) is monotonic as both x control points are in
+ * [0, 1].
+ */
+float MotionCurve::ease(float x) const {
+    if (linear) return x;
+    float s = x;
+    bool solved = false;
+    for (int i = 0; i < kNewtonSteps && !solved; i++) {
+        float error = bezier(s, x1, x2) - x;
+        float slope = bezierSlope(s, x1, x2);
+        solved = std::abs(error) < kCurveTolerance;
+        if (solved || std::abs(slope) < 1e-6f) break;
+        s = glm::clamp(s - error / slope, 0.0f, 1.0f);
+    }
+    if (!solved) {
+        float lo = 0.0f, hi = 1.0f;
+        for (int i = 0; i < kBisectionSteps; i++) {
+            s = 0.5f * (lo + hi);
+            if (bezier(s, x1, x2) < x)
+                lo = s;
+            else
+                hi = s;
+        }
+    }
+    return bezier(s, y1, y2);
+}
+
+void MotionClip::load(const std::vector<std::vector<MotionKey>>& keys) {
+    clear();
+    tracks.resize(keys.size());
+    for (size_t j = 0; j < keys.size(); j++) {
+        tracks[j].first = frames.size();
+        tracks[j].count = keys[j].size();
+        for (const MotionKey& key : keys[j]) {
+            frames.emplace_back(key.frame);
+            rotations.emplace_back(key.rotation);
+            translations.emplace_back(key.translation);
+            for (int c = 0; c < 4; c++)
+                curves.emplace_back(MotionCurve::make(key.curve[c]));
+            nframes = std::max(nframes, key.frame + 1);
+        }
+    }
+}
+
+float MotionClip::duration() const {
+    return std::max(nframes - 1, 0) / kMotionFps;
+}
+
+void MotionClip::sample(float frame, KeyFrame& target) const {
+    frame = glm::clamp(frame, 0.0f, float(std::max(nframes - 1, 0)));
+    target.rel_rot.resize(tracks.size());
+    target.rel_trans.resize(tracks.size());
+    target.root = glm::vec3(0.0f);
+    for (size_t j = 0; j < tracks.size(); j++) {
+        const Track& track = tracks[j];
+        if (track.count == 0) {
+            target.rel_rot[j] = glm::fquat(1.0f, 0.0f, 0.0f, 0.0f);
+            target.rel_trans[j] = glm::vec3(0.0f);
+            continue;
+        }
+        // Key k is the first one after the frame, its curves lead to it.
+        const uint32_t* times = &frames[track.first];
+        int k = std::upper_bound(times, times + track.count, uint32_t(frame)) -
+                times;
+        if (k == 0 || k == int(track.count)) {
+            int held = track.first + (k == 0 ? 0 : k - 1);
+            target.rel_rot[j] = rotations[held];
+            target.rel_trans[j] = translations[held];
+            continue;
+        }
+        int hi = track.first + k;
+        int lo = hi - 1;
+        float x = (frame - frames[lo]) / float(frames[hi] - frames[lo]);
+        const MotionCurve* c = &curves[4 * hi];
+        target.rel_rot[j] =
+            glm::slerp(rotations[lo], rotations[hi], c[3].ease(x));
+        for (int i = 0; i < 3; i++) {
+            float a = translations[lo][i];
+            target.rel_trans[j][i] = a + (translations[hi][i] - a) * c[i].ease(x);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef MOTION_CLIP_H
+#define MOTION_CLIP_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <stdint.h>
+#include <vector>
+
+struct KeyFrame;
+struct MotionKey;
+
+/*
+ * MotionCurve: cubic Bezier easing from (0, 0) to (1, 1) through the
+ * control points (x1, y1) and (x2, y2), as MMD eases between two keys.
+ * Curves whose control points lie on the diagonal are linear and are not
+ * solved for at all.
+ */
+struct MotionCurve {
+    float x1, y1, x2, y2;
+    bool linear;
+
+    static MotionCurve make(const glm::vec4& points);
+    // Eased progress for the linear progress x in [0, 1].
+    float ease(float x) const;
+};
+
+/*
+ * MotionClip: a VMD motion laid out for playback on the skeleton of one
+ * model.
+ *
+ * Every joint is one track of its sparse keys, all tracks share the flat
+ * frames/rotations/translations arrays. A key carries the four curves
+ * (translation x, y, z and rotation) that ease the segment ending at it.
+ * Joints without keys hold the bind pose.
+ */
+struct MotionClip {
+    struct Track {
+        uint32_t first = 0;  // offset into frames and the key arrays
+        uint32_t count = 0;
+    };
+
+    int nframes = 0;  // frames on the 30 fps timeline, last key included
+    std::vector<Track> tracks;
+    std::vector<uint32_t> frames;
+    std::vector<glm::fquat> rotations;
+    std::vector<glm::vec3> translations;
+    std::vector<MotionCurve> curves;  // 4 per key
+
+    // keys[j] are the keys of joint j, sorted by frame.
+    void load(const std::vector<std::vector<MotionKey>>& keys);
+    void clear() { *this = MotionClip(); }
+    bool empty() const { return nframes == 0; }
+    // Length in seconds.
+    float duration() const;
+    /*
+     * sample: evaluate the motion at the given frame (fractional, clamped
+     * to the timeline) into the rotations and translations of a KeyFrame.
+     */
+    void sample(float frame, KeyFrame& target) const;
+};
+
+#endif
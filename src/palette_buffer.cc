@@ -0,0 +1,85 @@
+#include "palette_buffer.h"
+#include <GL/glew.h>
+#include <algorithm>
+#include <debuggl.h>
+#include <iostream>
+#include "bone_geometry.h"
+#include "config.h"
+
+PaletteBuffer::PaletteBuffer() {}
+
+PaletteBuffer::~PaletteBuffer() {
+    if (tex_) glDeleteTextures(1, &tex_);
+    if (buffer_) glDeleteBuffers(1, &buffer_);
+}
+
+int PaletteBuffer::allocate(int njoints) {
+    int base = texels_.size() / kPaletteTexelsPerJoint;
+    texels_.resize((base + njoints) * kPaletteTexelsPerJoint);
+    return base;
+}
+
+void PaletteBuffer::update(int base, const Configuration& q) {
+    int first = 0;
+    int last = q.trans.size();
+    auto iter = versions_.find(base);
+    if (iter != versions_.end()) {
+        if (iter->second == q.version) return;
+        if (iter->second + 1 == q.version) {
+            first = q.changed_first;
+            last = q.changed_last;
+        }
+    }
+    if (first >= last) {
+        versions_[base] = q.version;
+        return;
+    }
+    size_t begin = (base + first) * kPaletteTexelsPerJoint;
+    size_t end = (base + last) * kPaletteTexelsPerJoint;
+    glm::vec4* texel = texels_.data() + begin;
+    for (int j = first; j < last; j++) {
+        const glm::fquat& r = q.dq_real[j];
+        const glm::fquat& d = q.dq_dual[j];
+        *texel++ = glm::vec4(r.x, r.y, r.z, r.w);
+        *texel++ = glm::vec4(d.x, d.y, d.z, d.w);
+        *texel++ = glm::vec4(q.trans[j], 1.0f);
+    }
+    versions_[base] = q.version;
+    if (dirty_begin_ == dirty_end_) {
+        dirty_begin_ = begin;
+        dirty_end_ = end;
+    } else {
+        dirty_begin_ = std::min(dirty_begin_, begin);
+        dirty_end_ = std::max(dirty_end_, end);
+    }
+}
+
+void PaletteBuffer::upload() {
+    if (dirty_begin_ == dirty_end_ && capacity_ == texels_.size()) return;
+    if (!buffer_) {
+        CHECK_GL_ERROR(glGenBuffers(1, &buffer_));
+        CHECK_GL_ERROR(glGenTextures(1, &tex_));
+    }
+    CHECK_GL_ERROR(glBindBuffer(GL_TEXTURE_BUFFER, buffer_));
+    if (capacity_ != texels_.size() ||
+        (dirty_begin_ == 0 && dirty_end_ == texels_.size())) {
+        // New storage, so we never wait for draws still reading the old.
+        size_t size = texels_.size() * sizeof(glm::vec4);
+        CHECK_GL_ERROR(glBufferData(GL_TEXTURE_BUFFER, size, texels_.data(),
+                                    GL_STREAM_DRAW));
+        if (capacity_ != texels_.size()) {
+            CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_BUFFER, tex_));
+            CHECK_GL_ERROR(
+                glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer_));
+            CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_BUFFER, 0));
+            capacity_ = texels_.size();
+        }
+    } else {
+        CHECK_GL_ERROR(glBufferSubData(
+            GL_TEXTURE_BUFFER, dirty_begin_ * sizeof(glm::vec4),
+            (dirty_end_ - dirty_begin_) * sizeof(glm::vec4),
+            texels_.data() + dirty_begin_));
+    }
+    CHECK_GL_ERROR(glBindBuffer(GL_TEXTURE_BUFFER, 0));
+    dirty_begin_ = dirty_end_ = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef PALETTE_BUFFER_H
+#define PALETTE_BUFFER_H
+
+#include <glm/glm.hpp>
+#include <map>
+#include <vector>
+
+struct Configuration;
+
+/*
+ * PaletteBuffer: joint palettes of any number of skeletons packed into one
+ * texture buffer, so there is no fixed bone limit in the shaders.
+ *
+ * Every joint takes kPaletteTexelsPerJoint RGBA32F texels: the real part
+ * of its dual quaternion, the dual part, and the joint position.
+ */
+class PaletteBuffer {
+   public:
+    PaletteBuffer();
+    ~PaletteBuffer();
+    PaletteBuffer(const PaletteBuffer&) = delete;
+    PaletteBuffer& operator=(const PaletteBuffer&) = delete;
+
+    /*
+     * allocate: reserve palette entries for one skeleton
+     * Return: the base joint index of the new range, pass it to the
+     * shaders as palette_base.
+     */
+    int allocate(int njoints);
+    /*
+     * update: stage a skeleton pose into the CPU copy. Only the joints
+     * changed since the last update of this range are copied.
+     */
+    void update(int base, const Configuration& q);
+    /*
+     * upload: send the staged texels changed since the last upload to the
+     * GPU. The storage is only reallocated when the palette grew or every
+     * texel changed.
+     */
+    void upload();
+    unsigned getTexture() const { return tex_; }
+
+   private:
+    std::vector<glm::vec4> texels_;
+    std::map<int, size_t> versions_;  // base -> staged Configuration version
+    size_t dirty_begin_ = 0;          // texels not uploaded yet
+    size_t dirty_end_ = 0;
+    size_t capacity_ = 0;             // texels in the GPU buffer
+    unsigned buffer_ = 0;
+    unsigned tex_ = 0;
+};
+
+#endif
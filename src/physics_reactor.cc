@@ -0,0 +1,434 @@
+#include "physics_reactor.h"
+#include <mmdadapter.h>
+#include <algorithm>
+#include <cmath>
+#include <glm/gtx/quaternion.hpp>
+#include <numeric>
+#include <utility>
+#include "bone_geometry.h"
+#include "config.h"
+
+namespace {
+
+const float kPi = float(M_PI);
+
+// Largest magnitude of any component, used to collapse the per-axis 6-DOF
+// limits and springs into the one swing and one distance this reactor
+// models.
+float largest(const glm::vec3& a) {
+    return std::max({std::abs(a.x), std::abs(a.y), std::abs(a.z)});
+}
+
+float largest(const glm::vec3& a, const glm::vec3& b) {
+    return std::max(largest(a), largest(b));
+}
+
+// MMD applies rigid body Euler angles in Y, X, Z order.
+glm::fquat eulerYXZ(const glm::vec3& r) {
+    return glm::angleAxis(r.y, glm::vec3(0.0f, 1.0f, 0.0f)) *
+           glm::angleAxis(r.x, glm::vec3(1.0f, 0.0f, 0.0f)) *
+           glm::angleAxis(r.z, glm::vec3(0.0f, 0.0f, 1.0f));
+}
+
+int findRoot(std::vector<int>& parent, int i) {
+    while (parent[i] != i) i = parent[i] = parent[parent[i]];
+    return i;
+}
+
+}  // namespace
+
+PhysicsReactor::PhysicsReactor()
+    : gravity_(0.0f, -kPhysicsGravity, 0.0f) {}
+
+void PhysicsReactor::addSkeleton(
+    Skeleton& skeleton, const std::vector<RigidBody>& bodies,
+    const std::vector<SpringConstraint>& constraints) {
+    Model model;
+    model.skeleton = &skeleton;
+    const int nslots = skeleton.joint_of_slot.size();
+
+    std::vector<int> body_slot(bodies.size(), -1);
+    std::vector<bool> taken(nslots, false);
+    for (size_t i = 0; i < bodies.size(); i++) {
+        const RigidBody& body = bodies[i];
+        if (body.joint < 0 || body.joint >= nslots) continue;
+        int slot = skeleton.slot_of_joint[body.joint];
+        glm::vec3 offset =
+            body.position - skeleton.joints[body.joint].init_position;
+
+        if (body.type == RigidBody::kKinematic) {
+            Collider c;
+            c.slot = slot;
+            c.offset = offset;
+            c.axis = eulerYXZ(body.rotation) * glm::vec3(0.0f, 1.0f, 0.0f);
+            c.radius = body.size.x;
+            c.half_height = 0.0f;
+            if (body.shape == RigidBody::kCapsule)
+                c.half_height = 0.5f * body.size.y;
+            else if (body.shape == RigidBody::kBox)
+                c.radius = (body.size.x + body.size.y + body.size.z) / 3.0f;
+            c.group = body.group;
+            model.colliders.emplace_back(c);
+            continue;
+        }
+        if (body.type == RigidBody::kGhost || taken[slot]) continue;
+        taken[slot] = true;
+        body_slot[i] = slot;
+
+        Particle p;
+        p.slot = slot;
+        p.anchor = -1;
+        p.offset = offset;
+        p.rest = 0.0f;
+        p.radius = body.shape == RigidBody::kBox
+                       ? std::min({body.size.x, body.size.y, body.size.z})
+                       : body.size.x;
+        p.damping = glm::clamp(
+            std::max(body.linear_damping, body.angular_damping), 0.0f, 1.0f);
+        p.stiffness = 0.0f;
+        p.stretch = 0.0f;
+        p.stretch_stiffness = 0.0f;
+        p.max_swing = kPi;
+        p.locked = false;
+        p.group = body.group;
+        p.mask = body.mask;
+        p.position = p.previous = body.position;
+        p.anim_rot = p.written_rot = skeleton.local_rot[slot];
+        model.particles.emplace_back(p);
+    }
+    std::sort(model.particles.begin(), model.particles.end(),
+              [](const Particle& a, const Particle& b) {
+                  return a.slot < b.slot;
+              });
+    model.particle_of_slot.assign(nslots, -1);
+    for (size_t k = 0; k < model.particles.size(); k++)
+        model.particle_of_slot[model.particles[k].slot] = k;
+
+    // Chain every particle to the nearest particle above it.
+    for (Particle& p : model.particles) {
+        for (int s = skeleton.parent_slot[p.slot]; s >= 0 && p.anchor < 0;
+             s = skeleton.parent_slot[s])
+            p.anchor = model.particle_of_slot[s];
+        glm::vec3 anchor =
+            p.anchor < 0 ? p.position - p.offset
+                         : model.particles[p.anchor].position;
+        p.rest = glm::length(p.position - anchor);
+    }
+
+    /*
+     * PMD constraints go from the parent body (0) to the child body (1).
+     * The 6-DOF constraint of a body to the one above it becomes a swing
+     * and a distance: the rotation limits bound the swing and the rotation
+     * spring pulls it back to the animation, the translation limits let
+     * the distance give and the translation spring pulls it back to the
+     * bind distance. Per axis values are reduced to their largest.
+     */
+    for (const SpringConstraint& c : constraints) {
+        if (c.body[0] < 0 || c.body[1] < 0) continue;
+        int a = body_slot[c.body[0]] < 0
+                    ? -1
+                    : model.particle_of_slot[body_slot[c.body[0]]];
+        int b = body_slot[c.body[1]] < 0
+                    ? -1
+                    : model.particle_of_slot[body_slot[c.body[1]]];
+        if (b < 0) std::swap(a, b);
+        if (b < 0) continue;
+        Particle& child = model.particles[b];
+        if (a < 0 || child.anchor == a) {
+            child.max_swing = std::min(
+                child.max_swing, largest(c.lo_rotation, c.hi_rotation));
+            child.stiffness =
+                std::max(child.stiffness, largest(c.spring_rotation));
+            child.stretch = std::max(
+                child.stretch, largest(c.lo_translation, c.hi_translation));
+            child.stretch_stiffness = std::max(
+                child.stretch_stiffness, largest(c.spring_translation));
+        } else if (model.particles[a].anchor != b) {
+            Link link;
+            link.a = a;
+            link.b = b;
+            link.rest = glm::length(model.particles[a].position -
+                                    child.position);
+            model.links.emplace_back(link);
+        }
+    }
+    for (Particle& p : model.particles)
+        p.locked = p.max_swing < 1e-4f || glm::length(p.offset) < 1e-4f;
+
+    buildIslands(model);
+    models_.emplace_back(std::move(model));
+}
+
+void PhysicsReactor::removeSkeleton(Skeleton& skeleton) {
+    models_.erase(std::remove_if(models_.begin(), models_.end(),
+                                 [&skeleton](const Model& m) {
+                                     return m.skeleton == &skeleton;
+                                 }),
+                  models_.end());
+}
+
+/*
+ * A strand is the subtree of a particle without a particle above it. Strands
+ * that share a constraint are merged into one island.
+ */
+void PhysicsReactor::buildIslands(Model& model) {
+    const int n = model.particles.size();
+    std::vector<int> strand_of(n, -1);
+    std::vector<int> roots;
+    for (int k = 0; k < n; k++) {
+        int anchor = model.particles[k].anchor;
+        strand_of[k] = anchor < 0 ? k : strand_of[anchor];
+        if (anchor < 0) roots.emplace_back(k);
+    }
+    std::vector<int> parent(n);
+    std::iota(parent.begin(), parent.end(), 0);
+    for (const Link& link : model.links)
+        parent[findRoot(parent, strand_of[link.a])] =
+            findRoot(parent, strand_of[link.b]);
+
+    std::vector<int> island_of(n, -1);
+    model.islands.clear();
+    for (int r : roots) {
+        int root = findRoot(parent, r);
+        if (island_of[root] < 0) {
+            island_of[root] = model.islands.size();
+            model.islands.emplace_back();
+        }
+        model.islands[island_of[root]].strands.emplace_back(r);
+    }
+    for (size_t i = 0; i < model.links.size(); i++) {
+        int root = findRoot(parent, strand_of[model.links[i].a]);
+        model.islands[island_of[root]].links.emplace_back(i);
+    }
+}
+
+void PhysicsReactor::reset() {
+    for (Model& model : models_) {
+        Skeleton& skeleton = *model.skeleton;
+        for (Particle& p : model.particles) {
+            if (skeleton.local_rot[p.slot] != p.written_rot)
+                p.anim_rot = skeleton.local_rot[p.slot];
+            skeleton.local_rot[p.slot] = p.written_rot = p.anim_rot;
+        }
+        skeleton.markAllDirty();
+        skeleton.evaluate();
+        for (Particle& p : model.particles) {
+            p.position = p.previous = skeleton.world_pos[p.slot] +
+                                      skeleton.world_rot[p.slot] * p.offset;
+        }
+    }
+    accumulator_ = 0.0f;
+    timeline_step_ = -1;
+}
+
+int PhysicsReactor::react(float elapsed) {
+    timeline_step_ = -1;
+    accumulator_ += std::max(elapsed, 0.0f);
+    int steps = accumulator_ / kPhysicsStep;
+    if (steps > kPhysicsMaxSteps) {
+        // Too far behind: drop time rather than spiral.
+        steps = kPhysicsMaxSteps;
+        accumulator_ = 0.0f;
+    } else {
+        accumulator_ -= steps * kPhysicsStep;
+    }
+    return step(steps);
+}
+
+int PhysicsReactor::follow(double time) {
+    // Times on a step boundary must not fall short of it by rounding.
+    long target = long(std::floor(time / kPhysicsStep + 1e-4));
+    if (timeline_step_ < 0 || target < timeline_step_) {
+        reset();
+        timeline_step_ = target;
+        return 0;
+    }
+    int steps = target - timeline_step_;
+    timeline_step_ = target;
+    return step(steps);
+}
+
+int PhysicsReactor::step(int steps) {
+    if (steps <= 0) return 0;
+
+    std::vector<std::pair<int, int>> work;
+    for (size_t m = 0; m < models_.size(); m++) {
+        Model& model = models_[m];
+        Skeleton& skeleton = *model.skeleton;
+        if (skeleton.isDirty()) skeleton.evaluate();
+        for (Collider& c : model.colliders) {
+            const glm::fquat& rot = skeleton.world_rot[c.slot];
+            c.center = skeleton.world_pos[c.slot] + rot * c.offset;
+            c.world_axis = rot * c.axis;
+        }
+        for (size_t i = 0; i < model.islands.size(); i++)
+            work.emplace_back(m, i);
+    }
+
+#pragma omp parallel for schedule(dynamic)
+    for (int w = 0; w < (int)work.size(); w++) {
+        Model& model = models_[work[w].first];
+        const Island& island = model.islands[work[w].second];
+        for (int i = 0; i < steps; i++)
+            stepIsland(model, island, kPhysicsStep);
+    }
+
+    for (Model& model : models_)
+        for (const Island& island : model.islands)
+            for (int r : island.strands)
+                model.skeleton->markDirty(
+                    model.skeleton->joint_of_slot[model.particles[r].slot]);
+    return steps;
+}
+
+void PhysicsReactor::stepIsland(Model& model, const Island& island,
+                                float dt) {
+    std::vector<Particle>& particles = model.particles;
+    for (int r : island.strands) poseStrand(model, r, true);
+
+    // Verlet integration, damping is per second as in Bullet.
+    glm::vec3 g = gravity_ * dt * dt;
+    for (int r : island.strands) {
+        for (int k = r, end = strandEnd(model, r); k < end; k++) {
+            Particle& p = particles[k];
+            if (p.locked) {
+                p.position = p.previous = p.target;
+                continue;
+            }
+            glm::vec3 v =
+                (p.position - p.previous) * std::pow(1.0f - p.damping, dt);
+            float pull = std::min(1.0f, p.stiffness * dt * dt);
+            p.previous = p.position;
+            p.position += v + g + (p.target - p.position) * pull;
+            if (p.stretch > 0.0f) {
+                glm::vec3 anchor = p.anchor < 0
+                                       ? p.joint
+                                       : particles[p.anchor].position;
+                glm::vec3 d = p.position - anchor;
+                float len = glm::length(d);
+                float back = std::min(1.0f, p.stretch_stiffness * dt * dt);
+                if (len > 1e-6f)
+                    p.position -= d * ((len - p.rest) / len * back);
+            }
+        }
+    }
+
+    for (int it = 0; it < kPhysicsIterations; it++) {
+        for (int r : island.strands) {
+            for (int k = r, end = strandEnd(model, r); k < end; k++) {
+                Particle& p = particles[k];
+                if (p.locked) continue;
+                glm::vec3 anchor = p.anchor < 0
+                                       ? p.joint
+                                       : particles[p.anchor].position;
+                glm::vec3 d = p.position - anchor;
+                float len = glm::length(d);
+                float kept =
+                    glm::clamp(len, std::max(p.rest - p.stretch, 0.0f),
+                               p.rest + p.stretch);
+                if (len > 1e-6f && kept != len)
+                    p.position = anchor + d * (kept / len);
+                collide(model, p);
+            }
+        }
+        for (int i : island.links) {
+            const Link& link = model.links[i];
+            Particle& a = particles[link.a];
+            Particle& b = particles[link.b];
+            glm::vec3 d = b.position - a.position;
+            float len = glm::length(d);
+            if (len < 1e-6f || (a.locked && b.locked)) continue;
+            glm::vec3 fix = d * ((len - link.rest) / len);
+            if (a.locked)
+                b.position -= fix;
+            else if (b.locked)
+                a.position += fix;
+            else {
+                a.position += 0.5f * fix;
+                b.position -= 0.5f * fix;
+            }
+        }
+    }
+
+    for (int r : island.strands) poseStrand(model, r, false);
+}
+
+/*
+ * Walk the joint subtree of a strand in slot order. The animated pass puts
+ * the animated rotations back and records where the animation wants every
+ * body, the other pass swings the joints towards the simulated bodies.
+ */
+void PhysicsReactor::poseStrand(Model& model, int root, bool animated) {
+    Skeleton& skeleton = *model.skeleton;
+    int begin = model.particles[root].slot;
+    int end = skeleton.subtree_end[begin];
+    for (int s = begin; s < end; s++) {
+        int k = model.particle_of_slot[s];
+        if (k < 0) {
+            skeleton.evaluateSlot(s);
+            continue;
+        }
+        Particle& p = model.particles[k];
+        if (animated && skeleton.local_rot[s] != p.written_rot)
+            p.anim_rot = skeleton.local_rot[s];
+        skeleton.local_rot[s] = p.anim_rot;
+        skeleton.evaluateSlot(s);
+        const glm::vec3& joint = skeleton.world_pos[s];
+        glm::vec3 center = joint + skeleton.world_rot[s] * p.offset;
+        if (animated) {
+            p.joint = joint;
+            p.target = center;
+            continue;
+        }
+        if (!p.locked) {
+            glm::vec3 from = center - joint;
+            glm::vec3 to = p.position - joint;
+            if (glm::length(to) > 1e-6f) {
+                glm::fquat swing =
+                    glm::rotation(glm::normalize(from), glm::normalize(to));
+                float angle = glm::angle(swing);
+                if (angle > p.max_swing)
+                    swing = glm::angleAxis(p.max_swing, glm::axis(swing));
+                int parent = skeleton.parent_slot[s];
+                glm::fquat parent_rot = parent < 0
+                                            ? glm::fquat(1.0f, 0.0f, 0.0f, 0.0f)
+                                            : skeleton.world_rot[parent];
+                skeleton.local_rot[s] =
+                    glm::normalize(glm::inverse(parent_rot) * swing *
+                                   parent_rot * p.anim_rot);
+                skeleton.evaluateSlot(s);
+            }
+        }
+        p.written_rot = skeleton.local_rot[s];
+    }
+}
+
+// Push a particle out of the kinematic bodies it collides with.
+void PhysicsReactor::collide(const Model& model, Particle& p) const {
+    for (const Collider& c : model.colliders) {
+        if (!((p.mask >> c.group) & 1)) continue;
+        glm::vec3 closest = c.center;
+        if (c.half_height > 0.0f) {
+            float t = glm::clamp(glm::dot(p.position - c.center, c.world_axis),
+                                 -c.half_height, c.half_height);
+            closest += t * c.world_axis;
+        }
+        glm::vec3 d = p.position - closest;
+        float len = glm::length(d);
+        float reach = c.radius + p.radius;
+        if (len < reach && len > 1e-6f) p.position = closest + d * (reach / len);
+    }
+    if (has_floor_ && p.position.y < floor_height_ + p.radius)
+        p.position.y = floor_height_ + p.radius;
+}
+
+// One past the last particle of a strand, particles are in slot order.
+int PhysicsReactor::strandEnd(const Model& model, int root) const {
+    int end_slot =
+        model.skeleton->subtree_end[model.particles[root].slot];
+    int k = root + 1;
+    while (k < (int)model.particles.size() &&
+           model.particles[k].slot < end_slot)
+        k++;
+    return k;
+}
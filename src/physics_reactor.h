@@ -0,0 +1,119 @@
+#ifndef PHYSICS_REACTOR_H
+#define PHYSICS_REACTOR_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+
+struct RigidBody;
+struct SpringConstraint;
+struct Skeleton;
+
+/*
+ * PhysicsReactor: secondary motion (hair, skirts) of the dynamic rigid
+ * bodies of every added skeleton, at a fixed time step.
+ *
+ * A dynamic body is a point at its center that is integrated with gravity,
+ * damping and a spring back to where the animation puts it, and then kept
+ * at its bind distance, give or take its translation limits, to the body
+ * above it, to the bodies it shares a constraint with, out of the
+ * kinematic bodies and above the floor. Its joint is then swung towards
+ * the point, within the rotation limits of its constraint.
+ *
+ * The bodies of one joint subtree, plus those linked to it by
+ * constraints, form an island. Islands touch disjoint joints and are
+ * stepped in parallel, each in a fixed order, so a run is deterministic.
+ */
+class PhysicsReactor {
+   public:
+    PhysicsReactor();
+    void addSkeleton(Skeleton& skeleton, const std::vector<RigidBody>& bodies,
+                     const std::vector<SpringConstraint>& constraints);
+    void removeSkeleton(Skeleton& skeleton);
+    // Put every dynamic joint back to its animated rotation and every body
+    // to its animated position, at rest.
+    void reset();
+    /*
+     * react: advance by elapsed wall clock seconds in fixed steps, the
+     * remainder is carried over to the next call. A frame that is too far
+     * behind drops time. The skeletons must be evaluated. Returns the
+     * number of steps, the touched joints are marked dirty.
+     */
+    int react(float elapsed);
+    /*
+     * follow: advance to the given time of the animation timeline, by
+     * every step since the previous call, so no time is ever dropped and
+     * the same sequence of times always gives the same motion. The first
+     * call, and a time before the previous one, reset() instead of
+     * stepping. Otherwise as react.
+     */
+    int follow(double time);
+    // Advance by exactly this many steps, as react.
+    int step(int steps);
+
+    void setGravity(const glm::vec3& gravity) { gravity_ = gravity; }
+    const glm::vec3& getGravity() const { return gravity_; }
+    void setFloor(bool has_floor, float height = 0.0f) {
+        has_floor_ = has_floor;
+        floor_height_ = height;
+    }
+    bool isHasFloor() const { return has_floor_; }
+
+   private:
+    struct Particle {
+        int slot;
+        int anchor;         // particle above this one, -1 for the joint
+        glm::vec3 offset;   // center in the joint's bind frame
+        float rest;         // bind distance to the anchor
+        float radius;
+        float damping;
+        float stiffness;    // swing spring towards the animation, per s^2
+        float stretch;      // the distance to the anchor may give this much
+        float stretch_stiffness;  // distance spring back to rest, per s^2
+        float max_swing;    // largest swing off the animation, radians
+        bool locked;        // follows the animation
+        unsigned group, mask;
+        glm::vec3 position, previous;
+        glm::vec3 joint, target;  // animated joint and center, per step
+        glm::fquat anim_rot, written_rot;
+    };
+    struct Collider {
+        int slot;
+        glm::vec3 offset;
+        glm::vec3 axis;     // capsule axis in the joint's bind frame
+        float radius, half_height;
+        unsigned group;
+        glm::vec3 center, world_axis;  // refreshed every react()
+    };
+    struct Link {
+        int a, b;
+        float rest;
+    };
+    struct Island {
+        std::vector<int> strands;  // root particles, each owns a subtree
+        std::vector<int> links;
+    };
+    struct Model {
+        Skeleton* skeleton;
+        std::vector<Particle> particles;  // sorted by slot
+        std::vector<int> particle_of_slot;
+        std::vector<Collider> colliders;
+        std::vector<Link> links;
+        std::vector<Island> islands;
+    };
+
+    void buildIslands(Model& model);
+    void stepIsland(Model& model, const Island& island, float dt);
+    void poseStrand(Model& model, int root, bool animated);
+    void collide(const Model& model, Particle& p) const;
+    int strandEnd(const Model& model, int root) const;
+
+    std::vector<Model> models_;
+    glm::vec3 gravity_;
+    bool has_floor_ = false;
+    float floor_height_ = 0.0f;
+    float accumulator_ = 0.0f;
+    long timeline_step_ = -1;  // step follow() is at, -1 if not following
+};
+
+#endif
@@ -23,31 +23,44 @@ struct RenderInputMeta {
     size_t nelements = 0;
     size_t element_length = 0;
     int element_type = 0;
+    bool normalized = false;
+    // Interleaved data: attributes point at the meta that owns the buffer,
+    // which has no position and no element type.
+    int source = -1;
+    size_t stride = 0;
+    size_t offset = 0;
+    unsigned external = 0;  // GL buffer owned elsewhere, 0 if none
 
     size_t getElementSize()
         const;  // simple check: return 12 (3 * 4 bytes) for float3
     RenderInputMeta();
     RenderInputMeta(int _position, const std::string& _name, const void* _data,
                     size_t _nelements, size_t _element_length,
-                    int _element_type);
+                    int _element_type, bool _normalized = false);
     bool isInteger() const;
+    bool isBufferOnly() const { return position < 0 && element_type == 0; }
 };
 
 RenderInputMeta::RenderInputMeta() {}
 
 bool RenderInputMeta::isInteger() const {
-    return element_type == GL_INT || element_type == GL_UNSIGNED_INT;
+    if (normalized) return false;
+    return element_type == GL_INT || element_type == GL_UNSIGNED_INT ||
+           element_type == GL_UNSIGNED_SHORT ||
+           element_type == GL_UNSIGNED_BYTE;
 }
 
 RenderInputMeta::RenderInputMeta(int _position, const std::string& _name,
                                  const void* _data, size_t _nelements,
-                                 size_t _element_length, int _element_type)
+                                 size_t _element_length, int _element_type,
+                                 bool _normalized)
     : position(_position),
       name(_name),
       data(_data),
       nelements(_nelements),
       element_length(_element_length),
-      element_type(_element_type) {}
+      element_type(_element_type),
+      normalized(_normalized) {}
 
 RenderDataInput::RenderDataInput() : index_meta_(new RenderInputMeta) {}
 
@@ -63,6 +76,7 @@ RenderPass::RenderPass(
     : vao_(vao), input_(input), uniforms_(uniforms) {
     if (vao_ < 0) {
         CHECK_GL_ERROR(glGenVertexArrays(1, (GLuint*)&vao_));
+        owns_vao_ = true;
     }
     CHECK_GL_ERROR(glBindVertexArray(vao_));
 
@@ -75,24 +89,37 @@ RenderPass::RenderPass(
     glAttachShader(sp_, fs_);
     if (shaders[1]) glAttachShader(sp_, gs_);
 
-    // ... and then buffers
+    // ... and then buffers, named only for the metas that own storage.
+    // Attributes of an interleaved buffer keep 0 here.
     size_t nbuffer = input.getNBuffers();
     if (input.hasIndex()) nbuffer++;
-    glbuffers_.resize(nbuffer);
-    CHECK_GL_ERROR(glGenBuffers(nbuffer, glbuffers_.data()));
+    glbuffers_.assign(nbuffer, 0);
+    for (int i = 0; i < input.getNBuffers(); i++) {
+        const auto& meta = input.getBufferMeta(i);
+        if (meta.source < 0 && !meta.external)
+            CHECK_GL_ERROR(glGenBuffers(1, &glbuffers_[i]));
+    }
+    if (input.hasIndex())
+        CHECK_GL_ERROR(glGenBuffers(1, &glbuffers_.back()));
     for (int i = 0; i < input.getNBuffers(); i++) {
         auto meta = input.getBufferMeta(i);
-        CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, glbuffers_[i]));
-        CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
-                                    meta.getElementSize() * meta.nelements,
-                                    meta.data, GL_STATIC_DRAW));
+        CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, bufferOf(i)));
+        if (meta.source < 0 && !meta.external) {
+            CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
+                                        meta.getElementSize() * meta.nelements,
+                                        meta.data, GL_STATIC_DRAW));
+        }
+        if (meta.isBufferOnly()) continue;
+        const void* offset = (const void*)meta.offset;
         if (meta.isInteger()) {
-            CHECK_GL_ERROR(glVertexAttribIPointer(
-                meta.position, meta.element_length, meta.element_type, 0, 0));
+            CHECK_GL_ERROR(glVertexAttribIPointer(meta.position,
+                                                  meta.element_length,
+                                                  meta.element_type,
+                                                  meta.stride, offset));
         } else {
-            CHECK_GL_ERROR(
-                glVertexAttribPointer(meta.position, meta.element_length,
-                                      meta.element_type, GL_FALSE, 0, 0));
+            CHECK_GL_ERROR(glVertexAttribPointer(
+                meta.position, meta.element_length, meta.element_type,
+                meta.normalized ? GL_TRUE : GL_FALSE, meta.stride, offset));
         }
         CHECK_GL_ERROR(glEnableVertexAttribArray(meta.position));
         // ... because we need program to bind location
@@ -231,7 +258,23 @@ void RenderPass::createMaterialTexture() {
 }
 
 RenderPass::~RenderPass() {
-    // TODO: Free resources
+    // Shaders stay in shader_cache_, other passes may share them. GL skips
+    // the 0 names and the textures that materials share.
+    if (sp_) glDeleteProgram(sp_);
+    glDeleteBuffers(glbuffers_.size(), glbuffers_.data());
+    glDeleteTextures(matexids_.size(), matexids_.data());
+    if (sampler2d_) glDeleteSamplers(1, &sampler2d_);
+    if (owns_vao_) {
+        GLuint vao = vao_;
+        glDeleteVertexArrays(1, &vao);
+    }
+}
+
+// GL buffer of meta i, interleaved attributes share their source's.
+unsigned RenderPass::bufferOf(int i) const {
+    const auto& meta = input_.getBufferMeta(i);
+    if (meta.source >= 0) return bufferOf(meta.source);
+    return meta.external ? meta.external : glbuffers_[i];
 }
 
 void RenderPass::updateVBO(int position, const void* data, size_t size) {
@@ -247,8 +290,11 @@ void RenderPass::updateVBO(int position, const void* data, size_t size) {
         throw __func__ +
             std::string(": error, can't find buffer with position ") +
             std::to_string(position);
+    // Interleaved attributes update the whole shared buffer.
+    if (input_.getBufferMeta(bufferid).source >= 0)
+        bufferid = input_.getBufferMeta(bufferid).source;
     auto meta = input_.getBufferMeta(bufferid);
-    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, glbuffers_[bufferid]));
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, bufferOf(bufferid)));
     CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, size * meta.getElementSize(),
                                 data, GL_STATIC_DRAW));
 }
@@ -306,9 +352,37 @@ unsigned RenderPass::compileShader(const char* source_ptr, int type) {
 
 void RenderDataInput::assign(int position, const std::string& name,
                              const void* data, size_t nelements,
-                             size_t element_length, int element_type) {
+                             size_t element_length, int element_type,
+                             bool normalized) {
     meta_.emplace_back(position, name, data, nelements, element_length,
-                       element_type);
+                       element_type, normalized);
+}
+
+void RenderDataInput::assignInterleaved(const void* data, size_t nelements,
+                                        size_t stride) {
+    meta_.emplace_back(-1, "", data, nelements, 0, 0);
+    meta_.back().stride = stride;
+}
+
+void RenderDataInput::assignExternal(unsigned buffer, size_t nelements,
+                                     size_t stride) {
+    assignInterleaved(nullptr, nelements, stride);
+    meta_.back().external = buffer;
+}
+
+void RenderDataInput::assignAttribute(int position, const std::string& name,
+                                      size_t offset, size_t element_length,
+                                      int element_type, bool normalized) {
+    int source = -1;
+    for (int i = int(meta_.size()) - 1; i >= 0 && source < 0; i--)
+        if (meta_[i].isBufferOnly()) source = i;
+    if (source < 0)
+        throw __func__ + std::string(": no interleaved buffer for ") + name;
+    meta_.emplace_back(position, name, nullptr, meta_[source].nelements,
+                       element_length, element_type, normalized);
+    meta_.back().source = source;
+    meta_.back().stride = meta_[source].stride;
+    meta_.back().offset = offset;
 }
 
 void RenderDataInput::assignIndex(const void* data, size_t nelements,
@@ -332,6 +406,8 @@ const RenderInputMeta& RenderDataInput::getBufferMeta(int i) const {
 }
 
 size_t RenderInputMeta::getElementSize() const {
+    if (isBufferOnly()) return stride;
+    if (element_type == GL_INT_2_10_10_10_REV) return 4;
     size_t element_size = 4;
     if (element_type == GL_FLOAT)
         element_size = 4;
@@ -339,6 +415,11 @@ size_t RenderInputMeta::getElementSize() const {
         element_size = 4;
     else if (element_type == GL_INT)
         element_size = 4;
+    else if (element_type == GL_UNSIGNED_SHORT ||
+             element_type == GL_HALF_FLOAT)
+        element_size = 2;
+    else if (element_type == GL_UNSIGNED_BYTE)
+        element_size = 1;
     return element_size * element_length;
 }
 
@@ -35,10 +35,36 @@ class RenderDataInput {
      *      name: glBindAttribLocation name
      *      nelements: number of elements
      *      element_length: element dimension, e.g. for vec3 it's 3
-     *      element_type: GL_FLOAT or GL_UNSIGNED_INT
+     *      element_type: GL_FLOAT, GL_INT, GL_UNSIGNED_INT,
+     *                    GL_UNSIGNED_SHORT or GL_UNSIGNED_BYTE
+     *      normalized: integer data is read as [0, 1] floats by the
+     *                  shader instead of as integers
      */
     void assign(int position, const std::string& name, const void* data,
-                size_t nelements, size_t element_length, int element_type);
+                size_t nelements, size_t element_length, int element_type,
+                bool normalized = false);
+    /*
+     * assignInterleaved: assign one buffer that holds several attributes
+     * per vertex, describe them with assignAttribute afterwards
+     *      nelements: number of vertices
+     *      stride: size of one vertex in bytes
+     */
+    void assignInterleaved(const void* data, size_t nelements, size_t stride);
+    /*
+     * assignExternal: like assignInterleaved, for a buffer that already
+     * lives on the GPU and is owned by someone else
+     *      buffer: the GL buffer name
+     */
+    void assignExternal(unsigned buffer, size_t nelements, size_t stride);
+    /*
+     * assignAttribute: add an attribute of the last interleaved buffer
+     *      offset: byte offset of the attribute inside a vertex
+     *      element_type: as in assign, plus GL_HALF_FLOAT and
+     *                    GL_INT_2_10_10_10_REV (element_length 4)
+     */
+    void assignAttribute(int position, const std::string& name, size_t offset,
+                         size_t element_length, int element_type,
+                         bool normalized = false);
     /*
      * assign_index: assign the index buffer for vertices
      * This will bind the data to GL_ELEMENT_ARRAY_BUFFER
@@ -102,18 +128,23 @@ class RenderPass {
      * corresponding uniforms for Phong shading.
      */
     bool renderWithMaterial(int i);  // return false if material id is invalid
+    RenderPass(const RenderPass&) = delete;
+    RenderPass& operator=(const RenderPass&) = delete;
+
    private:
     void initMaterialUniform();
     void createMaterialTexture();
+    unsigned bufferOf(int i) const;
 
     int vao_;
+    bool owns_vao_ = false;
     RenderDataInput input_;
     std::vector<ShaderUniformPtr> uniforms_;
     std::vector<std::vector<ShaderUniformPtr>> material_uniforms_;
 
     std::vector<unsigned> glbuffers_, unilocs_, malocs_;
     std::vector<unsigned> gltextures_, matexids_;
-    unsigned sampler2d_;
+    unsigned sampler2d_ = 0;
     unsigned vs_ = 0, gs_ = 0, fs_ = 0;
     unsigned sp_ = 0;
 
@@ -52,7 +52,7 @@ void TextureCombo::bind(unsigned loc) {
     // Assign texture object to texture unit
     unsigned tex = texture_source();
     CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0 + texture_unit));
-    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_2D, tex));
+    CHECK_GL_ERROR(glBindTexture(texture_target, tex));
 
     // Set the OpenGL sampler used by the texture unit
     unsigned sam = sampler_source();
@@ -60,6 +60,8 @@ void TextureCombo::bind(unsigned loc) {
 
     // Attach the GLSL sampler to a texture unit
     CHECK_GL_ERROR(glUniform1i(loc, texture_unit));
+    // Later plain glBindTexture calls expect unit 0 to be active
+    CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0));
 }
 
 std::shared_ptr<TextureCombo> make_texture(
@@ -71,3 +73,15 @@ std::shared_ptr<TextureCombo> make_texture(
     ret->texture_source = texture_source;
     return ret;
 }
+
+std::shared_ptr<TextureCombo> make_buffer_texture(
+    const std::string& name, unsigned texture_unit,
+    std::function<unsigned()> texture_source) {
+    auto ret = std::make_shared<TextureCombo>();
+    ret->name = name;
+    ret->sampler_source = []() { return 0u; };
+    ret->texture_unit = texture_unit;
+    ret->texture_target = GL_TEXTURE_BUFFER;
+    ret->texture_source = texture_source;
+    return ret;
+}
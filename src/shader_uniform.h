@@ -76,6 +76,7 @@ std::shared_ptr<ShaderUniformBase> make_uniform(const std::string& name,
 struct TextureCombo : public ShaderUniformBase {
     std::function<unsigned()> sampler_source;
     unsigned texture_unit;
+    unsigned texture_target = GL_TEXTURE_2D;
     std::function<unsigned()> texture_source;
     virtual void bind(unsigned loc) override;
 };
@@ -83,5 +84,12 @@ struct TextureCombo : public ShaderUniformBase {
 std::shared_ptr<TextureCombo> make_texture(
     const std::string& name, std::function<unsigned()> sampler_source,
     unsigned texture_unit, std::function<unsigned()> texture_source);
+/*
+ * make_buffer_texture: bind a GL_TEXTURE_BUFFER to a samplerBuffer.
+ * Buffer textures ignore sampler objects, so none is bound.
+ */
+std::shared_ptr<TextureCombo> make_buffer_texture(
+    const std::string& name, unsigned texture_unit,
+    std::function<unsigned()> texture_source);
 
 #endif
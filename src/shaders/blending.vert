@@ -1,77 +1,82 @@
 R"zzz(
 #version 330 core
-uniform vec4 light_position;
-uniform vec3 camera_position;
-
-uniform vec3 joint_trans[128];
-uniform vec4 joint_rot[128];
-
-in int jid0;
-in int jid1;
-in float w0;
-in vec3 vector_from_joint0;
-in vec3 vector_from_joint1;
+// Skinning pre-pass, run once per pose with transform feedback. The
+// skinned vertices are captured and then drawn by every shading pass.
+
+// Per-joint dual quaternion palette, built once per frame on the CPU.
+// Each entry is 3 texels: real part, dual part, joint position.
+uniform samplerBuffer joint_palette;
+uniform int palette_base;
+// Per-batch variant: 0 two joints, 1 four joints, 2 four joints and SDEF.
+uniform int skin_variant;
+// Per-vertex SDEF data, 3 texels: (C, is SDEF), C0 and C1.
+uniform samplerBuffer sdef_params;
+
+in uvec4 joints;
+in vec4 weights;
 in vec4 normal;
-in vec2 uv;
 in vec4 vert;
 
-out vec4 vs_light_direction;
-out vec4 vs_normal;
-out vec2 vs_uv;
-out vec4 vs_camera_direction;
+out vec4 skinned_position;
+out vec4 skinned_normal;
 
 vec3 qtransform(vec4 q, vec3 v) {
 	return v + 2.0 * cross(cross(v, q.xyz) - q.w*v, q.xyz);
 }
 
-vec4 construct(vec4 q, vec3 v) {
-	vec4 dual = vec4(1.0);
-	dual[0] = -0.5 * (v[0]*q.x  + v[1]*q.y + v[2]*q.z);
-	dual[1] =  0.5 * (v[0]*q.w  + v[1]*q.z - v[2]*q.y);
-	dual[2] =  0.5 * (-v[0]*q.z + v[1]*q.w + v[2]*q.x);
-	dual[3] =  0.5 * (v[0]*q.y  - v[1]*q.x + v[2]*q.w);
-	return dual;
+vec3 trans(vec4 r, vec4 d) {
+	return 2.0 * (r.w * d.xyz - d.w * r.xyz + cross(r.xyz, d.xyz));
 }
 
-vec3 trans(vec4 r, vec4 i){
-	vec3 trans = vec3(1.0);
-	trans[0] = 2.0*(-i[0]*r.x + i[1]*r.w - i[2]*r.z + i[3]*r.y);
-	trans[1] = 2.0*(-i[0]*r.y + i[1]*r.z + i[2]*r.w - i[3]*r.x);
-	trans[2] = 2.0*(-i[0]*r.z - i[1]*r.y + i[2]*r.x + i[3]*r.w);
-	return trans;
+int palette(uint jid) {
+	return (palette_base + int(jid)) * 3;
 }
 
+// Accumulate one influence, blending along the shortest arc from pivot.
+void blend(uint jid, float w, vec4 pivot, inout vec4 r, inout vec4 d) {
+	int t = palette(jid);
+	vec4 r_j = texelFetch(joint_palette, t);
+	vec4 d_j = texelFetch(joint_palette, t + 1);
+	if (dot(pivot, r_j) < 0.0)
+		w = -w;
+	r += w * r_j;
+	d += w * d_j;
+}
 
 void main() {
-	// FIXME: Implement linear skinning here
-	
-	vec4 r_0 = joint_rot[jid0];
-	vec4 r_1 = joint_rot[jid1];
-
-
-	vec3 trans_joint_0 =  joint_trans[jid0] - qtransform(r_0, vert.xyz - vector_from_joint0);
-	vec3 trans_joint_1 =  joint_trans[jid1] - qtransform(r_1, vert.xyz - vector_from_joint1);
-
-	vec4 i_0 = construct(r_0, trans_joint_0);
-	vec4 i_1 = construct(r_1, trans_joint_1);
-
-	vec4 r = w0 * r_0 + (1-w0) * r_1;
-	vec4 i = w0 * i_0 + (1-w0) * i_1;
+	int t_0 = palette(joints.x);
+	vec4 r_0 = texelFetch(joint_palette, t_0);
+	vec4 d_0 = texelFetch(joint_palette, t_0 + 1);
+	vec4 r = weights.x * r_0;
+	vec4 d = weights.x * d_0;
+	blend(joints.y, weights.y, r_0, r, d);
+	if (skin_variant != 0) {
+		blend(joints.z, weights.z, r_0, r, d);
+		blend(joints.w, weights.w, r_0, r, d);
+	}
 
 	float length = length(r);
 	r /= length;
-	i /= length;
-
-	vec3 new_trans = trans(r, i);
-
-
-
-	gl_Position = vec4(qtransform(r, vert.xyz) + new_trans, 1.0);
-
-	
-	vs_normal = normal;
-	vs_light_direction = light_position - gl_Position;
-	vs_camera_direction = vec4(camera_position, 1.0) - gl_Position;
-	vs_uv = uv;
+	d /= length;
+
+	vec3 pos = qtransform(r, vert.xyz) + trans(r, d);
+	if (skin_variant == 2) {
+		vec4 c = texelFetch(sdef_params, gl_VertexID * 3);
+		if (c.w > 0.0) {
+			// SDEF: rotate around C by the blended rotation, and move C
+			// with the bones.
+			int t_1 = palette(joints.y);
+			vec4 r_1 = texelFetch(joint_palette, t_1);
+			vec4 d_1 = texelFetch(joint_palette, t_1 + 1);
+			vec3 c_0 = texelFetch(sdef_params, gl_VertexID * 3 + 1).xyz;
+			vec3 c_1 = texelFetch(sdef_params, gl_VertexID * 3 + 2).xyz;
+			pos = qtransform(r, vert.xyz - c.xyz) +
+			      weights.x * (qtransform(r_0, c_0) + trans(r_0, d_0)) +
+			      weights.y * (qtransform(r_1, c_1) + trans(r_1, d_1));
+		}
+	}
+
+	skinned_position = vec4(pos, 1.0);
+	skinned_normal = vec4(qtransform(r, normal.xyz), 0.0);
 }
 )zzz"
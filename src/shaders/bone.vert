@@ -1,13 +1,15 @@
 R"zzz(#version 330 core
-const int kMaxBones = 128;
 uniform mat4 projection;
 uniform mat4 model;
 uniform mat4 view;
+uniform samplerBuffer joint_palette;
+uniform int palette_base;
 in int jid;
-uniform vec3 joint_trans[128];
 
 void main() {
 	mat4 mvp = projection * view * model;
-	gl_Position = mvp * vec4(joint_trans[jid], 1.0);
+	// Third texel of a palette entry holds the joint position.
+	vec4 joint = texelFetch(joint_palette, (palette_base + jid) * 3 + 2);
+	gl_Position = mvp * vec4(joint.xyz, 1.0);
 }
 )zzz"
@@ -1,6 +1,5 @@
 R"zzz(
 #version 330 core
-in vec4 face_normal;
 in vec4 vertex_normal;
 in vec4 light_direction;
 in vec4 camera_direction;
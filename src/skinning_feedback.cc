@@ -0,0 +1,156 @@
+#include "skinning_feedback.h"
+#include <GL/glew.h>
+#include <debuggl.h>
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include "bone_geometry.h"
+
+SkinningFeedback::SkinningFeedback(const Mesh& mesh,
+                                   const char* vertex_shader) {
+    nvertices_ = mesh.packed_vertices.size();
+    has_sdef_ = !mesh.sdef_params.empty();
+
+    CHECK_GL_ERROR(vs_ = glCreateShader(GL_VERTEX_SHADER));
+    CHECK_GL_ERROR(glShaderSource(vs_, 1, &vertex_shader, nullptr));
+    glCompileShader(vs_);
+    CHECK_GL_SHADER_ERROR(vs_);
+    CHECK_GL_ERROR(program_ = glCreateProgram());
+    CHECK_GL_ERROR(glAttachShader(program_, vs_));
+    CHECK_GL_ERROR(glBindAttribLocation(program_, 0, "joints"));
+    CHECK_GL_ERROR(glBindAttribLocation(program_, 1, "weights"));
+    CHECK_GL_ERROR(glBindAttribLocation(program_, 2, "normal"));
+    CHECK_GL_ERROR(glBindAttribLocation(program_, 3, "vert"));
+    const char* varyings[] = {"skinned_position", "skinned_normal"};
+    CHECK_GL_ERROR(glTransformFeedbackVaryings(program_, 2, varyings,
+                                               GL_INTERLEAVED_ATTRIBS));
+    glLinkProgram(program_);
+    CHECK_GL_PROGRAM_ERROR(program_);
+    CHECK_GL_ERROR(palette_loc_ =
+                       glGetUniformLocation(program_, "joint_palette"));
+    CHECK_GL_ERROR(palette_base_loc_ =
+                       glGetUniformLocation(program_, "palette_base"));
+    CHECK_GL_ERROR(sdef_loc_ = glGetUniformLocation(program_, "sdef_params"));
+    CHECK_GL_ERROR(variant_loc_ =
+                       glGetUniformLocation(program_, "skin_variant"));
+
+    // A vertex needs the most expensive variant among its materials, and
+    // runs of equal variants are drawn together.
+    std::vector<int> variant(nvertices_);
+    for (size_t v = 0; v < nvertices_; v++) variant[v] = mesh.getSkinVariant(v);
+    for (const Material& material : mesh.materials) {
+        for (size_t f = material.offset;
+             f < material.offset + material.nfaces && f < mesh.faces.size();
+             f++) {
+            for (int k = 0; k < 3; k++) {
+                int& v = variant[mesh.faces[f][k]];
+                v = std::max(v, material.skin_variant);
+            }
+        }
+    }
+    for (size_t v = 0; v < nvertices_; v++) {
+        if (batches_.empty() || batches_.back().variant != variant[v])
+            batches_.push_back({variant[v], v, 0});
+        batches_.back().count++;
+    }
+
+    CHECK_GL_ERROR(glGenVertexArrays(1, &vao_));
+    CHECK_GL_ERROR(glBindVertexArray(vao_));
+    CHECK_GL_ERROR(glGenBuffers(1, &input_));
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, input_));
+    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER,
+                                nvertices_ * sizeof(SkinnedVertex),
+                                mesh.packed_vertices.data(), GL_STATIC_DRAW));
+    const GLsizei stride = sizeof(SkinnedVertex);
+    CHECK_GL_ERROR(glVertexAttribIPointer(
+        0, 4, GL_UNSIGNED_SHORT, stride,
+        (const void*)offsetof(SkinnedVertex, joint_ids)));
+    CHECK_GL_ERROR(glVertexAttribPointer(
+        1, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride,
+        (const void*)offsetof(SkinnedVertex, joint_weights)));
+    CHECK_GL_ERROR(glVertexAttribPointer(
+        2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride,
+        (const void*)offsetof(SkinnedVertex, normal)));
+    CHECK_GL_ERROR(glVertexAttribPointer(
+        3, 3, GL_FLOAT, GL_FALSE, stride,
+        (const void*)offsetof(SkinnedVertex, position)));
+    for (int i = 0; i < 4; i++)
+        CHECK_GL_ERROR(glEnableVertexAttribArray(i));
+    CHECK_GL_ERROR(glBindVertexArray(0));
+
+    CHECK_GL_ERROR(glGenBuffers(1, &output_));
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, output_));
+    CHECK_GL_ERROR(glBufferData(GL_ARRAY_BUFFER, nvertices_ * kOutputStride,
+                                nullptr, GL_DYNAMIC_COPY));
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, 0));
+
+    // SDEF parameters never change, so they live in a static buffer.
+    if (has_sdef_) {
+        CHECK_GL_ERROR(glGenBuffers(1, &sdef_buffer_));
+        CHECK_GL_ERROR(glBindBuffer(GL_TEXTURE_BUFFER, sdef_buffer_));
+        CHECK_GL_ERROR(glBufferData(
+            GL_TEXTURE_BUFFER, mesh.sdef_params.size() * sizeof(glm::vec4),
+            mesh.sdef_params.data(), GL_STATIC_DRAW));
+        CHECK_GL_ERROR(glGenTextures(1, &sdef_tex_));
+        CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_BUFFER, sdef_tex_));
+        CHECK_GL_ERROR(
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, sdef_buffer_));
+        CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_BUFFER, 0));
+        CHECK_GL_ERROR(glBindBuffer(GL_TEXTURE_BUFFER, 0));
+    }
+}
+
+SkinningFeedback::~SkinningFeedback() {
+    if (program_) glDeleteProgram(program_);
+    if (vs_) glDeleteShader(vs_);
+    if (sdef_tex_) glDeleteTextures(1, &sdef_tex_);
+    GLuint buffers[] = {input_, output_, sdef_buffer_};
+    glDeleteBuffers(3, buffers);
+    if (vao_) glDeleteVertexArrays(1, &vao_);
+}
+
+void SkinningFeedback::update(unsigned palette, int palette_base,
+                              size_t version) {
+    if (skinned_ && version == version_) return;
+
+    CHECK_GL_ERROR(glUseProgram(program_));
+    CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE1));
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_BUFFER, palette));
+    CHECK_GL_ERROR(glUniform1i(palette_loc_, 1));
+    CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE2));
+    CHECK_GL_ERROR(glBindTexture(GL_TEXTURE_BUFFER, sdef_tex_));
+    CHECK_GL_ERROR(glUniform1i(sdef_loc_, 2));
+    CHECK_GL_ERROR(glActiveTexture(GL_TEXTURE0));
+    CHECK_GL_ERROR(glUniform1i(palette_base_loc_, palette_base));
+
+    CHECK_GL_ERROR(glBindVertexArray(vao_));
+    CHECK_GL_ERROR(glEnable(GL_RASTERIZER_DISCARD));
+    CHECK_GL_ERROR(glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, output_));
+    // The batches cover the vertices in order, so the captured vertices
+    // land in the output at their own index.
+    CHECK_GL_ERROR(glBeginTransformFeedback(GL_POINTS));
+    for (const Batch& batch : batches_) {
+        CHECK_GL_ERROR(glUniform1i(variant_loc_, batch.variant));
+        CHECK_GL_ERROR(glDrawArrays(GL_POINTS, batch.first, batch.count));
+    }
+    CHECK_GL_ERROR(glEndTransformFeedback());
+    CHECK_GL_ERROR(glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0));
+    CHECK_GL_ERROR(glDisable(GL_RASTERIZER_DISCARD));
+    CHECK_GL_ERROR(glBindVertexArray(0));
+
+    skinned_ = true;
+    version_ = version;
+}
+
+void SkinningFeedback::uploadVertices(const Mesh& mesh, size_t first,
+                                      size_t last) {
+    last = std::min(last, nvertices_);
+    if (first >= last) return;
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, input_));
+    CHECK_GL_ERROR(glBufferSubData(GL_ARRAY_BUFFER,
+                                   first * sizeof(SkinnedVertex),
+                                   (last - first) * sizeof(SkinnedVertex),
+                                   &mesh.packed_vertices[first]));
+    CHECK_GL_ERROR(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    skinned_ = false;
+}
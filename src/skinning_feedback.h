@@ -0,0 +1,69 @@
+#ifndef SKINNING_FEEDBACK_H
+#define SKINNING_FEEDBACK_H
+
+#include <stddef.h>
+#include <vector>
+
+struct Mesh;
+
+/*
+ * SkinningFeedback: skinning pre-pass. Deforms the mesh once per pose with
+ * transform feedback into a buffer of (position, normal) vec4 pairs, which
+ * all shading passes and views then draw without skinning again.
+ *
+ * Vertices take the shader variant of the materials that use them, so the
+ * two-joint batches of a model never pay for four joints or SDEF.
+ */
+class SkinningFeedback {
+   public:
+    // Position and normal of one skinned vertex in the output buffer.
+    static const size_t kOutputStride = 2 * 4 * sizeof(float);
+
+    SkinningFeedback(const Mesh& mesh, const char* vertex_shader);
+    ~SkinningFeedback();
+    SkinningFeedback(const SkinningFeedback&) = delete;
+    SkinningFeedback& operator=(const SkinningFeedback&) = delete;
+
+    /*
+     * update: skin the mesh with the given palette texture buffer, unless
+     * the pose version was already skinned.
+     */
+    void update(unsigned palette, int palette_base, size_t version);
+    /*
+     * uploadVertices: copy packed_vertices[first, last) to the input buffer
+     * after a morph moved them, the next update() skins again.
+     */
+    void uploadVertices(const Mesh& mesh, size_t first, size_t last);
+    // Skinned vertices, read with kOutputStride.
+    unsigned getOutputBuffer() const { return output_; }
+    // Packed SkinnedVertex data, for the attributes that aren't skinned.
+    unsigned getInputBuffer() const { return input_; }
+    size_t getNVertices() const { return nvertices_; }
+
+   private:
+    // Vertices [first, first + count), skinned with one variant.
+    struct Batch {
+        int variant;
+        size_t first;
+        size_t count;
+    };
+
+    size_t nvertices_ = 0;
+    std::vector<Batch> batches_;
+    unsigned vao_ = 0;
+    unsigned input_ = 0;
+    unsigned output_ = 0;
+    unsigned sdef_buffer_ = 0;
+    unsigned sdef_tex_ = 0;
+    unsigned vs_ = 0;
+    unsigned program_ = 0;
+    int palette_loc_ = -1;
+    int palette_base_loc_ = -1;
+    int sdef_loc_ = -1;
+    int variant_loc_ = -1;
+    bool has_sdef_ = false;
+    bool skinned_ = false;
+    size_t version_ = 0;
+};
+
+#endif
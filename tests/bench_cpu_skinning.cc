@@ -0,0 +1,92 @@
+/*
+ * CPU skinning throughput on the bundled models: vertices per second per
+ * core for both blends, SSE and scalar, on one thread and on all of them.
+ * Usage: bench_cpu_skinning [model directory]
+ */
+#include <chrono>
+#include <cstdio>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "bone_geometry.h"
+#include "check.h"
+#include "cpu_skinning.h"
+
+namespace {
+
+const char* kModels[] = {
+    "Miku_Hatsune.pmd", "Miku_Hatsune_Ver2.pmd", "Rin_Kagamine.pmd",
+    "Len_Kagamine.pmd", "KAITO.pmd",             "MEIKO.pmd",
+    "Haku_Yowane.pmd",  "Neru_Akita.pmd",
+};
+const double kSecondsPerRun = 0.5;
+
+int maxThreads() {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+void setThreads(int n) {
+#ifdef _OPENMP
+    omp_set_num_threads(n);
+#else
+    (void)n;
+#endif
+}
+
+// Skinned vertices per second over about kSecondsPerRun.
+double measure(CpuSkinner& skinner, const Mesh& mesh, SkinningMode mode) {
+    typedef std::chrono::steady_clock Clock;
+    skinner.skin(mesh, *mesh.getCurrentQ(), mode);  // sizes the outputs
+    long frames = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    do {
+        skinner.skin(mesh, *mesh.getCurrentQ(), mode);
+        frames++;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < kSecondsPerRun);
+    return frames * double(mesh.vertices.size()) / elapsed;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    int threads = maxThreads();
+    std::printf("%-22s %8s %6s %6s %7s %14s\n", "model", "vertices", "blend",
+                "simd", "threads", "Mvert/s/core");
+    for (const char* name : kModels) {
+        Mesh mesh;
+        mesh.setModelCacheDir(testCacheDir());
+        mesh.loadPmd(assetPath(argc, argv, name));
+        for (int j = 0; j < mesh.getNumberOfBones(); j += 2)
+            mesh.skeleton.rotate(
+                j, glm::angleAxis(0.2f, glm::vec3(0.0f, 1.0f, 0.0f)));
+        mesh.refreshPose();
+
+        const SkinningMode modes[] = {SkinningMode::kLinearBlend,
+                                      SkinningMode::kDualQuaternion};
+        for (SkinningMode mode : modes) {
+            for (bool simd : {true, false}) {
+                for (int n : {1, threads}) {
+                    CpuSkinner skinner;
+                    skinner.setVectorized(simd);
+                    setThreads(n);
+                    double rate = measure(skinner, mesh, mode);
+                    std::printf(
+                        "%-22s %8zu %6s %6s %7d %14.2f\n", name,
+                        mesh.vertices.size(),
+                        mode == SkinningMode::kLinearBlend ? "linear" : "dual",
+                        skinner.isVectorized() ? "sse" : "scalar", n,
+                        rate / n / 1e6);
+                    if (threads == 1) break;
+                }
+            }
+        }
+        setThreads(threads);
+    }
+    return 0;
+}
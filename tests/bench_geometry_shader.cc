@@ -0,0 +1,190 @@
+/*
+ * Cost of the geometry shader path: milliseconds per frame to draw the
+ * floor and a model through default.vert + default.geom, against
+ * direct.vert with the face normals from dFdx/dFdy, in a hidden window.
+ * The model is drawn from its bind pose, so only the shading paths differ.
+ * Usage: bench_geometry_shader [model directory]
+ */
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <debuggl.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include "bone_geometry.h"
+#include "check.h"
+#include "procedure_geometry.h"
+#include "render_pass.h"
+
+namespace {
+
+const char* vertex_shader =
+#include "shaders/default.vert"
+    ;
+
+const char* direct_vertex_shader =
+#include "shaders/direct.vert"
+    ;
+
+const char* geometry_shader =
+#include "shaders/default.geom"
+    ;
+
+const char* fragment_shader =
+#include "shaders/default.frag"
+    ;
+
+const char* floor_fragment_shader =
+#include "shaders/floor.frag"
+    ;
+
+const char* kModels[] = {"Miku_Hatsune.pmd", "KAITO.pmd", "Haku_Yowane.pmd"};
+const int kWidth = 1280, kHeight = 720;
+const int kWarmupFrames = 30;
+const double kSecondsPerRun = 2.0;
+
+GLFWwindow* createHiddenWindow() {
+    if (!glfwInit()) return nullptr;
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    GLFWwindow* window =
+        glfwCreateWindow(kWidth, kHeight, "bench", nullptr, nullptr);
+    if (!window) return nullptr;
+    glfwMakeContextCurrent(window);
+    glfwSwapInterval(0);
+    glewExperimental = GL_TRUE;
+    if (glewInit() != GLEW_OK) return nullptr;
+    glGetError();  // clear GLEW's error for it
+    return window;
+}
+
+struct Scene {
+    std::vector<glm::vec4> floor_vertices;
+    std::vector<glm::uvec3> floor_faces;
+    glm::mat4 identity = glm::mat4(1.0f);
+    glm::mat4 view, projection;
+    glm::vec3 camera = glm::vec3(0.0f, 12.0f, 30.0f);
+    glm::vec4 light = glm::vec4(10.0f, 50.0f, 30.0f, 1.0f);
+    float alpha = 1.0f;
+};
+
+// Milliseconds per frame of draw() over about kSecondsPerRun.
+template <typename Draw>
+double msPerFrame(GLFWwindow* window, Draw draw) {
+    for (int i = 0; i < kWarmupFrames; i++) draw();
+    glFinish();
+    typedef std::chrono::steady_clock Clock;
+    int frames = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    while (elapsed < kSecondsPerRun) {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        draw();
+        glfwSwapBuffers(window);
+        glFinish();
+        frames++;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    return 1e3 * elapsed / frames;
+}
+
+void benchModel(GLFWwindow* window, Scene& scene, const std::string& path,
+                const char* name) {
+    Mesh mesh;
+    mesh.setModelCacheDir(testCacheDir());
+    mesh.loadPmd(path);
+    if (mesh.vertices.empty()) {
+        std::printf("%-22s missing\n", name);
+        return;
+    }
+
+    std::function<glm::mat4()> model_data = [&scene]() {
+        return scene.identity;
+    };
+    std::function<glm::mat4()> view_data = [&scene]() { return scene.view; };
+    std::function<glm::mat4()> proj_data = [&scene]() {
+        return scene.projection;
+    };
+    std::function<glm::vec4()> lp_data = [&scene]() { return scene.light; };
+    std::function<glm::vec3()> cam_data = [&scene]() { return scene.camera; };
+    std::function<float()> alpha_data = [&scene]() { return scene.alpha; };
+    auto model = make_uniform("model", model_data);
+    auto view = make_uniform("view", view_data);
+    auto projection = make_uniform("projection", proj_data);
+    auto light = make_uniform("light_position", lp_data);
+    auto camera = make_uniform("camera_position", cam_data);
+    auto alpha = make_uniform("alpha", alpha_data);
+
+    RenderDataInput floor_input;
+    floor_input.assign(0, "vertex_position", scene.floor_vertices.data(),
+                       scene.floor_vertices.size(), 4, GL_FLOAT);
+    floor_input.assignIndex(scene.floor_faces.data(),
+                            scene.floor_faces.size(), 3);
+    RenderDataInput object_input;
+    object_input.assign(0, "vertex_position", mesh.vertices.data(),
+                        mesh.vertices.size(), 4, GL_FLOAT);
+    object_input.assign(1, "normal", mesh.vertex_normals.data(),
+                        mesh.vertex_normals.size(), 4, GL_FLOAT);
+    object_input.assign(2, "uv", mesh.uv_coordinates.data(),
+                        mesh.uv_coordinates.size(), 2, GL_FLOAT);
+    object_input.assignIndex(mesh.faces.data(), mesh.faces.size(), 3);
+    object_input.useMaterials(mesh.materials);
+
+    double ms[2];
+    for (int gs = 0; gs < 2; gs++) {
+        const char* vs = gs ? vertex_shader : direct_vertex_shader;
+        const char* geom = gs ? geometry_shader : nullptr;
+        RenderPass floor_pass(-1, floor_input,
+                              {vs, geom, floor_fragment_shader},
+                              {model, view, projection, light},
+                              {"fragment_color"});
+        RenderPass object_pass(
+            -1, object_input, {vs, geom, fragment_shader},
+            {model, view, projection, light, camera, alpha},
+            {"fragment_color"});
+        ms[gs] = msPerFrame(window, [&]() {
+            floor_pass.setup();
+            CHECK_GL_ERROR(glDrawElements(GL_TRIANGLES,
+                                          scene.floor_faces.size() * 3,
+                                          GL_UNSIGNED_INT, 0));
+            object_pass.setup();
+            int mid = 0;
+            while (object_pass.renderWithMaterial(mid)) mid++;
+        });
+    }
+    std::printf("%-22s %7zu faces  gs %7.3f ms  direct %7.3f ms  %+6.1f%%\n",
+                name, mesh.faces.size(), ms[1], ms[0],
+                100.0 * (ms[0] - ms[1]) / ms[1]);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    GLFWwindow* window = createHiddenWindow();
+    if (!window) {
+        std::fprintf(stderr, "no OpenGL 4.1 context\n");
+        return 1;
+    }
+    std::printf("%s\n", glGetString(GL_RENDERER));
+    glViewport(0, 0, kWidth, kHeight);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    Scene scene;
+    create_floor(scene.floor_vertices, scene.floor_faces);
+    scene.view = glm::lookAt(scene.camera, glm::vec3(0.0f, 10.0f, 0.0f),
+                             glm::vec3(0.0f, 1.0f, 0.0f));
+    scene.projection = glm::perspective(glm::radians(45.0f),
+                                        float(kWidth) / kHeight, 0.1f, 1000.0f);
+    for (const char* name : kModels)
+        benchModel(window, scene, assetPath(argc, argv, name), name);
+
+    glfwDestroyWindow(window);
+    glfwTerminate();
+    return 0;
+}
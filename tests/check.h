@@ -0,0 +1,74 @@
+#ifndef TESTS_CHECK_H
+#define TESTS_CHECK_H
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+/*
+ * Minimal checks for the test executables: a failed check is reported and
+ * counted, and main returns checkFailures() != 0 so ctest sees it.
+ */
+inline int& checkFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,    \
+                         __LINE__, #cond);                                 \
+            checkFailures()++;                                             \
+        }                                                                  \
+    } while (0)
+
+#define CHECK_NEAR(a, b, eps)                                              \
+    do {                                                                   \
+        double a_ = (a), b_ = (b);                                         \
+        if (!(std::abs(a_ - b_) <= (eps))) {                               \
+            std::fprintf(stderr, "%s:%d: CHECK_NEAR(%s, %s) failed: %g vs " \
+                         "%g\n", __FILE__, __LINE__, #a, #b, a_, b_);      \
+            checkFailures()++;                                             \
+        }                                                                  \
+    } while (0)
+
+// Path of a bundled model, argv[1] is the model directory.
+inline std::string assetPath(int argc, char* argv[], const char* name) {
+    std::string dir = argc > 1 ? argv[1] : "assets/pmd";
+    return dir + "/" + name;
+}
+
+/*
+ * Fresh temporary directory for the model caches of this run, so that no
+ * test writes next to the bundled models. Emptied and removed at exit.
+ */
+inline const std::string& testCacheDir() {
+    static std::string dir;
+    if (dir.empty()) {
+        const char* tmp = getenv("TMPDIR");
+        std::string pattern =
+            std::string(tmp && *tmp ? tmp : "/tmp") + "/skinning_test.XXXXXX";
+        if (!mkdtemp(&pattern[0])) {
+            dir = ".";
+            return dir;
+        }
+        dir = pattern;
+        atexit([] {
+            const std::string& d = testCacheDir();
+            if (DIR* listing = opendir(d.c_str())) {
+                while (dirent* entry = readdir(listing))
+                    if (entry->d_name[0] != '.')
+                        std::remove((d + "/" + entry->d_name).c_str());
+                closedir(listing);
+            }
+            rmdir(d.c_str());
+        });
+    }
+    return dir;
+}
+
+#endif
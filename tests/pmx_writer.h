@@ -0,0 +1,76 @@
+#ifndef TESTS_PMX_WRITER_H
+#define TESTS_PMX_WRITER_H
+
+#include <stdint.h>
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+// Little endian PMX writer, just enough for the models the tests generate.
+class PmxWriter {
+   public:
+    PmxWriter(bool utf8, int vertex_index_size)
+        : utf8_(utf8), vertex_index_size_(vertex_index_size) {}
+
+    template <typename T>
+    void put(T x) {
+        const char* p = reinterpret_cast<const char*>(&x);
+        bytes_.insert(bytes_.end(), p, p + sizeof(T));
+    }
+    void floats(std::initializer_list<float> xs) {
+        for (float x : xs) put(x);
+    }
+    // code points, written as UTF-8 or as UTF-16 with surrogate pairs
+    void text(const std::u32string& s) {
+        std::string encoded;
+        for (char32_t c : s) {
+            if (utf8_) {
+                if (c < 0x80) {
+                    encoded += char(c);
+                } else if (c < 0x800) {
+                    encoded += char(0xC0 | (c >> 6));
+                    encoded += char(0x80 | (c & 0x3F));
+                } else if (c < 0x10000) {
+                    encoded += char(0xE0 | (c >> 12));
+                    encoded += char(0x80 | ((c >> 6) & 0x3F));
+                    encoded += char(0x80 | (c & 0x3F));
+                } else {
+                    encoded += char(0xF0 | (c >> 18));
+                    encoded += char(0x80 | ((c >> 12) & 0x3F));
+                    encoded += char(0x80 | ((c >> 6) & 0x3F));
+                    encoded += char(0x80 | (c & 0x3F));
+                }
+            } else {
+                auto unit = [&](uint32_t u) {
+                    encoded += char(u & 0xFF);
+                    encoded += char(u >> 8);
+                };
+                if (c >= 0x10000) {
+                    unit(0xD800 + ((c - 0x10000) >> 10));
+                    unit(0xDC00 + ((c - 0x10000) & 0x3FF));
+                } else {
+                    unit(c);
+                }
+            }
+        }
+        put(int32_t(encoded.size()));
+        bytes_.insert(bytes_.end(), encoded.begin(), encoded.end());
+    }
+    void vertexIndex(int i) {
+        if (vertex_index_size_ == 1)
+            put(uint8_t(i));
+        else if (vertex_index_size_ == 2)
+            put(uint16_t(i));
+        else
+            put(int32_t(i));
+    }
+    void boneIndex(int i) { put(int16_t(i)); }
+    const std::vector<char>& bytes() const { return bytes_; }
+
+   private:
+    bool utf8_;
+    int vertex_index_size_;
+    std::vector<char> bytes_;
+};
+
+#endif
@@ -0,0 +1,80 @@
+/*
+ * .anim round trip, and headers whose block offsets point outside the
+ * file.
+ */
+#include <stdint.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include "bone_geometry.h"
+#include "check.h"
+
+namespace {
+
+const size_t kRotationOffsetAt = 16;  // AnimationHeader::rotation_offset
+const size_t kRootOffsetAt = 24;      // AnimationHeader::root_offset
+
+std::string readFile(const std::string& fn) {
+    std::ifstream i(fn, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(i),
+                       std::istreambuf_iterator<char>());
+}
+
+void writeFile(const std::string& fn, const std::string& data) {
+    std::ofstream o(fn, std::ios::binary);
+    o.write(data.data(), data.size());
+}
+
+// The file with one header offset replaced.
+void patchOffset(const std::string& fn, const std::string& data, size_t at,
+                 uint64_t offset) {
+    std::string patched = data;
+    std::memcpy(&patched[at], &offset, sizeof(offset));
+    writeFile(fn, patched);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string model = assetPath(argc, argv, "Miku_Hatsune.pmd");
+    Mesh mesh;
+    mesh.setModelCacheDir(testCacheDir());
+    mesh.loadPmd(model);
+    glm::fquat step = glm::angleAxis(0.3f, glm::vec3(0.0f, 1.0f, 0.0f));
+    for (int k = 0; k < 3; k++) {
+        mesh.skeleton.rotate(k, step);
+        mesh.skeleton.translate(glm::vec3(0.1f * k, 0.0f, 0.0f));
+        mesh.constructKeyFrame();
+    }
+    const std::string fn = "test_animation_binary.anim";
+    mesh.saveAnimationTo(fn);
+
+    Mesh loaded;
+    loaded.setModelCacheDir(testCacheDir());
+    loaded.loadPmd(model);
+    loaded.loadAnimationFrom(fn);
+    CHECK(loaded.key_frames.size() == mesh.key_frames.size());
+    for (size_t f = 0; f < loaded.key_frames.size(); f++) {
+        CHECK(loaded.key_frames[f].rel_rot == mesh.key_frames[f].rel_rot);
+        CHECK(loaded.key_frames[f].root == mesh.key_frames[f].root);
+    }
+
+    // Offsets near 2^64 must not wrap around the bounds checks.
+    std::string data = readFile(fn);
+    const uint64_t far = std::numeric_limits<uint64_t>::max() - 15;
+    const uint64_t past = data.size() + 1;
+    for (size_t at : {kRotationOffsetAt, kRootOffsetAt}) {
+        for (uint64_t offset : {far, past}) {
+            patchOffset(fn, data, at, offset);
+            Mesh rejected;
+            rejected.setModelCacheDir(testCacheDir());
+            rejected.loadPmd(model);
+            rejected.loadAnimationFrom(fn);
+            CHECK(rejected.key_frames.empty());
+        }
+    }
+    std::remove(fn.c_str());
+    return checkFailures() != 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * AnimationClip against its source keys: packing may flip the sign of a
+ * key, sampling must still take the short way between neighbours.
+ */
+#include <glm/gtx/quaternion.hpp>
+#include "bone_geometry.h"
+#include "check.h"
+
+namespace {
+
+float angleBetween(const glm::fquat& a, const glm::fquat& b) {
+    return 2.0f * std::acos(std::min(1.0f, std::abs(glm::dot(a, b))));
+}
+
+}  // namespace
+
+int main() {
+    // q1 is in q0's hemisphere but its largest component is negative, so
+    // PackedQuat stores -q1.
+    glm::fquat q0 = glm::angleAxis(-1.4f, glm::vec3(0.0f, 0.0f, 1.0f));
+    glm::fquat q1 = glm::angleAxis(-1.8f, glm::vec3(0.0f, 0.0f, 1.0f));
+    CHECK(glm::dot(q0, q1) > 0.0f);
+    CHECK(glm::dot(q0, PackedQuat::pack(q1).unpack()) < 0.0f);
+    CHECK(angleBetween(PackedQuat::pack(q1).unpack(), q1) < 1e-3f);
+
+    // A linear turn over five keys reduces to its two ends.
+    std::vector<KeyFrame> keys(5);
+    for (int f = 0; f < 5; f++) {
+        keys[f].rel_rot.emplace_back(glm::slerp(q0, q1, f / 4.0f));
+        keys[f].root = glm::vec3(0.0f);
+    }
+    AnimationClip clip;
+    clip.compress(keys, 0.01f, 0.01f);
+    CHECK(clip.tracks[0].count == 2);
+
+    KeyFrame sampled;
+    for (int i = 0; i <= 16; i++) {
+        float t = i / 4.0f;
+        clip.sample(t, sampled);
+        glm::fquat expected = glm::slerp(q0, q1, t / 4.0f);
+        CHECK(angleBetween(sampled.rel_rot[0], expected) < 0.01f);
+    }
+    return checkFailures() != 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * animation.json through the SAX reader: a saved timeline must load back
+ * as the old DOM loader read it, and truncated or mistyped documents must
+ * be rejected without leaving partial key frames behind.
+ */
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include "bone_geometry.h"
+#include "check.h"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+namespace {
+
+const char kFile[] = "test_animation_json.json";
+
+void writeFile(const std::string& fn, const std::string& data) {
+    std::ofstream o(fn, std::ios::binary);
+    o.write(data.data(), data.size());
+}
+
+std::string readFile(const std::string& fn) {
+    std::ifstream i(fn, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(i),
+                       std::istreambuf_iterator<char>());
+}
+
+// The loader loadAnimationFrom had before it streamed, for comparison.
+std::vector<KeyFrame> domLoad(const std::string& fn) {
+    std::ifstream i(fn);
+    json json_load;
+    i >> json_load;
+    std::vector<KeyFrame> key_frames;
+    for (size_t i = 0; i < json_load.size(); i++) {
+        json a_frame = json_load[i];
+        json rotation = a_frame[0];
+        json translation = a_frame[1];
+        KeyFrame frame;
+        frame.root = glm::vec3(translation[0], translation[1], translation[2]);
+        for (size_t j = 0; j < rotation.size(); j++) {
+            json rot_joint = rotation[j];
+            glm::fquat rel_rotation = glm::fquat(rot_joint[3], rot_joint[0],
+                                                 rot_joint[1], rot_joint[2]);
+            frame.rel_rot.emplace_back(rel_rotation);
+        }
+        key_frames.emplace_back(frame);
+    }
+    return key_frames;
+}
+
+bool sameFrames(const std::vector<KeyFrame>& a,
+                const std::vector<KeyFrame>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t f = 0; f < a.size(); f++)
+        if (a[f].rel_rot != b[f].rel_rot || a[f].root != b[f].root)
+            return false;
+    return true;
+}
+
+class Loader {
+   public:
+    explicit Loader(const std::string& model) : model_(model) {}
+
+    // A fresh mesh with the given key frames, then the document loaded.
+    std::vector<KeyFrame> load(const std::string& document,
+                               const std::vector<KeyFrame>& before = {}) {
+        writeFile(kFile, document);
+        Mesh mesh;
+        mesh.setModelCacheDir(testCacheDir());
+        mesh.loadPmd(model_);
+        mesh.key_frames = before;
+        mesh.loadAnimationFrom(kFile);
+        return mesh.key_frames;
+    }
+
+   private:
+    std::string model_;
+};
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string model = assetPath(argc, argv, "Miku_Hatsune.pmd");
+    Mesh mesh;
+    mesh.setModelCacheDir(testCacheDir());
+    mesh.loadPmd(model);
+    glm::fquat step = glm::angleAxis(0.3f, glm::vec3(0.0f, 1.0f, 0.0f));
+    for (int k = 0; k < 3; k++) {
+        mesh.skeleton.rotate(k, step);
+        mesh.skeleton.translate(glm::vec3(0.1f * k, 0.0f, 0.0f));
+        mesh.constructKeyFrame();
+    }
+    mesh.saveAnimationTo(kFile);
+    const std::string saved = readFile(kFile);
+    const json document = json::parse(saved);
+    const int njoints = mesh.getNumberOfBones();
+    CHECK(document.size() == 3 && document[0][0].size() == size_t(njoints));
+
+    // A saved timeline loads back as saved and as the DOM loader read it.
+    Loader loader(model);
+    std::vector<KeyFrame> loaded = loader.load(saved);
+    CHECK(sameFrames(loaded, mesh.key_frames));
+    CHECK(sameFrames(loaded, domLoad(kFile)));
+
+    // Integers are numbers too, and the frames are appended to any there.
+    json integral = document;
+    integral[1][0][0] = {0, 0, 0, 1};
+    integral[1][1] = {1, -2, 3};
+    std::vector<KeyFrame> appended =
+        loader.load(integral.dump(), mesh.key_frames);
+    std::vector<KeyFrame> expected = mesh.key_frames;
+    for (const KeyFrame& frame : domLoad(kFile)) expected.emplace_back(frame);
+    CHECK(appended.size() == 6 && sameFrames(appended, expected));
+    CHECK(appended[4].root == glm::vec3(1.0f, -2.0f, 3.0f));
+    CHECK(loader.load("[]").empty());
+
+    // A truncated file keeps none of the frames it started.
+    for (size_t length : {size_t(1), saved.size() / 3, saved.size() / 2,
+                          saved.rfind(']')}) {
+        CHECK(loader.load(saved.substr(0, length)).empty());
+        CHECK(sameFrames(loader.load(saved.substr(0, length), mesh.key_frames),
+                         mesh.key_frames));
+    }
+
+    // Documents of the wrong shape are rejected the same way, here in the
+    // last frame so that the first two were already read.
+    std::vector<json> mistyped;
+    const json numbers[] = {"0.5", nullptr, true, json::object()};
+    for (const json& x : numbers) {
+        mistyped.emplace_back(document);
+        mistyped.back()[2][0][1][2] = x;
+        mistyped.emplace_back(document);
+        mistyped.back()[2][1][0] = x;
+    }
+    mistyped.emplace_back(document);  // a joint short
+    mistyped.back()[2][0].erase(njoints - 1);
+    mistyped.emplace_back(document);  // a joint too many
+    mistyped.back()[2][0].emplace_back(json::array({0, 0, 0, 1}));
+    mistyped.emplace_back(document);  // a rotation of 3 components
+    mistyped.back()[2][0][4].erase(3);
+    mistyped.emplace_back(document);  // a rotation of 5 components
+    mistyped.back()[2][0][4].emplace_back(0);
+    mistyped.emplace_back(document);  // a root of 2 components
+    mistyped.back()[2][1].erase(2);
+    mistyped.emplace_back(document);  // a root of 4 components
+    mistyped.back()[2][1].emplace_back(0);
+    mistyped.emplace_back(document);  // no root
+    mistyped.back()[2].erase(1);
+    mistyped.emplace_back(document);  // a third field
+    mistyped.back()[2].emplace_back(json::array({0, 0, 0}));
+    mistyped.emplace_back(document);  // a number for the rotations
+    mistyped.back()[2][0] = 1;
+    mistyped.emplace_back(document);  // a nested array for a component
+    mistyped.back()[2][1][1] = json::array({0});
+    for (const json& bad : mistyped) {
+        CHECK(loader.load(bad.dump()).empty());
+        CHECK(sameFrames(loader.load(bad.dump(), mesh.key_frames),
+                         mesh.key_frames));
+    }
+
+    // Anything but an array of frames at the top, or trailing text.
+    for (const char* bad : {"", "5", "\"frames\"", "null", "{}",
+                            "{\"frames\": []}", "[5]", "[] []"})
+        CHECK(loader.load(bad).empty());
+    CHECK(loader.load(saved + "]").empty());
+
+    std::remove(kFile);
+    return checkFailures() != 0;
+}
@@ -0,0 +1,79 @@
+/*
+ * A baked animation with IK must not depend on how the frames were split
+ * between threads, and playing it must leave the skeleton in the pose of
+ * the palette, as picking and editing read the skeleton.
+ */
+#include <algorithm>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "bone_geometry.h"
+#include "check.h"
+
+namespace {
+
+// Skinning palettes of 90 baked frames.
+std::vector<glm::mat4> bake(const std::string& fn, int threads) {
+#ifdef _OPENMP
+    omp_set_num_threads(threads);
+#endif
+    Mesh mesh;
+    mesh.setModelCacheDir(testCacheDir());
+    mesh.loadPmd(fn);
+    glm::fquat step = glm::angleAxis(0.3f, glm::vec3(0.0f, 0.0f, 1.0f));
+    for (int k = 0; k < 4; k++) {
+        for (int j = 0; j < mesh.getNumberOfBones(); j += 3)
+            mesh.skeleton.rotate(j, step);
+        mesh.constructKeyFrame();
+    }
+    mesh.setIK(true);
+    mesh.setBaked(true);
+
+    std::vector<glm::mat4> palettes;
+    float stale = 0.0f;
+    for (int f = 0; f < 90; f++) {
+        mesh.updateAnimation(f / 30.0f);
+        const auto& skin = mesh.getCurrentQ()->skin;
+        palettes.insert(palettes.end(), skin.begin(), skin.end());
+
+        // The world transforms must be those of the baked palette and of
+        // the local pose left in the skeleton.
+        Skeleton evaluated = mesh.skeleton;
+        evaluated.markAllDirty();
+        evaluated.evaluate();
+        for (int j = 0; j < mesh.getNumberOfBones(); j++) {
+            int s = mesh.skeleton.slot_of_joint[j];
+            glm::mat4 posed = mesh.skeleton.getTransform(j);
+            glm::mat4 palette =
+                skin[j] * glm::inverse(mesh.skeleton.inverse_bind[s]);
+            for (int c = 0; c < 4; c++)
+                stale = std::max(
+                    stale, std::max(glm::length(posed[c] - palette[c]),
+                                    glm::length(posed[c] -
+                                                evaluated.world[s][c])));
+        }
+    }
+    std::printf("skeleton off the baked pose by up to %g\n", stale);
+    CHECK(stale < 1e-3f);
+    return palettes;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string fn = assetPath(argc, argv, "Miku_Hatsune.pmd");
+    std::vector<glm::mat4> serial = bake(fn, 1);
+    for (int threads : {3, 8}) {
+        std::vector<glm::mat4> parallel = bake(fn, threads);
+        CHECK(parallel.size() == serial.size());
+        float diff = 0.0f;
+        for (size_t i = 0; i < std::min(serial.size(), parallel.size()); i++)
+            for (int c = 0; c < 4; c++)
+                diff = std::max(
+                    diff, glm::length(serial[i][c] - parallel[i][c]));
+        std::printf("%d threads: max difference %g\n", threads, diff);
+        CHECK(diff == 0.0f);
+    }
+    return checkFailures() != 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * CpuSkinner: the SSE blends against the scalar reference on a posed
+ * model, the bind pose reproducing the model, and an SDEF vertex against
+ * its position worked out by hand.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include "bone_geometry.h"
+#include "check.h"
+#include "config.h"
+#include "cpu_skinning.h"
+#include "pmx_writer.h"
+
+namespace {
+
+// Largest distance between matching points.
+float maxDistance(const std::vector<glm::vec4>& a,
+                  const std::vector<glm::vec4>& b) {
+    float d = 0.0f;
+    for (size_t i = 0; i < std::min(a.size(), b.size()); i++)
+        d = std::max(d, glm::length(a[i] - b[i]));
+    return d;
+}
+
+/*
+ * Bone 0 at the origin, bone 1 at (0, 1, 0) below it. Vertex 0 at
+ * (1, 1, 0) is SDEF between them at weights 1/2 with C = (0, 1, 0),
+ * R0 = (0, 1, 0) and R1 = (0, 3, 0), which the loader corrects to (0, 0, 0)
+ * and (0, 2, 0) so that their mean is C. Vertex 3 sits at C with the same
+ * C, R0 and R1 at weights 3/4 and 1/4, corrected to (0, 0.5, 0) and
+ * (0, 2.5, 0). Vertices 1 and 2 at (0, 0, 0) and (0, 2, 0) follow bone 0
+ * and bone 1 alone.
+ */
+std::string writeSdefModel(const std::string& fn) {
+    PmxWriter w(true, 4);
+    const char magic[] = {'P', 'M', 'X', ' '};
+    for (char c : magic) w.put(c);
+    w.put(2.0f);
+    w.put(uint8_t(8));
+    for (int g : {1, 0, 4, 1, 1, 2, 1, 1}) w.put(uint8_t(g));
+    for (int i = 0; i < 4; i++) w.text(U"");
+
+    auto sdef = [&w](float x, float w0) {
+        w.floats({x, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f});
+        w.put(uint8_t(3));  // SDEF
+        w.boneIndex(0);
+        w.boneIndex(1);
+        w.put(w0);
+        w.floats({0.0f, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 3.0f, 0.0f});
+        w.put(1.0f);  // edge scale
+    };
+    w.put(int32_t(4));
+    sdef(1.0f, 0.5f);
+    for (int i = 1; i < 3; i++) {
+        w.floats({0.0f, 2.0f * (i - 1), 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f});
+        w.put(uint8_t(0));  // BDEF1
+        w.boneIndex(i - 1);
+        w.put(1.0f);
+    }
+    sdef(0.0f, 0.75f);
+    w.put(int32_t(6));
+    for (int i : {0, 1, 2, 3, 1, 2}) w.vertexIndex(i);
+    w.put(int32_t(0));  // textures
+    w.put(int32_t(0));  // materials
+
+    w.put(int32_t(2));
+    for (int i = 0; i < 2; i++) {
+        w.text(i == 0 ? U"センター" : U"b1");
+        w.text(U"bone");
+        w.floats({0.0f, float(i), 0.0f});
+        w.boneIndex(i - 1);
+        w.put(int32_t(0));        // layer
+        w.put(uint16_t(0x000A));  // rotatable, visible, tail by offset
+        w.floats({0.0f, 1.0f, 0.0f});
+    }
+    for (int i = 0; i < 4; i++) w.put(int32_t(0));  // morphs to joints
+    std::ofstream out(fn, std::ios::binary | std::ios::trunc);
+    out.write(w.bytes().data(), w.bytes().size());
+    return fn;
+}
+
+/*
+ * Bone 1 turned a quarter around z. With r0 the identity and r1 that turn
+ * the blended rotation is an eighth turn r. The midpoints c0 = (0, 0.5, 0)
+ * and c1 = (0, 1.5, 0) go to p0 = c0 and p1 = (-0.5, 1, 0), so vertex 0
+ * lands at r (v - C) + (p0 + p1) / 2
+ *   = (s, s, 0) + (-0.25, 0.75, 0), s = sqrt(1/2)
+ * and its normal (1, 0, 0) turns to (s, s, 0). At C vertex 3 only moves
+ * with its midpoints (0, 0.75, 0) and (0, 1.75, 0), to
+ *   3/4 (0, 0.75, 0) + 1/4 (-0.75, 1, 0) = (-0.1875, 0.8125, 0).
+ * Vertex 2 turns around bone 1 to (-1, 1, 0). The weights are unorm16, 1/2
+ * is off by 1e-5.
+ */
+void checkSdef() {
+    const std::string fn = "test_cpu_skinning.pmx";
+    Mesh mesh;
+    mesh.setModelCacheDir(testCacheDir());
+    mesh.loadPmd(writeSdefModel(fn));
+    std::remove(fn.c_str());
+    CHECK(mesh.vertices.size() == 4 && mesh.getSkinVariant(0) == kSkinSdef);
+    if (mesh.vertices.size() != 4) return;
+    mesh.skeleton.setRelOrientation(
+        1, glm::angleAxis(0.5f * glm::pi<float>(), glm::vec3(0, 0, 1)));
+    mesh.refreshPose();
+
+    const float s = std::sqrt(0.5f);
+    const glm::vec3 expected[] = {
+        glm::vec3(s - 0.25f, s + 0.75f, 0.0f), glm::vec3(0.0f),
+        glm::vec3(-1.0f, 1.0f, 0.0f), glm::vec3(-0.1875f, 0.8125f, 0.0f)};
+    const SkinningMode modes[] = {SkinningMode::kLinearBlend,
+                                  SkinningMode::kDualQuaternion};
+    for (SkinningMode mode : modes) {
+        CpuSkinner skinner;
+        skinner.skin(mesh, *mesh.getCurrentQ(), mode);
+        for (int v = 0; v < 4; v++)
+            for (int k = 0; k < 3; k++)
+                CHECK_NEAR(skinner.positions()[v][k], expected[v][k], 1e-4f);
+        CHECK_NEAR(skinner.normals()[0].x, s, 1e-4f);
+        CHECK_NEAR(skinner.normals()[0].y, s, 1e-4f);
+        CHECK_NEAR(skinner.normals()[0].z, 0.0f, 1e-4f);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    Mesh mesh;
+    mesh.setModelCacheDir(testCacheDir());
+    mesh.loadPmd(assetPath(argc, argv, "Miku_Hatsune.pmd"));
+    CpuSkinner simd, scalar;
+    scalar.setVectorized(false);
+    CHECK(!scalar.isVectorized());
+
+    mesh.refreshPose();
+    scalar.skin(mesh, *mesh.getCurrentQ(), SkinningMode::kLinearBlend);
+    CHECK(scalar.positions().size() == mesh.vertices.size());
+    CHECK(maxDistance(scalar.positions(), mesh.vertices) < 1e-4f);
+
+    for (int j = 0; j < mesh.getNumberOfBones(); j += 2) {
+        glm::vec3 axis = glm::normalize(glm::vec3(j % 3, 1.0f, j % 5));
+        mesh.skeleton.rotate(j, glm::angleAxis(0.1f * (j % 7), axis));
+    }
+    mesh.skeleton.translate(glm::vec3(0.3f, 0.0f, -0.2f));
+    mesh.refreshPose();
+
+    const SkinningMode modes[] = {SkinningMode::kLinearBlend,
+                                  SkinningMode::kDualQuaternion};
+    for (SkinningMode mode : modes) {
+        simd.skin(mesh, *mesh.getCurrentQ(), mode);
+        scalar.skin(mesh, *mesh.getCurrentQ(), mode);
+        float dv = maxDistance(simd.positions(), scalar.positions());
+        float dn = maxDistance(simd.normals(), scalar.normals());
+        std::printf("%s: simd %d, max position difference %g, normal %g\n",
+                    mode == SkinningMode::kLinearBlend ? "linear" : "dual",
+                    simd.isVectorized(), dv, dn);
+        CHECK(dv < 1e-4f);
+        CHECK(dn < 1e-4f);
+        // The pose has to move the model, or the comparison proves nothing.
+        CHECK(maxDistance(scalar.positions(), mesh.vertices) > 1.0f);
+    }
+    checkSdef();
+    return checkFailures() != 0;
+}
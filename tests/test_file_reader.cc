@@ -0,0 +1,88 @@
+/*
+ * mmd::FileReader on a mapped file and on a pipe: both must see the bytes
+ * of the file, views must outlive GetBuffer, and the PMD indices decoded
+ * from their unaligned block must match the triangles of the model.
+ */
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fstream>
+#include <iterator>
+#include "check.h"
+#include "mmd/mmdslim.hh"
+
+namespace {
+
+std::vector<std::uint8_t> slurp(const std::string& fn) {
+    std::ifstream in(fn, std::ios::binary);
+    return std::vector<std::uint8_t>(std::istreambuf_iterator<char>(in),
+                                     std::istreambuf_iterator<char>());
+}
+
+bool sameBytes(mmd::array_view<std::uint8_t> view,
+               const std::vector<std::uint8_t>& bytes) {
+    return view.size() == bytes.size() &&
+           std::equal(view.begin(), view.end(), bytes.begin());
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    std::string fn = assetPath(argc, argv, "KAITO.pmd");
+    std::vector<std::uint8_t> bytes = slurp(fn);
+    CHECK(!bytes.empty());
+
+    // Mapped: a view taken before GetBuffer stays readable after it.
+    mmd::FileReader mapped(fn);
+    CHECK(mapped.GetLength() == bytes.size());
+    mmd::array_view<std::uint8_t> view =
+        mapped.ReadArray<std::uint8_t>(bytes.size());
+    CHECK(sameBytes(view, bytes));
+    bool threw = false;
+    try {
+        mapped.ReadArray<std::uint8_t>(1);
+    } catch (const mmd::exception&) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(mapped.GetBuffer() == bytes);
+    CHECK(sameBytes(view, bytes));
+    mapped.Reset();
+    CHECK(sameBytes(mapped.ReadArray<std::uint8_t>(bytes.size()), bytes));
+
+    // A pipe has no length to map, it is read in chunks.
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    pid_t writer = fork();
+    if (writer == 0) {
+        close(fds[0]);
+        size_t done = 0;
+        while (done < bytes.size()) {
+            ssize_t n = write(fds[1], bytes.data() + done, bytes.size() - done);
+            if (n <= 0) break;
+            done += n;
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    mmd::FileReader piped("/proc/self/fd/" + std::to_string(fds[0]));
+    waitpid(writer, nullptr, 0);
+    close(fds[0]);
+    CHECK(sameBytes(piped.ReadArray<std::uint8_t>(bytes.size()), bytes));
+
+    // Decoded indices against the triangles of the full read.
+    mmd::FileReader file(fn);
+    mmd::Model model, slim;
+    mmd::PmdReader(file).ReadModel(model);
+    mmd::PmdGeometry geometry;
+    mmd::PmdReader(file).ReadModel(slim, geometry);
+    CHECK(uintptr_t(geometry.index_block.data()) % 2 == 1);
+    CHECK(geometry.GetIndexNum() == 3 * model.GetTriangleNum());
+    CHECK(slim.GetTriangleNum() == 0);
+    bool same = true;
+    for (size_t i = 0; i < model.GetTriangleNum(); i++)
+        for (int k = 0; k < 3; k++)
+            same = same && geometry.DecodeIndex(3 * i + k) ==
+                               model.GetTriangle(i).v[k];
+    CHECK(same);
+    return checkFailures() != 0;
+}
@@ -0,0 +1,87 @@
+/*
+ * The closed form for two link chains against CCD on a leg: for the same
+ * goals both must reach it with the same knee bend. None of the bundled
+ * models keeps a two link chain, so the leg is built here.
+ */
+#include <mmdadapter.h>
+#include <vector>
+#include "bone_geometry.h"
+#include "check.h"
+
+namespace {
+
+enum { kRoot, kHip, kKnee, kAnkle, kGoal };
+
+// Hip, knee and ankle, the knee limited to bend one way like MMD's.
+void buildLeg(Skeleton& skeleton, IKChain& chain) {
+    skeleton.joints = {Joint(kRoot, glm::vec3(0.0f), -1),
+                       Joint(kHip, glm::vec3(1.0f, 10.0f, 0.0f), kRoot),
+                       Joint(kKnee, glm::vec3(1.0f, 5.0f, -0.2f), kHip),
+                       Joint(kAnkle, glm::vec3(1.0f, 0.5f, 0.0f), kKnee),
+                       Joint(kGoal, glm::vec3(1.0f, 0.5f, 0.0f), kRoot)};
+    skeleton.construct();
+
+    chain.goal = kGoal;
+    chain.target = kAnkle;
+    chain.links = {kKnee, kHip};
+    chain.limited = {true, false};
+    chain.lo = {glm::vec3(-3.14f, 0.0f, 0.0f), glm::vec3(0.0f)};
+    chain.hi = {glm::vec3(-0.01f, 0.0f, 0.0f), glm::vec3(0.0f)};
+    chain.iterations = 500;
+    chain.angle_limit = 0.5f;
+}
+
+struct Solution {
+    glm::vec3 target;
+    float knee;  // angle of the knee hinge
+};
+
+// Solve the leg from the bind pose with its goal moved by delta.
+Solution solveFromBind(Skeleton& skeleton, const glm::vec3& delta,
+                       bool closed_form) {
+    IKSolver& ik = skeleton.ik;
+    for (glm::fquat& q : skeleton.local_rot)
+        q = glm::fquat(1.0f, 0.0f, 0.0f, 0.0f);
+    skeleton.markAllDirty();
+    skeleton.evaluate();
+    ik.setClosedForm(closed_form);
+    ik.setEnabled(true);  // drops the warm start
+    ik.moveGoal(0, delta);
+    ik.solve(skeleton, IKBudget());
+    ik.moveGoal(0, -delta);
+    skeleton.evaluate();
+    const glm::fquat& q = skeleton.getRelOrientation(kKnee);
+    return {skeleton.getPosition(kAnkle), 2.0f * std::atan2(q.x, q.w)};
+}
+
+}  // namespace
+
+int main() {
+    Skeleton skeleton;
+    IKChain chain;
+    buildLeg(skeleton, chain);
+    skeleton.ik.load({chain}, skeleton);
+    CHECK(skeleton.ik.size() == 1);
+    if (skeleton.ik.size() != 1) return 1;
+    CHECK(skeleton.ik.isTwoBone(0));
+
+    // Reachable goals: lifted, stepped forward, back and aside.
+    const glm::vec3 deltas[] = {
+        glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 2.0f, -1.5f),
+        glm::vec3(0.5f, 1.5f, 1.0f), glm::vec3(-0.4f, 3.0f, -0.5f),
+        glm::vec3(0.0f, 6.0f, 2.0f)};
+    for (const glm::vec3& delta : deltas) {
+        glm::vec3 goal = skeleton.getPosition(kGoal) + delta;
+        Solution closed = solveFromBind(skeleton, delta, true);
+        Solution ccd = solveFromBind(skeleton, delta, false);
+        float closed_error = glm::length(closed.target - goal);
+        float ccd_error = glm::length(ccd.target - goal);
+        std::printf("error closed form %g, CCD %g, knee %g vs %g\n",
+                    closed_error, ccd_error, closed.knee, ccd.knee);
+        CHECK(closed_error < 1e-2f);
+        CHECK(ccd_error < 1e-2f);
+        CHECK(closed_error <= ccd_error);
+        CHECK_NEAR(closed.knee, ccd.knee, 1e-2f);
+    }
+    return checkFailures() != 0;
+}
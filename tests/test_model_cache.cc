@@ -0,0 +1,304 @@
+/*
+ * Model cache round trip on copies of bundled models in the working
+ * directory:
+ * a cached load must equal a parsed one, a changed model must not use the
+ * old cache, and a cache whose ids point out of their arrays, or whose
+ * enums hold no value of theirs, must be rejected and rewritten rather
+ * than loaded. The cache goes where setModelCacheDir says, or nowhere.
+ */
+#include <sys/stat.h>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <map>
+#include "bone_geometry.h"
+#include "check.h"
+
+namespace {
+
+const size_t kHeaderSize = 24;
+
+std::vector<char> slurp(const std::string& fn) {
+    std::ifstream in(fn, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(in),
+                             std::istreambuf_iterator<char>());
+}
+
+void spit(const std::string& fn, const std::vector<char>& bytes) {
+    std::ofstream out(fn, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+}
+
+template <typename T>
+void poke(std::vector<char>& bytes, size_t at, T x) {
+    std::memcpy(&bytes[at], &x, sizeof(T));
+}
+
+// Offsets of the fields the corruptions below patch, found by walking the
+// sections in the order saveModelCache writes them.
+struct Layout {
+    size_t vertex0 = 0;
+    size_t texture0_height = 0;
+    size_t material0_offset = 0, material0_nfaces = 0;
+    size_t joint1_parent = 0;
+    size_t chain0_goal = 0, chain0_link0 = 0;
+    size_t morph0_vid0 = 0;
+    size_t body0_joint = 0, body0_shape = 0, body0_type = 0;
+    size_t constraint0_body1 = 0;
+    uint64_t textures = 0, chains = 0, morphs = 0, bodies = 0,
+             constraints = 0;
+
+    explicit Layout(const std::vector<char>& b) {
+        size_t at = kHeaderSize;
+        auto count = [&]() {
+            uint64_t n;
+            std::memcpy(&n, &b[at], sizeof(n));
+            at += sizeof(n);
+            return n;
+        };
+        auto skipArray = [&](size_t element) { at += count() * element; };
+
+        vertex0 = at + 8;
+        for (size_t element : {16, 16, 8, 12, 8, 8, 16}) skipArray(element);
+        textures = count();
+        for (uint64_t i = 0; i < textures; i++) {
+            if (i == 0) texture0_height = at + 4;
+            at += 12;
+            skipArray(1);
+        }
+        uint64_t materials = count();
+        material0_offset = at + 3 * 16 + 4;
+        material0_nfaces = material0_offset + 8;
+        at += materials * (3 * 16 + 4 + 8 + 8 + 4);
+        uint64_t joints = count();
+        for (uint64_t i = 0; i < joints; i++) {
+            if (i == 1) joint1_parent = at + 12;
+            at += 16;
+            skipArray(4);
+        }
+        chains = count();
+        for (uint64_t i = 0; i < chains; i++) {
+            if (i == 0) chain0_goal = at;
+            at += 16;
+            if (i == 0) chain0_link0 = at + 8;
+            for (size_t element : {4, 1, 12, 12}) skipArray(element);
+        }
+        morphs = count();
+        for (uint64_t i = 0; i < morphs; i++) {
+            skipArray(1);
+            at += 4;
+            if (i == 0) morph0_vid0 = at + 8;
+            skipArray(4);
+            skipArray(12);
+        }
+        body0_joint = at + 8 + offsetof(RigidBody, joint);
+        body0_shape = at + 8 + offsetof(RigidBody, shape);
+        body0_type = at + 8 + offsetof(RigidBody, type);
+        bodies = count();
+        at += bodies * sizeof(RigidBody);
+        constraint0_body1 = at + 8 + offsetof(SpringConstraint, body) + 4;
+        constraints = count();
+    }
+};
+
+bool sameModel(const Mesh& a, const Mesh& b) {
+    bool same = a.vertices == b.vertices && a.faces == b.faces &&
+                a.vertex_normals == b.vertex_normals &&
+                a.joint_ids == b.joint_ids &&
+                a.joint_weights == b.joint_weights &&
+                a.materials.size() == b.materials.size() &&
+                a.skeleton.joints.size() == b.skeleton.joints.size() &&
+                a.skeleton.ik.size() == b.skeleton.ik.size() &&
+                a.morphs.size() == b.morphs.size() &&
+                a.rigid_bodies.size() == b.rigid_bodies.size() &&
+                a.spring_constraints.size() == b.spring_constraints.size();
+    for (size_t i = 0; same && i < a.materials.size(); i++) {
+        const Material& m = a.materials[i];
+        const Material& n = b.materials[i];
+        same = m.offset == n.offset && m.nfaces == n.nfaces &&
+               m.diffuse == n.diffuse && bool(m.texture) == bool(n.texture);
+        if (same && m.texture)
+            same = m.texture->bytes == n.texture->bytes &&
+                   m.texture->width == n.texture->width &&
+                   m.texture->height == n.texture->height;
+    }
+    for (size_t j = 0; same && j < a.skeleton.joints.size(); j++) {
+        const Joint& x = a.skeleton.joints[j];
+        const Joint& y = b.skeleton.joints[j];
+        same = x.init_position == y.init_position &&
+               x.parent_index == y.parent_index && x.name == y.name;
+    }
+    return same;
+}
+
+/*
+ * Run every check on a copy of the model and its texture, the bundled
+ * assets stay untouched. Counts the corruptions the model had the
+ * sections for.
+ */
+void checkModel(int argc, char* argv[], const char* name,
+                const char* texture, std::map<std::string, int>& exercised) {
+    mkdir("model_cache_test", 0755);
+    std::string fn = std::string("model_cache_test/") + name;
+    std::string cache_fn = fn + ".cache";
+    std::vector<char> model = slurp(assetPath(argc, argv, name));
+    CHECK(!model.empty());
+    spit(fn, model);
+    if (texture)
+        spit(std::string("model_cache_test/") + texture,
+             slurp(assetPath(argc, argv, texture)));
+    std::remove(cache_fn.c_str());
+
+    Mesh parsed;
+    parsed.loadPmd(fn);
+    std::vector<char> good = slurp(cache_fn);
+    CHECK(good.size() > kHeaderSize);
+    if (good.size() <= kHeaderSize) return;
+
+    Mesh cached;
+    cached.loadPmd(fn);
+    CHECK(sameModel(parsed, cached));
+
+    // The cache is what got loaded: a patched vertex shows up.
+    std::vector<char> patched = good;
+    Layout layout(good);
+    poke(patched, layout.vertex0, 1234.5f);
+    spit(cache_fn, patched);
+    Mesh from_patched;
+    from_patched.loadPmd(fn);
+    CHECK(from_patched.vertices[0].x == 1234.5f);
+
+    // A changed model is parsed again and gets a new cache. The last byte
+    // of the PMD comment changes the hash, not what gets parsed.
+    const size_t kCommentEnd = 3 + 4 + 20 + 256 - 1;
+    std::vector<char> changed = model;
+    changed[kCommentEnd] ^= 1;
+    spit(fn, changed);
+    Mesh stale;
+    stale.loadPmd(fn);
+    CHECK(sameModel(parsed, stale));
+    std::vector<char> rewritten = slurp(cache_fn);
+    CHECK(rewritten.size() == good.size() &&
+          !std::equal(good.begin() + 16, good.begin() + kHeaderSize,
+                      rewritten.begin() + 16));
+    spit(fn, model);
+    spit(cache_fn, good);
+
+    size_t nfaces = parsed.faces.size();
+    int32_t njoints = parsed.skeleton.joints.size();
+    struct Corruption {
+        const char* name;
+        bool present;
+        std::function<void(std::vector<char>&)> apply;
+    } corruptions[] = {
+        {"texture larger than its bytes", layout.textures > 0,
+         [&](std::vector<char>& b) {
+             poke(b, layout.texture0_height, int32_t(1 << 20));
+         }},
+        {"material past the faces", true,
+         [&](std::vector<char>& b) {
+             poke(b, layout.material0_nfaces, uint64_t(nfaces + 1));
+         }},
+        {"material offset overflow", true,
+         [&](std::vector<char>& b) {
+             poke(b, layout.material0_offset, uint64_t(1));
+             poke(b, layout.material0_nfaces, ~uint64_t(0));
+         }},
+        {"negative joint parent", true,
+         [&](std::vector<char>& b) {
+             poke(b, layout.joint1_parent, int32_t(-5));
+         }},
+        {"joint its own parent", true,
+         [&](std::vector<char>& b) {
+             poke(b, layout.joint1_parent, int32_t(1));
+         }},
+        {"IK goal out of range", layout.chains > 0,
+         [&](std::vector<char>& b) {
+             poke(b, layout.chain0_goal, njoints);
+         }},
+        {"IK link out of range", layout.chains > 0,
+         [&](std::vector<char>& b) {
+             poke(b, layout.chain0_link0, int32_t(-1));
+         }},
+        {"morph vertex out of range", layout.morphs > 0,
+         [&](std::vector<char>& b) {
+             poke(b, layout.morph0_vid0, int32_t(parsed.vertices.size()));
+         }},
+        {"rigid body joint out of range", layout.bodies > 0,
+         [&](std::vector<char>& b) {
+             poke(b, layout.body0_joint, njoints);
+         }},
+        {"rigid body shape unknown", layout.bodies > 0,
+         [&](std::vector<char>& b) {
+             poke(b, layout.body0_shape, int32_t(RigidBody::kCapsule + 1));
+         }},
+        {"rigid body type negative", layout.bodies > 0,
+         [&](std::vector<char>& b) {
+             poke(b, layout.body0_type, int32_t(-1));
+         }},
+        {"constraint body out of range", layout.constraints > 0,
+         [&](std::vector<char>& b) {
+             poke(b, layout.constraint0_body1, int32_t(layout.bodies));
+         }},
+    };
+    for (const Corruption& c : corruptions) {
+        if (!c.present) continue;
+        // The patched vertex tells a loaded cache from a parsed model.
+        std::vector<char> bad = patched;
+        c.apply(bad);
+        spit(cache_fn, bad);
+        Mesh mesh;
+        mesh.loadPmd(fn);
+        bool rejected = sameModel(parsed, mesh) && slurp(cache_fn) == good;
+        std::printf("%-22s %-30s %s\n", name, c.name,
+                    rejected ? "rejected" : "LOADED");
+        CHECK(rejected);
+        exercised[c.name]++;
+    }
+}
+
+bool exists(const std::string& fn) {
+    struct stat st;
+    return stat(fn.c_str(), &st) == 0;
+}
+
+// A set cache directory gets the cache, a disabled cache is never written.
+void checkLocation(int argc, char* argv[]) {
+    mkdir("model_cache_test", 0755);
+    mkdir("model_cache_test/dir", 0755);
+    std::string fn = "model_cache_test/Miku_Hatsune.pmd";
+    spit(fn, slurp(assetPath(argc, argv, "Miku_Hatsune.pmd")));
+    std::string beside = fn + ".cache";
+    std::string in_dir = "model_cache_test/dir/Miku_Hatsune.pmd.cache";
+    std::remove(beside.c_str());
+    std::remove(in_dir.c_str());
+
+    Mesh disabled;
+    disabled.setModelCache(false);
+    disabled.loadPmd(fn);
+    CHECK(!disabled.vertices.empty());
+    CHECK(!exists(beside) && !exists(in_dir));
+
+    Mesh parsed, cached;
+    parsed.setModelCacheDir("model_cache_test/dir");
+    parsed.loadPmd(fn);
+    CHECK(exists(in_dir) && !exists(beside));
+    cached.setModelCacheDir("model_cache_test/dir");
+    cached.loadPmd(fn);
+    CHECK(sameModel(parsed, cached));
+    CHECK(sameModel(disabled, cached));
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    // KAITO has a texture, Miku has the rigid bodies and constraints.
+    std::map<std::string, int> exercised;
+    checkModel(argc, argv, "KAITO.pmd", "eyeKT.bmp", exercised);
+    checkModel(argc, argv, "Miku_Hatsune.pmd", nullptr, exercised);
+    CHECK(exercised.size() == 12);
+    checkLocation(argc, argv);
+    return checkFailures() != 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * MorphSet::apply on hand-made morphs: the reported range must cover every
+ * vertex the current and the previous weights move, and nothing may be
+ * reported when no weight changed.
+ */
+#include <mmdadapter.h>
+#include "check.h"
+#include "config.h"
+#include "morph_set.h"
+
+namespace {
+
+const size_t kVertices = 20;
+
+VertexMorph makeMorph(const char* name, std::vector<int> vid) {
+    VertexMorph vm;
+    vm.name = name;
+    vm.vid = vid;
+    for (int v : vid) vm.offset.emplace_back(glm::vec3(v, 1.0f, 0.0f));
+    return vm;
+}
+
+// Displacement the weights should give every vertex.
+glm::vec4 expected(const std::vector<VertexMorph>& vms,
+                   const std::vector<float>& weights, size_t vertex) {
+    glm::vec4 d(0.0f);
+    for (size_t m = 0; m < vms.size(); m++)
+        for (size_t k = 0; k < vms[m].vid.size(); k++)
+            if (size_t(vms[m].vid[k]) == vertex)
+                d += weights[m] * glm::vec4(vms[m].offset[k], 0.0f);
+    return d;
+}
+
+void checkDisplacement(const MorphSet& set,
+                       const std::vector<VertexMorph>& vms,
+                       const std::vector<float>& weights) {
+    for (size_t v = 0; v < kVertices; v++) {
+        glm::vec4 d = expected(vms, weights, v);
+        for (int i = 0; i < 4; i++)
+            CHECK_NEAR(set.getDisplacement(v)[i], d[i], 1e-6f);
+    }
+}
+
+}  // namespace
+
+int main() {
+    // Unsorted vertices, and one out of range that load() drops.
+    std::vector<VertexMorph> vms = {makeMorph("a", {7, 3, 5}),
+                                    makeMorph("b", {12, 15}),
+                                    makeMorph("c", {4, 40})};
+    MorphSet set;
+    set.load(vms, kVertices);
+    vms[2].vid.pop_back();
+    vms[2].offset.pop_back();
+    CHECK(set.size() == 3);
+    CHECK(set.find("b") == 1);
+    CHECK(set.find("z") == -1);
+
+    size_t first = 99, last = 99;
+    CHECK(!set.apply(first, last));
+
+    std::vector<float> w = {0.5f, 0.0f, 0.0f};
+    set.setWeight(0, w[0]);
+    CHECK(set.apply(first, last));
+    CHECK(first == 3 && last == 8);
+    checkDisplacement(set, vms, w);
+    CHECK(!set.apply(first, last));
+
+    // Setting the same weight again is not a change.
+    set.setWeight(0, w[0]);
+    CHECK(!set.apply(first, last));
+
+    // Switching a to b has to reset a's range as well.
+    w = {0.0f, 1.0f, 0.0f};
+    set.setWeight(0, w[0]);
+    set.setWeight(1, w[1]);
+    CHECK(set.apply(first, last));
+    CHECK(first == 3 && last == 16);
+    checkDisplacement(set, vms, w);
+
+    // Only b is active now, c extends it downwards.
+    w = {0.0f, 1.0f, 0.75f};
+    set.setWeight(2, w[2]);
+    CHECK(set.apply(first, last));
+    CHECK(first == 4 && last == 16);
+    checkDisplacement(set, vms, w);
+
+    // Dropping everything returns the last active range to rest.
+    set.clearWeights();
+    w = {0.0f, 0.0f, 0.0f};
+    CHECK(set.apply(first, last));
+    CHECK(first == 4 && last == 16);
+    checkDisplacement(set, vms, w);
+
+    // Nothing is displaced, so a change below the epsilon moves nothing.
+    set.setWeight(1, 1e-6f);
+    CHECK(!set.apply(first, last));
+
+    // Weights are kept within [0, kMaxMorphWeight].
+    set.setWeight(0, kMaxMorphWeight + 1.0f);
+    CHECK(set.getWeight(0) == kMaxMorphWeight);
+    set.setWeight(0, -1.0f);
+    CHECK(set.getWeight(0) == 0.0f);
+
+    return checkFailures() != 0;
+}
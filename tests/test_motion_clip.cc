@@ -0,0 +1,114 @@
+/*
+ * MotionCurve and MotionClip::sample against values worked out by hand:
+ * a Bezier segment between two keys, the end keys held outside them and
+ * joints without keys at the bind pose.
+ */
+#include <mmdadapter.h>
+#include <cmath>
+#include "bone_geometry.h"
+#include "check.h"
+#include "motion_clip.h"
+
+namespace {
+
+const glm::vec4 kLinear(0.25f, 0.25f, 0.75f, 0.75f);
+const glm::vec4 kEaseIn(0.2f, 0.6f, 0.4f, 0.9f);
+
+/*
+ * At s = 1/2 the curve kEaseIn is at
+ *   x = 3/8 * 0.2 + 3/8 * 0.4 + 1/8 = 0.35
+ *   y = 3/8 * 0.6 + 3/8 * 0.9 + 1/8 = 0.6875
+ */
+const float kEaseX = 0.35f;
+const float kEaseY = 0.6875f;
+
+bool sameRotation(const glm::fquat& a, const glm::fquat& b) {
+    return std::abs(std::abs(glm::dot(a, b)) - 1.0f) < 1e-5f;
+}
+
+bool sameVector(const glm::vec3& a, const glm::vec3& b) {
+    return glm::length(a - b) < 1e-4f;
+}
+
+MotionKey key(int frame, const glm::fquat& rotation,
+              const glm::vec3& translation, const glm::vec4& x_curve,
+              const glm::vec4& rotation_curve) {
+    MotionKey k;
+    k.frame = frame;
+    k.rotation = rotation;
+    k.translation = translation;
+    k.curve[0] = x_curve;
+    k.curve[1] = kLinear;
+    k.curve[2] = x_curve;
+    k.curve[3] = rotation_curve;
+    return k;
+}
+
+void checkCurves() {
+    MotionCurve linear = MotionCurve::make(kLinear);
+    CHECK(linear.linear);
+    CHECK(linear.ease(0.3f) == 0.3f);
+
+    MotionCurve curve = MotionCurve::make(kEaseIn);
+    CHECK(!curve.linear);
+    CHECK_NEAR(curve.ease(kEaseX), kEaseY, 1e-4f);
+    CHECK_NEAR(curve.ease(0.0f), 0.0f, 1e-4f);
+    CHECK_NEAR(curve.ease(1.0f), 1.0f, 1e-4f);
+}
+
+void checkClip() {
+    const glm::fquat identity(1.0f, 0.0f, 0.0f, 0.0f);
+    const glm::fquat turn = glm::angleAxis(1.0f, glm::vec3(0.0f, 1.0f, 0.0f));
+    const glm::vec3 move(2.0f, 4.0f, -6.0f);
+    const glm::fquat tilt = glm::angleAxis(0.5f, glm::vec3(1.0f, 0.0f, 0.0f));
+    const glm::vec3 lift(0.0f, 1.0f, 0.0f);
+
+    // Joint 0 eases from frame 10 to 30, joint 1 has no keys, joint 2 one.
+    std::vector<std::vector<MotionKey>> keys(3);
+    keys[0].emplace_back(key(10, identity, glm::vec3(0.0f), kLinear, kLinear));
+    keys[0].emplace_back(key(30, turn, move, kEaseIn, kEaseIn));
+    keys[2].emplace_back(key(5, tilt, lift, kLinear, kLinear));
+    MotionClip clip;
+    clip.load(keys);
+    CHECK(clip.nframes == 31);
+    CHECK_NEAR(clip.duration(), 1.0f, 1e-6f);
+
+    // Frame 17 is 0.35 of the way, the x and z tracks and the rotation
+    // reach 0.6875 of theirs, the linear y track 0.35.
+    KeyFrame pose;
+    clip.sample(10.0f + 20.0f * kEaseX, pose);
+    CHECK(pose.rel_rot.size() == 3 && pose.rel_trans.size() == 3);
+    if (pose.rel_rot.size() != 3 || pose.rel_trans.size() != 3) return;
+    CHECK(sameVector(pose.rel_trans[0],
+                     glm::vec3(2.0f * kEaseY, 4.0f * kEaseX, -6.0f * kEaseY)));
+    CHECK(sameRotation(pose.rel_rot[0],
+                       glm::angleAxis(kEaseY, glm::vec3(0.0f, 1.0f, 0.0f))));
+    CHECK(sameRotation(pose.rel_rot[1], identity));
+    CHECK(sameVector(pose.rel_trans[1], glm::vec3(0.0f)));
+    CHECK(sameRotation(pose.rel_rot[2], tilt));
+    CHECK(sameVector(pose.rel_trans[2], lift));
+
+    // Before the first key and past the last the end keys are held, and
+    // frames off the timeline are clamped to it.
+    for (float frame : {-5.0f, 0.0f, 9.5f}) {
+        clip.sample(frame, pose);
+        CHECK(sameRotation(pose.rel_rot[0], identity));
+        CHECK(sameVector(pose.rel_trans[0], glm::vec3(0.0f)));
+        CHECK(sameRotation(pose.rel_rot[2], tilt));
+    }
+    for (float frame : {30.0f, 45.0f}) {
+        clip.sample(frame, pose);
+        CHECK(sameRotation(pose.rel_rot[0], turn));
+        CHECK(sameVector(pose.rel_trans[0], move));
+        CHECK(sameRotation(pose.rel_rot[1], identity));
+        CHECK(sameVector(pose.rel_trans[2], lift));
+    }
+}
+
+}  // namespace
+
+int main() {
+    checkCurves();
+    checkClip();
+    return checkFailures() != 0;
+}
@@ -0,0 +1,192 @@
+/*
+ * PhysicsReactor must give the same motion whatever the number of threads
+ * its islands are stepped on, and the motion must differ from the plain
+ * animation, or the comparison would prove nothing. Following the
+ * timeline must drop no step however slowly frames come, and must move
+ * baked playback as it moves live playback. On a single bone the
+ * rotation spring of a constraint must hold the swing, and its
+ * translation spring must not.
+ */
+#include <algorithm>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "bone_geometry.h"
+#include "check.h"
+#include "config.h"
+#include "physics_reactor.h"
+
+namespace {
+
+// Miku with four key frames that swing every fifth joint.
+void loadAnimated(const std::string& fn, Mesh& mesh) {
+    mesh.setModelCacheDir(testCacheDir());
+    mesh.loadPmd(fn);
+    glm::fquat step = glm::angleAxis(0.4f, glm::vec3(0.0f, 0.0f, 1.0f));
+    for (int k = 0; k < 4; k++) {
+        for (int j = 0; j < mesh.getNumberOfBones(); j += 5)
+            mesh.skeleton.rotate(j, step);
+        mesh.constructKeyFrame();
+    }
+}
+
+// Skinning palettes of 120 animated frames, with or without physics.
+std::vector<glm::mat4> simulate(const std::string& fn, int threads,
+                                bool physics_on) {
+#ifdef _OPENMP
+    omp_set_num_threads(threads);
+#endif
+    Mesh mesh;
+    loadAnimated(fn, mesh);
+
+    PhysicsReactor physics;
+    physics.addSkeleton(mesh.skeleton, mesh.rigid_bodies,
+                        mesh.spring_constraints);
+    physics.setFloor(true, kFloorY);
+    physics.reset();
+
+    std::vector<glm::mat4> palettes;
+    for (int f = 0; f < 120; f++) {
+        mesh.updateAnimation(f / 60.0f);
+        // Uneven frame times, so the carried remainder is exercised too.
+        if (physics_on && physics.react(f % 3 == 0 ? 0.02f : 0.015f) > 0)
+            mesh.refreshPose();
+        const auto& skin = mesh.getCurrentQ()->skin;
+        palettes.insert(palettes.end(), skin.begin(), skin.end());
+    }
+    return palettes;
+}
+
+/*
+ * Export as main does it: every stride-th frame of the timeline at the
+ * export rate, the physics following the timeline. Returns the palettes
+ * and counts the physics steps taken.
+ */
+std::vector<glm::mat4> exportFrames(const std::string& fn, bool baked,
+                                    bool physics_on, int stride,
+                                    int& steps) {
+    Mesh mesh;
+    loadAnimated(fn, mesh);
+    mesh.setBaked(baked);
+    PhysicsReactor physics;
+    physics.addSkeleton(mesh.skeleton, mesh.rigid_bodies,
+                        mesh.spring_constraints);
+    physics.setFloor(true, kFloorY);
+
+    std::vector<glm::mat4> palettes;
+    steps = 0;
+    for (int f = 0; f <= 120; f += stride) {
+        float t = f / kExportFps;
+        mesh.updateAnimation(t);
+        if (physics_on) {
+            steps += physics.follow(t);
+            if (mesh.skeleton.isDirty()) mesh.refreshPose();
+        }
+        const auto& skin = mesh.getCurrentQ()->skin;
+        palettes.insert(palettes.end(), skin.begin(), skin.end());
+    }
+    return palettes;
+}
+
+/*
+ * How far a horizontal bone droops in a second under gravity when its
+ * body is held by a constraint with the given springs: root, a shoulder
+ * at (0, 10, 0) and the tip of the bone 5 to its right.
+ */
+float droop(const glm::vec3& spring_rotation,
+            const glm::vec3& spring_translation) {
+    Skeleton skeleton;
+    skeleton.joints = {Joint(0, glm::vec3(0.0f), -1),
+                       Joint(1, glm::vec3(0.0f, 10.0f, 0.0f), 0),
+                       Joint(2, glm::vec3(5.0f, 10.0f, 0.0f), 1)};
+    skeleton.construct();
+
+    std::vector<RigidBody> bodies(2);
+    bodies[0].joint = 0;
+    bodies[0].size = glm::vec3(0.1f);
+    bodies[0].position = glm::vec3(0.0f);
+    bodies[0].rotation = glm::vec3(0.0f);
+    bodies[1].joint = 1;
+    bodies[1].type = RigidBody::kDynamic;
+    bodies[1].size = glm::vec3(0.5f);
+    bodies[1].position = glm::vec3(2.5f, 10.0f, 0.0f);
+    bodies[1].rotation = glm::vec3(0.0f);
+    bodies[1].linear_damping = 0.5f;
+    bodies[1].mask = 0;
+    std::vector<SpringConstraint> constraints(1);
+    SpringConstraint& c = constraints[0];
+    c.body[0] = 0;
+    c.body[1] = 1;
+    c.lo_rotation = glm::vec3(-1.0f);
+    c.hi_rotation = glm::vec3(1.0f);
+    c.lo_translation = c.hi_translation = glm::vec3(0.0f);
+    c.spring_rotation = spring_rotation;
+    c.spring_translation = spring_translation;
+
+    PhysicsReactor physics;
+    physics.addSkeleton(skeleton, bodies, constraints);
+    physics.reset();
+    for (int f = 0; f < 60; f++) {
+        skeleton.evaluate();
+        physics.react(1.0f / 60.0f);
+    }
+    skeleton.evaluate();
+    return 10.0f - skeleton.getPosition(2).y;
+}
+
+float maxDifference(const std::vector<glm::mat4>& a,
+                    const std::vector<glm::mat4>& b) {
+    float diff = 0.0f;
+    for (size_t i = 0; i < std::min(a.size(), b.size()); i++)
+        for (int c = 0; c < 4; c++)
+            diff = std::max(diff, glm::length(a[i][c] - b[i][c]));
+    return diff;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    // The rotation spring holds the swing, the translation spring only
+    // holds the distance, which is locked here.
+    float free = droop(glm::vec3(0.0f), glm::vec3(0.0f));
+    float held = droop(glm::vec3(1e4f), glm::vec3(0.0f));
+    float distance_only = droop(glm::vec3(0.0f), glm::vec3(1e4f));
+    std::printf("droop: free %g, rotation spring %g, translation spring %g\n",
+                free, held, distance_only);
+    CHECK(free > 1.0f);
+    CHECK(held < 0.1f);
+    CHECK(std::abs(distance_only - free) < 1e-3f);
+
+    std::string fn = assetPath(argc, argv, "Miku_Hatsune.pmd");
+    std::vector<glm::mat4> serial = simulate(fn, 1, true);
+    float moved = maxDifference(serial, simulate(fn, 1, false));
+    std::printf("physics moves the palette by up to %g\n", moved);
+    CHECK(moved > 1e-3f);
+    for (int threads : {1, 3, 8}) {
+        std::vector<glm::mat4> parallel = simulate(fn, threads, true);
+        CHECK(parallel.size() == serial.size());
+        float diff = maxDifference(serial, parallel);
+        std::printf("%d threads: max difference %g\n", threads, diff);
+        CHECK(diff == 0.0f);
+    }
+
+    // On the timeline two seconds are 240 steps, however few frames they
+    // are rendered in, and a baked export gets the same physics as a live
+    // one.
+    int steps = 0, slow_steps = 0, baked_steps = 0, unused = 0;
+    std::vector<glm::mat4> live = exportFrames(fn, false, true, 1, steps);
+    exportFrames(fn, false, true, 10, slow_steps);
+    std::vector<glm::mat4> baked = exportFrames(fn, true, true, 1, baked_steps);
+    std::vector<glm::mat4> still = exportFrames(fn, true, false, 1, unused);
+    std::printf("timeline steps %d, rendering every tenth frame %d\n", steps,
+                slow_steps);
+    CHECK(steps == 240 && slow_steps == 240 && baked_steps == 240);
+    float baked_moved = maxDifference(baked, still);
+    float baked_diff = maxDifference(baked, live);
+    std::printf("baked: physics moves by %g, off the live export by %g\n",
+                baked_moved, baked_diff);
+    CHECK(baked_moved > 1e-3f);
+    CHECK(baked_diff < 1e-4f);
+    return checkFailures() != 0;
+}
@@ -0,0 +1,84 @@
+/*
+ * Key frame playback must not touch the heap once its scratch buffers are
+ * sized: every operator new after the warm-up frame is counted.
+ */
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "bone_geometry.h"
+#include "check.h"
+
+namespace {
+
+std::atomic<long> allocations(0);
+
+// Allocations made by running f.
+template <typename F>
+long countAllocations(F f) {
+    long before = allocations.load();
+    f();
+    return allocations.load() - before;
+}
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+    allocations++;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) { return operator new(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+
+int main(int argc, char* argv[]) {
+    Mesh mesh;
+    mesh.setModelCacheDir(testCacheDir());
+    mesh.loadPmd(assetPath(argc, argv, "Miku_Hatsune.pmd"));
+    int njoints = mesh.getNumberOfBones();
+    CHECK(njoints > 0);
+
+    // Three keys with every joint turned a little further each time.
+    glm::fquat step = glm::angleAxis(0.2f, glm::vec3(0.0f, 0.0f, 1.0f));
+    for (int k = 0; k < 3; k++) {
+        for (int j = 0; j < njoints; j++) mesh.skeleton.rotate(j, step);
+        mesh.constructKeyFrame();
+    }
+
+    struct Mode {
+        const char* name;
+        bool spline, compressed, ik;
+    } modes[] = {
+        {"linear", false, false, false},
+        {"spline", true, false, false},
+        {"compressed", false, true, false},
+        {"linear+ik", false, false, true},
+    };
+    for (const Mode& mode : modes) {
+        mesh.setSpline(mode.spline);
+        mesh.setCompressed(mode.compressed);
+        mesh.setIK(mode.ik);
+        mesh.updateAnimation(0.5f);  // warm-up sizes the scratch buffers
+        long n = countAllocations([&] {
+            for (int f = 0; f < 120; f++) mesh.updateAnimation(f / 60.0f);
+        });
+        std::printf("%-10s %ld allocations in 120 frames\n", mode.name, n);
+        CHECK(n == 0);
+    }
+
+    // Direct edits refresh the palette in place as well.
+    mesh.setIK(false);
+    mesh.refreshPose();
+    long n = countAllocations([&] {
+        for (int f = 0; f < 120; f++) {
+            mesh.skeleton.rotate(f % njoints, step);
+            mesh.refreshPose();
+        }
+    });
+    std::printf("%-10s %ld allocations in 120 frames\n", "refresh", n);
+    CHECK(n == 0);
+    return checkFailures() != 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * PMX through MMDReader on generated files: the bulk decode must match the
+ * Model a full PmxReader read builds, for every index size and both text
+ * encodings, and UTF-16 strings must join their surrogate pairs.
+ */
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <mmdadapter.h>
+#include "check.h"
+#include "mmd/mmdslim.hh"
+#include "pmx_writer.h"
+
+namespace {
+
+const std::u32string kBoneNames[] = {U"センター", U"b\U0001F600", U"b2"};
+
+/*
+ * Four vertices, one of each skinning type unless without SDEF, two
+ * triangles, three bones in a chain and one vertex morph.
+ */
+std::vector<char> makePmx(bool utf8, int vertex_index_size, bool sdef) {
+    PmxWriter w(utf8, vertex_index_size);
+    const char magic[] = {'P', 'M', 'X', ' '};
+    for (char c : magic) w.put(c);
+    w.put(2.0f);
+    w.put(uint8_t(8));
+    for (int g : {utf8 ? 1 : 0, 1, vertex_index_size, 1, 1, 2, 1, 1})
+        w.put(uint8_t(g));
+    w.text(U"ミク");
+    w.text(U"Miku");
+    w.text(U"");
+    w.text(U"");
+
+    w.put(int32_t(4));
+    for (int i = 0; i < 4; i++) {
+        float f = i;
+        w.floats({f, 2 * f, 3 * f, 0.0f, 1.0f, 0.0f, 0.25f * f, 1.0f - 0.25f * f});
+        w.floats({9.0f, 9.0f, 9.0f, 9.0f});  // the extra UV
+        int type = i == 3 && !sdef ? 1 : i;
+        w.put(uint8_t(type));
+        switch (type) {
+            case 0:
+                w.boneIndex(1);
+                break;
+            case 1:
+                w.boneIndex(0);
+                w.boneIndex(1);
+                w.put(0.25f);
+                break;
+            case 2:
+                for (int b : {0, 1, 2, 0}) w.boneIndex(b);
+                w.floats({0.5f, 0.3f, 0.2f, 0.0f});
+                break;
+            case 3:
+                w.boneIndex(1);
+                w.boneIndex(2);
+                w.put(0.6f);
+                w.floats({0, 1, 2, 3, 4, 5, 6, 7, 8});
+                break;
+        }
+        w.put(1.0f);  // edge scale
+    }
+    w.put(int32_t(6));
+    for (int i : {0, 1, 2, 1, 2, 3}) w.vertexIndex(i);
+    w.put(int32_t(0));  // textures
+    w.put(int32_t(0));  // materials
+
+    w.put(int32_t(3));
+    for (int i = 0; i < 3; i++) {
+        w.text(kBoneNames[i]);
+        w.text(U"bone");
+        w.floats({0.0f, float(i), 0.0f});
+        w.boneIndex(i - 1);
+        w.put(int32_t(0));       // layer
+        w.put(uint16_t(0x000A));  // rotatable, visible, tail by offset
+        w.floats({0.0f, 1.0f, 0.0f});
+    }
+
+    w.put(int32_t(1));
+    w.text(U"あ");
+    w.text(U"a");
+    w.put(uint8_t(0));  // panel
+    w.put(uint8_t(1));  // vertex morph
+    w.put(int32_t(2));
+    w.vertexIndex(1);
+    w.floats({1.0f, 0.0f, 0.0f});
+    w.vertexIndex(3);
+    w.floats({0.0f, 1.0f, 0.0f});
+
+    for (int i = 0; i < 3; i++) w.put(int32_t(0));  // frames, bodies, joints
+    return w.bytes();
+}
+
+std::string writeFile(const std::string& fn, const std::vector<char>& bytes) {
+    std::ofstream out(fn, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+    return fn;
+}
+
+bool near(float a, float b, float eps = 1e-6f) {
+    return std::abs(a - b) <= eps;
+}
+
+void checkPmx(bool utf8, int vertex_index_size, bool sdef) {
+    std::string fn = writeFile("test_pmx_reader.pmx",
+                               makePmx(utf8, vertex_index_size, sdef));
+    MMDReader reader;
+    CHECK(reader.open(fn));
+    std::vector<glm::vec4> V, N;
+    std::vector<glm::uvec3> F;
+    std::vector<glm::vec2> UV;
+    reader.getMesh(V, F, N, UV);
+
+    // Geometry against the Model a full read builds one vertex at a time.
+    mmd::FileReader file(fn);
+    mmd::Model model;
+    mmd::PmxReader(file).ReadModel(model);
+    CHECK(V.size() == 4 && model.GetVertexNum() == 4);
+    CHECK(F.size() == 2 && model.GetTriangleNum() == 2);
+    if (V.size() != 4 || F.size() != 2 || model.GetVertexNum() != 4 ||
+        model.GetTriangleNum() != 2)
+        return;
+    bool same = true;
+    for (size_t i = 0; i < V.size(); i++) {
+        auto vertex = model.GetVertex(i);
+        for (int k = 0; k < 3; k++)
+            same = same && near(V[i][k], vertex.GetCoordinate().v[k]) &&
+                   near(N[i][k], vertex.GetNormal().v[k]);
+        for (int k = 0; k < 2; k++)
+            same = same && near(UV[i][k], vertex.GetUVCoordinate().v[k]);
+        same = same && near(V[i][1], 2.0f * i);
+    }
+    for (size_t i = 0; i < F.size(); i++)
+        for (int k = 0; k < 3; k++)
+            same = same && F[i][k] == model.GetTriangle(i).v[k] &&
+                   F[i][k] == i + k;
+    CHECK(same);
+
+    // Influences as written, sorted by decreasing weight unless SDEF.
+    std::vector<VertexSkin> skins;
+    reader.getSkinning(skins);
+    CHECK(skins.size() == 4);
+    if (skins.size() == 4) {
+        CHECK(skins[0].jid[0] == 1 && near(skins[0].weight[0], 1.0f));
+        CHECK(skins[1].jid[0] == 1 && near(skins[1].weight[0], 0.75f));
+        CHECK(skins[1].jid[1] == 0 && near(skins[1].weight[1], 0.25f));
+        CHECK(near(skins[2].weight[0], 0.5f) && near(skins[2].weight[1], 0.3f) &&
+              near(skins[2].weight[2], 0.2f) && skins[2].jid[2] == 2);
+        CHECK(skins[3].sdef == sdef);
+        if (sdef)
+            CHECK(skins[3].sdef_c == glm::vec3(0, 1, 2) &&
+                  skins[3].sdef_r0 == glm::vec3(3, 4, 5) &&
+                  skins[3].sdef_r1 == glm::vec3(6, 7, 8));
+    }
+
+    // The bulk path declines SDEF, otherwise it agrees with the above.
+    std::vector<glm::vec4> BV, BN;
+    std::vector<glm::uvec3> BF;
+    std::vector<glm::vec2> BUV;
+    std::vector<glm::u16vec4> ids, weights;
+    bool bulk = reader.getSkinnedMesh(BV, BF, BN, BUV, ids, weights);
+    CHECK(bulk == !sdef);
+    if (bulk) {
+        CHECK(BV == V && BF == F && BN == N && BUV == UV);
+        CHECK(ids[1][0] == 1 && ids[1][1] == 0 &&
+              std::abs(weights[1][0] - 0.75f * 65535) <= 1.0f);
+    }
+
+    for (int i = 0; i < 3; i++) {
+        std::wstring name;
+        CHECK(reader.getJointName(i, name));
+        CHECK(name == std::wstring(kBoneNames[i].begin(), kBoneNames[i].end()));
+    }
+    std::vector<VertexMorph> morphs;
+    reader.getMorphs(morphs);
+    CHECK(morphs.size() == 1);
+    if (morphs.size() == 1)
+        CHECK(morphs[0].vid == std::vector<int>({1, 3}) &&
+              morphs[0].offset[1] == glm::vec3(0, 1, 0));
+}
+
+// ReadString on raw UTF-16: pairs are joined, a lone surrogate is kept.
+void checkSurrogates() {
+    std::vector<char> bytes;
+    auto unit = [&](uint16_t u) {
+        bytes.emplace_back(char(u & 0xFF));
+        bytes.emplace_back(char(u >> 8));
+    };
+    for (uint16_t u : {0x0061, 0xD83D, 0xDE00, 0x0062, 0xD83D, 0x0063})
+        unit(u);
+    int32_t length = bytes.size();
+    std::vector<char> file(sizeof(length));
+    std::memcpy(file.data(), &length, sizeof(length));
+    file.insert(file.end(), bytes.begin(), bytes.end());
+    mmd::FileReader reader(writeFile("test_pmx_reader.utf16", file));
+    std::wstring s = reader.ReadString(false);
+    std::wstring expected = {L'a', wchar_t(0x1F600), L'b', wchar_t(0xD83D),
+                             L'c'};
+    CHECK(s == expected);
+
+    // The same text as UTF-8 gives the same code points.
+    const char utf8[] = "a\xF0\x9F\x98\x80" "b";
+    length = sizeof(utf8) - 1;
+    file.resize(sizeof(length));
+    std::memcpy(file.data(), &length, sizeof(length));
+    file.insert(file.end(), utf8, utf8 + length);
+    mmd::FileReader utf8_reader(writeFile("test_pmx_reader.utf8", file));
+    CHECK(utf8_reader.ReadString(true) == expected.substr(0, 3));
+}
+
+}  // namespace
+
+int main() {
+    static_assert(sizeof(wchar_t) == 4, "UTF-16 is joined into code points");
+    for (bool utf8 : {true, false})
+        for (int size : {1, 2, 4})
+            for (bool sdef : {true, false}) checkPmx(utf8, size, sdef);
+    checkSurrogates();
+    return checkFailures() != 0;
+}
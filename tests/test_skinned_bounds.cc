@@ -0,0 +1,135 @@
+/*
+ * Mesh::getSkinnedBounds must hold every vertex CpuSkinner produces, for
+ * posed skeletons and any mix of morph weights up to kMaxMorphWeight: on
+ * Miku, and on a generated model whose morphs stack on one corner.
+ */
+#include <fstream>
+#include "bone_geometry.h"
+#include "check.h"
+#include "config.h"
+#include "cpu_skinning.h"
+#include "pmx_writer.h"
+
+namespace {
+
+// Rounding of the box transforms, far below a model unit.
+const float kSlack = 1e-4f;
+
+/*
+ * A unit square on one bone. Morphs "a" and "b" both push its corner
+ * (1, 1, 0) one unit along x, so together it reaches x = 3, past what
+ * either alone moves it to.
+ */
+std::string writeStackedMorphs(const std::string& fn) {
+    PmxWriter w(true, 4);
+    const char magic[] = {'P', 'M', 'X', ' '};
+    for (char c : magic) w.put(c);
+    w.put(2.0f);
+    w.put(uint8_t(8));
+    for (int g : {1, 0, 4, 1, 1, 2, 1, 1}) w.put(uint8_t(g));
+    for (int i = 0; i < 4; i++) w.text(U"");
+
+    w.put(int32_t(4));
+    for (int i = 0; i < 4; i++) {
+        w.floats({float(i & 1), float(i >> 1), 0.0f, 0.0f, 0.0f, 1.0f, 0.0f,
+                  0.0f});
+        w.put(uint8_t(0));  // BDEF1
+        w.boneIndex(0);
+        w.put(1.0f);  // edge scale
+    }
+    w.put(int32_t(6));
+    for (int i : {0, 1, 2, 1, 3, 2}) w.vertexIndex(i);
+    w.put(int32_t(0));  // textures
+    w.put(int32_t(0));  // materials
+
+    w.put(int32_t(1));
+    w.text(U"センター");
+    w.text(U"center");
+    w.floats({0.0f, 0.0f, 0.0f});
+    w.boneIndex(-1);
+    w.put(int32_t(0));        // layer
+    w.put(uint16_t(0x000A));  // rotatable, visible, tail by offset
+    w.floats({0.0f, 1.0f, 0.0f});
+
+    w.put(int32_t(2));
+    for (const char32_t* name : {U"a", U"b"}) {
+        w.text(name);
+        w.text(name);
+        w.put(uint8_t(0));  // panel
+        w.put(uint8_t(1));  // vertex morph
+        w.put(int32_t(1));
+        w.vertexIndex(3);
+        w.floats({1.0f, 0.0f, 0.0f});
+    }
+
+    for (int i = 0; i < 3; i++) w.put(int32_t(0));  // frames, bodies, joints
+    std::ofstream out(fn, std::ios::binary | std::ios::trunc);
+    out.write(w.bytes().data(), w.bytes().size());
+    return fn;
+}
+
+// Vertices of the last skin() outside the box.
+int countOutside(const CpuSkinner& skinner, const BoundingBox& box) {
+    int outside = 0;
+    for (const glm::vec4& p : skinner.positions()) {
+        bool inside = true;
+        for (int k = 0; k < 3; k++)
+            inside = inside && p[k] >= box.min[k] - kSlack &&
+                     p[k] <= box.max[k] + kSlack;
+        if (!inside) outside++;
+    }
+    return outside;
+}
+
+void checkModel(const std::string& fn) {
+    Mesh mesh;
+    mesh.setModelCacheDir(testCacheDir());
+    mesh.loadPmd(fn);
+    int nmorphs = mesh.morphs.size();
+    CHECK(nmorphs > 1);
+
+    // Weight sets: none, every morph at once, every other, halfway.
+    std::vector<std::vector<float>> weight_sets = {
+        std::vector<float>(nmorphs, 0.0f),
+        std::vector<float>(nmorphs, kMaxMorphWeight),
+        std::vector<float>(nmorphs, 0.0f),
+        std::vector<float>(nmorphs, 0.5f * kMaxMorphWeight)};
+    for (int m = 0; m < nmorphs; m += 2) weight_sets[2][m] = kMaxMorphWeight;
+
+    CpuSkinner skinner;
+    for (int pose = 0; pose < 3; pose++) {
+        if (pose > 0) {
+            for (int j = pose % 2; j < mesh.getNumberOfBones(); j += 2) {
+                glm::vec3 axis = glm::normalize(glm::vec3(j % 3, 1, j % 5));
+                mesh.skeleton.rotate(j, glm::angleAxis(0.2f * pose, axis));
+            }
+            mesh.skeleton.translate(glm::vec3(0.5f, -0.25f, 0.1f * pose));
+        }
+        mesh.refreshPose();
+        const BoundingBox& box = mesh.getSkinnedBounds();
+        for (const std::vector<float>& weights : weight_sets) {
+            for (int m = 0; m < nmorphs; m++)
+                mesh.morphs.setWeight(m, weights[m]);
+            size_t first, last;
+            mesh.applyMorphs(first, last);
+            skinner.skin(mesh, *mesh.getCurrentQ(),
+                         SkinningMode::kLinearBlend);
+            int outside = countOutside(skinner, box);
+            if (outside > 0)
+                std::printf("%s, pose %d, weights %g, %g: %d outside\n",
+                            fn.c_str(), pose, weights[0], weights[1],
+                            outside);
+            CHECK(outside == 0);
+        }
+    }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    checkModel(assetPath(argc, argv, "Miku_Hatsune.pmd"));
+    const std::string stacked = "test_skinned_bounds.pmx";
+    checkModel(writeStackedMorphs(stacked));
+    std::remove(stacked.c_str());
+    return checkFailures() != 0;
+}
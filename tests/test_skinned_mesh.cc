@@ -0,0 +1,86 @@
+/*
+ * MMDReader::getSkinnedMesh against the per-element paths: the geometry
+ * must match a full PmdReader read vertex by vertex, the influences must
+ * match getSkinning up to the unorm16 rounding.
+ */
+#include <cmath>
+#include <mmdadapter.h>
+#include "check.h"
+#include "mmd/mmdslim.hh"
+
+namespace {
+
+const char* kModels[] = {
+    "Miku_Hatsune.pmd", "Miku_Hatsune_Ver2.pmd", "Rin_Kagamine.pmd",
+    "Len_Kagamine.pmd", "KAITO.pmd",             "MEIKO.pmd",
+    "Haku_Yowane.pmd",  "Neru_Akita.pmd",
+};
+
+bool near(float a, float b) { return std::abs(a - b) <= 1e-6f; }
+
+void checkModel(const std::string& fn) {
+    MMDReader reader;
+    CHECK(reader.open(fn));
+    std::vector<glm::vec4> V, N;
+    std::vector<glm::uvec3> F;
+    std::vector<glm::vec2> UV;
+    std::vector<glm::u16vec4> ids, weights;
+    CHECK(reader.getSkinnedMesh(V, F, N, UV, ids, weights));
+
+    // Geometry against the Model a full read builds one vertex at a time.
+    mmd::FileReader file(fn);
+    mmd::Model model;
+    mmd::PmdReader(file).ReadModel(model);
+    CHECK(V.size() == model.GetVertexNum());
+    CHECK(F.size() == model.GetTriangleNum());
+    bool same = V.size() == model.GetVertexNum();
+    for (size_t i = 0; same && i < V.size(); i++) {
+        auto vertex = model.GetVertex(i);
+        for (int k = 0; k < 3; k++) {
+            same = same && near(V[i][k], vertex.GetCoordinate().v[k]) &&
+                   near(N[i][k], vertex.GetNormal().v[k]);
+        }
+        for (int k = 0; k < 2; k++)
+            same = same && near(UV[i][k], vertex.GetUVCoordinate().v[k]);
+        same = same && V[i][3] == 1.0f && N[i][3] == 0.0f;
+    }
+    for (size_t i = 0; same && i < F.size(); i++)
+        for (int k = 0; k < 3; k++)
+            same = same && F[i][k] == model.GetTriangle(i).v[k];
+    CHECK(same);
+
+    // Influences against getSkinning, unbound vertices follow joint 0.
+    std::vector<VertexSkin> skins;
+    reader.getSkinning(skins);
+    std::vector<int> skin_of_vertex(V.size(), -1);
+    for (size_t s = 0; s < skins.size(); s++)
+        skin_of_vertex[skins[s].vid] = s;
+    bool influences = true;
+    for (size_t i = 0; i < V.size(); i++) {
+        int sum = weights[i][0] + weights[i][1] + weights[i][2] +
+                  weights[i][3];
+        influences = influences && sum == 65535;
+        if (skin_of_vertex[i] < 0) {
+            influences = influences && ids[i][0] == 0 && weights[i][0] == 65535;
+            continue;
+        }
+        const VertexSkin& skin = skins[skin_of_vertex[i]];
+        for (int k = 0; k < 4; k++) {
+            // Slot 0 also takes the rounding error of the others.
+            float tolerance = (k == 0 ? 4.0f : 1.0f) / 65535.0f;
+            influences = influences &&
+                         std::abs(weights[i][k] / 65535.0f - skin.weight[k]) <=
+                             tolerance;
+            if (skin.weight[k] > 0.0f)
+                influences = influences && ids[i][k] == skin.jid[k];
+        }
+    }
+    CHECK(influences);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    for (const char* name : kModels) checkModel(assetPath(argc, argv, name));
+    return checkFailures() != 0;
+}